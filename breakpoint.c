@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "cpu.h"
+#include "bus.h"
+#include "breakpoint.h"
+
+/*
+ * One predicate per register and comparison, a condition is a list of
+ * them with their operands. Longer names and operators come first, the
+ * parser takes the first one that matches.
+ */
+
+#define REGISTERS(R) \
+  R(PC, c->pc)       \
+  R(SP, c->sp)       \
+  R(A, c->a)         \
+  R(X, c->x)         \
+  R(Y, c->y)         \
+  R(P, get_flags(c))
+
+#define COMPARISONS(OP, name, value) \
+  OP(name, value, EQ, ==)            \
+  OP(name, value, NE, !=)            \
+  OP(name, value, LE, <=)            \
+  OP(name, value, GE, >=)            \
+  OP(name, value, LT, <)             \
+  OP(name, value, GT, >)
+
+#define PREDICATE(name, value, op, symbol)                \
+  static bool                                             \
+  name##_##op(MOS_6510* const c, uint16_t operand)        \
+  {                                                       \
+    return (value) symbol operand;                        \
+  }
+#define REGISTER_PREDICATES(name, value) COMPARISONS(PREDICATE, name, value)
+REGISTERS(REGISTER_PREDICATES)
+#undef REGISTER_PREDICATES
+#undef PREDICATE
+
+#define ENTRY(name, value, op, symbol) name##_##op,
+#define REGISTER_ENTRY(name, value) { #name, { COMPARISONS(ENTRY, name, value) } },
+static const struct
+{
+  const char* name;
+  predicate test[6];
+} registers[] = { REGISTERS(REGISTER_ENTRY) };
+#undef REGISTER_ENTRY
+#undef ENTRY
+
+#define SYMBOL(name, value, op, symbol) #symbol,
+static const char* const symbols[] = { COMPARISONS(SYMBOL, , ) };
+#undef SYMBOL
+
+static const char*
+skip_spaces(const char* p)
+{
+  while(*p == ' ' || *p == '\t') p++;
+  return p;
+}
+
+/* "A==0 && X>=$10": REGISTER OPERATOR VALUE, joined by && */
+
+static bool
+parse(struct condition* const condition, const char* text)
+{
+  const char* p = skip_spaces(text);
+
+  condition->terms = 0;
+
+  while(true)
+  {
+    uint8_t r = 0, op = 0;
+
+    while(r < sizeof(registers) / sizeof(registers[0]) && strncasecmp(p, registers[r].name, strlen(registers[r].name)) != 0) r++;
+    if(r == sizeof(registers) / sizeof(registers[0])) return false;
+    p = skip_spaces(p + strlen(registers[r].name));
+
+    while(op < sizeof(symbols) / sizeof(symbols[0]) && strncmp(p, symbols[op], strlen(symbols[op])) != 0) op++;
+    if(op == sizeof(symbols) / sizeof(symbols[0])) return false;
+    p = skip_spaces(p + strlen(symbols[op]));
+
+    const char* const digits = *p == '$' ? p + 1 : p;
+    char* end;
+    const unsigned long value = strtoul(digits, &end, digits == p ? 10 : 16);
+
+    if(end == digits || value > 0xFFFF || condition->terms == CONDITION_TERMS) return false;
+
+    condition->term[condition->terms].test = registers[r].test[op];
+    condition->term[condition->terms].value = value;
+    condition->terms++;
+
+    p = skip_spaces(end);
+    if(*p == '\0') return true;
+    if(strncmp(p, "&&", 2) != 0) return false;
+    p = skip_spaces(p + 2);
+  }
+}
+
+static bool
+is_set(const struct breakpoints* const b, uint16_t addr)
+{
+  return b->bitmap[addr >> 3] & 1 << (addr & 7);
+}
+
+/* Drops the conditions of `addr`, it stops unconditionally if its bit stays set */
+
+static void
+drop_conditions(struct breakpoints* const b, uint16_t addr)
+{
+  uint8_t kept = 0;
+
+  for(uint8_t i = 0; i < b->condition_count; i++)
+  {
+    if(b->conditions[i].addr != addr) b->conditions[kept++] = b->conditions[i];
+  }
+  b->condition_count = kept;
+}
+
+static bool
+has_conditions(const struct breakpoints* const b, uint16_t addr)
+{
+  for(uint8_t i = 0; i < b->condition_count; i++)
+  {
+    if(b->conditions[i].addr == addr) return true;
+  }
+  return false;
+}
+
+/*
+ * Stops at `addr` when the condition holds, every time if it is NULL.
+ * Conditions of one address add up, an unconditional breakpoint stays
+ * one. False if the condition doesn't parse or there is no room for it.
+ */
+
+bool
+breakpoint_set(MOS_6510* const c, uint16_t addr, const char* condition)
+{
+  struct breakpoints* const b = &c->breakpoints;
+  const bool unconditional = is_set(b, addr) && !has_conditions(b, addr);
+
+  if(condition == NULL) drop_conditions(b, addr);
+  else if(!unconditional)
+  {
+    struct condition parsed;
+
+    if(!parse(&parsed, condition) || b->condition_count == BREAK_CONDITIONS) return false;
+
+    parsed.addr = addr;
+    b->conditions[b->condition_count++] = parsed;
+  }
+
+  if(!is_set(b, addr))
+  {
+    b->bitmap[addr >> 3] |= 1 << (addr & 7);
+    b->count++;
+  }
+
+  b->armed = true;
+#ifdef BLOCK_CORE
+  blocks_flush(c); // Blocks are cut in front of breakpoints
+#endif
+  return true;
+}
+
+void
+breakpoint_clear(MOS_6510* const c, uint16_t addr)
+{
+  struct breakpoints* const b = &c->breakpoints;
+
+  if(!is_set(b, addr)) return;
+
+  drop_conditions(b, addr);
+  b->bitmap[addr >> 3] &= ~(1 << (addr & 7));
+  b->count--;
+
+  b->armed = b->count || b->hit;
+#ifdef BLOCK_CORE
+  blocks_flush(c);
+#endif
+}
+
+/* PC is on a breakpoint, true if it stops there */
+
+bool
+breakpoint_hit(MOS_6510* const c)
+{
+  const struct breakpoints* const b = &c->breakpoints;
+  bool conditional = false;
+
+  for(uint8_t i = 0; i < b->condition_count; i++)
+  {
+    const struct condition* const condition = &b->conditions[i];
+    uint8_t t = 0;
+
+    if(condition->addr != c->pc) continue;
+
+    conditional = true;
+    while(t < condition->terms && condition->term[t].test(c, condition->term[t].value)) t++;
+    if(t == condition->terms) return true;
+  }
+
+  return !conditional;
+}
+
+/* Watches `access` (WATCH_READ/WATCH_WRITE, 0 to stop watching) of every address in the range */
+
+bool
+watch_set(MOS_6510* const c, uint16_t first, uint16_t last, uint8_t access)
+{
+  if(first > last) return false;
+
+  return bus_watch(c, first, last, access);
+}
+
+void
+watch_hit(MOS_6510* const c, uint16_t addr, uint8_t access)
+{
+  c->breakpoints.hit |= access;
+  c->breakpoints.hit_addr = addr;
+  c->breakpoints.armed = true;
+}
@@ -0,0 +1,68 @@
+#ifndef _6510_BREAKPOINT
+#define _6510_BREAKPOINT
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Stop conditions of run_cycles() besides traps, JAMs and the watchdog.
+ *
+ * Execute breakpoints are one bit per address, tested after every
+ * instruction with the PC it left, so a run started on a breakpoint gets
+ * past it. A breakpoint may carry conditions ("A==0 && X>=$10"), parsed
+ * once into one predicate per comparison and only evaluated when the bit
+ * is hit; it stops when any of its conditions holds. Values are decimal,
+ * hex with a leading '$' ("X==16" and "X==$10" are the same).
+ *
+ * Watchpoints mark single addresses of the bus (see bus_watch()), so only
+ * their pages leave the pointer fast path. Zero page and stack can only be
+ * watched with LOW_WATCHPOINTS, then every access there tests whether any
+ * address in them is watched, and looks the address up if so. CORE=jit
+ * translates nothing meanwhile. A hit stops the run after the instruction
+ * that made it.
+ *
+ * None of it is looked at while c->breakpoints.armed is clear.
+ */
+
+struct MOS_6510;
+
+#define WATCH_READ 0x1
+#define WATCH_WRITE 0x2
+
+#define BREAK_CONDITIONS 16 // Conditions of all breakpoints together
+#define CONDITION_TERMS 4 // Comparisons joined by && in one condition
+
+typedef bool (*predicate)(struct MOS_6510* const c, uint16_t value);
+
+struct condition
+{
+  uint16_t addr; // Breakpoint it belongs to
+  uint8_t terms;
+  struct
+  {
+    predicate test;
+    uint16_t value;
+  } term[CONDITION_TERMS];
+};
+
+struct breakpoints
+{
+  bool armed; // Any bit set or a watchpoint hit
+  uint8_t hit; // WATCH_READ/WATCH_WRITE of the watchpoint the last instruction hit, 0 if none
+  uint16_t hit_addr;
+  uint32_t count; // Bits set
+
+  uint8_t condition_count;
+  struct condition conditions[BREAK_CONDITIONS];
+
+  uint8_t bitmap[0x2000]; // One bit per address
+};
+
+bool breakpoint_set(struct MOS_6510* const c, uint16_t addr, const char* condition);
+void breakpoint_clear(struct MOS_6510* const c, uint16_t addr);
+bool breakpoint_hit(struct MOS_6510* const c);
+
+bool watch_set(struct MOS_6510* const c, uint16_t first, uint16_t last, uint8_t access);
+void watch_hit(struct MOS_6510* const c, uint16_t addr, uint8_t access);
+
+#endif // _6510_BREAKPOINT
@@ -1,6 +1,10 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "cpu.h"
 #include "bus.h"
 #include "debug.h"
+#include "breakpoint.h"
 
 #define LORAM 0x1 // (BIT 0, WEIGHT 1)
 #define HIRAM 0x2 // (BIT 1, WEIGHT 2)
@@ -14,22 +18,16 @@
  *
  */
 
-uint8_t 
-rb(MOS_6510* const c, uint16_t addr)
-{
-  return c->ram[addr & 0xFFFF];
-}
-
-uint16_t
-rw(MOS_6510* const c, uint16_t addr)
+uint8_t
+read_handled(MOS_6510* const c, uint16_t addr)
 {
-  return rb(c, addr + 1) << 8 | rb(c, addr);
+  return c->bus->pages[addr >> 8].read_fn(c, addr);
 }
 
-void 
-wb(MOS_6510* const c, uint16_t addr, uint8_t value)
+void
+write_handled(MOS_6510* const c, uint16_t addr, uint8_t value)
 {
-  c->ram[addr & 0xFFFF] = value;
+  c->bus->pages[addr >> 8].write_fn(c, addr, value);
 }
 
 void
@@ -39,47 +37,388 @@ ww(MOS_6510* const c, uint16_t addr, uint16_t value)
   wb(c, addr + 1, (value & 0xFF) >> 8);
 }
 
-uint8_t 
-fetch_byte(MOS_6510* const c)
+/* PC left the cached code page, look up the new one */
+
+uint8_t
+fetch_slow(MOS_6510* const c, uint16_t pc)
+{
+  const uint8_t* const page = c->bus->pages[pc >> 8].read;
+
+  if(page == NULL) return read_handled(c, pc);
+
+  c->code = page;
+  c->code_page = pc >> 8;
+  return page[pc & 0xFF];
+}
+
+/* Memory map */
+
+static void
+unmapped_write(MOS_6510* const c, uint16_t addr, uint8_t value)
+{
+  (void) c;
+  (void) addr;
+  (void) value;
+}
+
+static uint8_t
+unmapped_read(MOS_6510* const c, uint16_t addr)
+{
+  (void) c;
+  return addr >> 8; // Open bus, the last byte on the bus was the high byte of the address
+}
+
+/* Zero page and stack are always plain RAM, rb()/wb() access them through c->low */
+
+static void
+check_range(MOS_6510* const c, uint8_t first, uint16_t count, bool low_allowed)
+{
+  if(first + count > 0x100)
+  {
+    fprintf(stderr, "\n**" RED " Error " RESET "**" " mapping past the end of the address space\n");
+    exit(1);
+  }
+
+  if(first < 2 && (!low_allowed || first != 0 || count < 2))
+  {
+    fprintf(stderr, "\n**" RED " Error " RESET "**" " zero page and stack must be mapped together as RAM\n");
+    exit(1);
+  }
+
+  c->code_page = -1; // Mapping may have changed under the cached code page
+#ifdef BLOCK_CORE
+  blocks_flush(c);
+#endif
+}
+
+/* Drops the private copy of a page that gets mapped to something else */
+
+static void
+release(struct bus* const b, uint8_t page)
+{
+  free(b->copies[page]);
+  b->copies[page] = NULL;
+  b->image[page] = NULL;
+}
+
+/* Gives this address space its own copy of a map_image() page */
+
+static uint8_t*
+private_copy(MOS_6510* const c, uint8_t page)
+{
+  struct bus* const b = c->bus;
+  struct page* const p = page_mapping(b, page);
+  uint8_t* const copy = malloc(0x100);
+
+  if(copy == NULL)
+  {
+    fprintf(stderr, "\n**" RED " Error " RESET "**" " out of memory copying page $%02X\n", page);
+    exit(1);
+  }
+
+  memcpy(copy, b->image[page], 0x100);
+  b->copies[page] = copy;
+
+  if(p->read == b->image[page]) p->read = copy; // Unless a ROM is banked over it
+  p->write = copy;
+  p->write_fn = unmapped_write;
+
+  c->code_page = -1; // Code may have been fetched from the shared page
+#ifdef JIT_CORE
+  blocks_flush(c); // Translated code reads the shared page directly
+#endif
+
+  return copy;
+}
+
+/* First write into a map_image() page */
+
+static void
+copy_on_write(MOS_6510* const c, uint16_t addr, uint8_t value)
 {
-	uint8_t byte = rb(c, c->pc++);
-	return byte;
+  private_copy(c, addr >> 8);
+  wb(c, addr, value);
 }
 
-uint16_t
-fetch_word(MOS_6510* const c)
+static void
+map_shared(struct bus* const b, uint8_t page, const uint8_t* host)
 {
-  uint16_t word = rw(c, c->pc);
-  c->pc += 2;
-  return word;
+  struct page* const p = page_mapping(b, page);
+
+  release(b, page);
+  b->image[page] = host;
+  b->version[page] = 0;
+
+  p->read = host;
+  p->write = NULL;
+  p->read_fn = unmapped_read;
+  p->write_fn = copy_on_write;
 }
 
-uint8_t 
-pop_byte(MOS_6510* const c)
+/* Every page starts out as a copy-on-write view of the same zeroed page */
+
+void
+bus_init(MOS_6510* const c, struct bus* const b)
 {
-  c->sp++;
-  uint16_t stack_addr = 0x100 + c->sp;
-  return rb(c, stack_addr);
+  static const uint8_t zero_page[0x100];
+
+  c->bus = b;
+
+  for(uint16_t i = 0; i < 0x100; i++)
+  {
+    b->copies[i] = NULL;
+    b->hooks[i] = NULL;
+    map_shared(b, i, zero_page);
+  }
+
+  b->versions = 0;
+  memset(c->written_pages, 0, sizeof(c->written_pages));
+
+  memset(b->low, 0, sizeof(b->low));
+  memset(b->low_watch, 0, sizeof(b->low_watch));
+  c->low_watches = 0;
+  map_ram(c, 0, 2, b->low);
 }
 
-uint16_t 
-pop_word(MOS_6510* const c)
+void
+bus_free(struct bus* const b)
 {
-  return (pop_byte(c)) | (pop_byte(c) << 8);
+  for(uint16_t i = 0; i < 0x100; i++)
+  {
+    release(b, i);
+    free(b->hooks[i]);
+    b->hooks[i] = NULL;
+  }
 }
 
-void 
-push_byte(MOS_6510* const c, uint8_t byte)
+void
+map_ram(MOS_6510* const c, uint8_t first, uint16_t count, uint8_t* host)
 {
-  uint16_t stack_addr = 0x100 + c->sp--;
-  wb(c, stack_addr, byte);
+  check_range(c, first, count, true);
+
+  if(first == 0) c->low = host;
+
+  for(uint16_t i = 0; i < count; i++)
+  {
+    struct page* const p = page_mapping(c->bus, first + i);
+
+    release(c->bus, first + i);
+    c->bus->version[first + i] = ++c->bus->versions; // Whatever `host` holds, it isn't an image
+    p->read = p->write = host + (i << 8);
+    p->read_fn = unmapped_read;
+    p->write_fn = unmapped_write;
+  }
 }
 
-void 
-push_word(MOS_6510* const c, uint16_t word)
+/* Writes keep going wherever they went before, as with ROM banked over RAM */
+
+void
+map_rom(MOS_6510* const c, uint8_t first, uint16_t count, const uint8_t* host)
+{
+  check_range(c, first, count, false);
+
+  for(uint16_t i = 0; i < count; i++)
+  {
+    struct page* const p = page_mapping(c->bus, first + i);
+
+    p->read = host + (i << 8);
+  }
+}
+
+/*
+ * Shared initial contents of RAM, `host` is only ever read. Zero page and
+ * stack can't be shared, an image covering them is copied into c->low.
+ */
+
+void
+map_image(MOS_6510* const c, uint8_t first, uint16_t count, const uint8_t* host)
 {
-  uint16_t addr = 0x100 + c->sp;
-  wb(c, addr, word >> 8);
-  wb(c, addr - 1, word & 0xFF);
-  c->sp -= 2;
+  check_range(c, first, count, true);
+
+  uint16_t i = 0;
+
+  if(first == 0)
+  {
+    memcpy(c->low, host, 0x200);
+    i = 2;
+  }
+
+  for(; i < count; i++) map_shared(c->bus, first + i, host + (i << 8));
+}
+
+void
+map_io(MOS_6510* const c, uint8_t first, uint16_t count, read_handler read_fn, write_handler write_fn)
+{
+  check_range(c, first, count, false);
+
+  for(uint16_t i = 0; i < count; i++)
+  {
+    struct page* const p = page_mapping(c->bus, first + i);
+
+    release(c->bus, first + i);
+    p->read = NULL;
+    p->write = NULL;
+    p->read_fn = read_fn ? read_fn : unmapped_read;
+    p->write_fn = write_fn ? write_fn : unmapped_write;
+  }
+}
+
+/* Host memory writes to `page` go to, copying a map_image() page first. NULL for I/O */
+
+uint8_t*
+bus_writable(MOS_6510* const c, uint8_t page)
+{
+  struct bus* const b = c->bus;
+  uint8_t* const write = page_mapping(b, page)->write;
+
+  if(write) return write;
+  return b->image[page] ? private_copy(c, page) : NULL;
+}
+
+/* Handlers of pages with hooks, unhooked addresses go to the mapping below as rb()/wb() would */
+
+static uint8_t
+hooked_read(MOS_6510* const c, uint16_t addr)
+{
+  const struct hooks* const h = c->bus->hooks[addr >> 8];
+
+  if(h->watch[addr & 0xFF] & WATCH_READ) watch_hit(c, addr, WATCH_READ);
+
+  if(h->read_fn[addr & 0xFF]) return h->read_fn[addr & 0xFF](c, addr);
+  if(h->under.read) return h->under.read[addr & 0xFF];
+  return h->under.read_fn(c, addr);
+}
+
+static void
+hooked_write(MOS_6510* const c, uint16_t addr, uint8_t value)
+{
+  const struct hooks* const h = c->bus->hooks[addr >> 8];
+  uint8_t* const page = h->under.write;
+
+  if(h->watch[addr & 0xFF] & WATCH_WRITE) watch_hit(c, addr, WATCH_WRITE);
+
+  if(h->write_fn[addr & 0xFF]) h->write_fn[addr & 0xFF](c, addr, value);
+  else if(page)
+  {
+    journal_write(c, addr, &page[addr & 0xFF]);
+    page[addr & 0xFF] = value;
+    page_written(c, addr);
+    code_write(c, addr);
+  }
+  else h->under.write_fn(c, addr, value);
+}
+
+static bool
+hooked(const struct hooks* const h, uint8_t i)
+{
+  return h->read_fn[i] || h->write_fn[i] || h->watch[i];
+}
+
+/* Hooks of the page holding `addr` (above the stack), NULL if it has none and `create` is false or out of memory */
+
+static struct hooks*
+page_hooks(MOS_6510* const c, uint16_t addr, bool create)
+{
+  struct bus* const b = c->bus;
+  const uint8_t page = addr >> 8;
+  struct hooks* h = b->hooks[page];
+
+  if(h || !create) return h;
+  if((h = calloc(1, sizeof(struct hooks))) == NULL) return NULL;
+
+  h->under = b->pages[page];
+  b->hooks[page] = h;
+  b->pages[page] = (struct page){ NULL, NULL, hooked_read, hooked_write };
+  return h;
+}
+
+/* The last hook of the page gone puts the page back on the fast path */
+
+static void
+hooks_release(struct bus* const b, uint8_t page)
+{
+  struct hooks* const h = b->hooks[page];
+
+  if(h && h->count == 0)
+  {
+    b->pages[page] = h->under;
+    b->hooks[page] = NULL;
+    free(h);
+  }
+}
+
+/* After hooks changed, nothing may keep accessing their pages directly */
+
+static void
+hooks_changed(MOS_6510* const c)
+{
+  c->code_page = -1;
+#ifdef BLOCK_CORE
+  blocks_flush(c); // Blocks and translated code may access the page directly
+#endif
+}
+
+bool
+hook_io(MOS_6510* const c, uint16_t addr, read_handler read_fn, write_handler write_fn)
+{
+  if(addr < 0x200) return false;
+
+  struct hooks* const h = page_hooks(c, addr, read_fn || write_fn);
+  const uint8_t i = addr & 0xFF;
+
+  if(h == NULL) return !(read_fn || write_fn); // Nothing to remove, or out of memory
+
+  h->count -= hooked(h, i);
+  h->read_fn[i] = read_fn;
+  h->write_fn[i] = write_fn;
+  h->count += hooked(h, i);
+
+  hooks_release(c->bus, addr >> 8);
+  hooks_changed(c);
+  return true;
+}
+
+bool
+bus_watch(MOS_6510* const c, uint16_t first, uint16_t last, uint8_t access)
+{
+  struct bus* const b = c->bus;
+  uint32_t addr = first;
+  bool done = true;
+
+#ifndef LOW_WATCHPOINTS
+  if(first < 0x200) return false; // Nothing would look for them
+#endif
+
+  for(; addr <= last && addr < 0x200; addr++)
+  {
+    c->low_watches += (access != 0) - (b->low_watch[addr] != 0);
+    b->low_watch[addr] = access;
+  }
+
+  for(; addr <= last; addr++)
+  {
+    struct hooks* const h = page_hooks(c, addr, access);
+    const uint8_t i = addr & 0xFF;
+
+    if(h == NULL && access)
+    {
+      done = false; // Out of memory
+      break;
+    }
+
+    if(h == NULL)
+    {
+      addr |= 0xFF; // Nothing to remove on this page
+      continue;
+    }
+
+    h->count -= hooked(h, i);
+    h->watch[i] = access;
+    h->count += hooked(h, i);
+
+    if(i == 0xFF || addr == last) hooks_release(c->bus, addr >> 8);
+  }
+
+  hooks_changed(c); // Once for the whole range
+  return done;
 }
@@ -2,21 +2,295 @@
 #define _6510_BUS
 
 #include <stdint.h>
+#include <stddef.h>
 
 #include "cpu.h"
+#include "rewind.h"
 
-uint8_t rb(MOS_6510* const c, uint16_t addr);
-uint16_t rw(MOS_6510* const c, uint16_t addr);
+typedef uint8_t (*read_handler)(struct MOS_6510* const c, uint16_t addr);
+typedef void (*write_handler)(struct MOS_6510* const c, uint16_t addr, uint8_t value);
 
-void wb(MOS_6510* const c, uint16_t addr, uint8_t value);
+/*
+ * One entry per 256 byte page of the address space. Pages backed by host
+ * memory are accessed through the pointers directly, pages whose pointer
+ * is NULL go through the handler instead (I/O, banking, ...).
+ */
 
-uint8_t fetch_byte(MOS_6510* const c);
-uint16_t fetch_word(MOS_6510* const c);
+struct page
+{
+  const uint8_t* read;
+  uint8_t* write;
 
-uint8_t pop_byte(MOS_6510* const c);
-uint16_t pop_word(MOS_6510* const c);
+  read_handler read_fn;
+  write_handler write_fn;
+};
 
-void push_byte(MOS_6510* const c, uint8_t byte);
-void push_word(MOS_6510* const c, uint16_t word);
+/*
+ * Per address handlers of a page, see hook_io(). Addresses without one go
+ * to `under`, the mapping the page would have without hooks.
+ */
+
+struct hooks
+{
+  struct page under;
+
+  read_handler read_fn[256];
+  write_handler write_fn[256];
+  uint8_t watch[256]; // WATCH_READ/WATCH_WRITE, see breakpoint.h
+  uint16_t count; // Addresses with a handler or a watchpoint
+};
+
+/*
+ * Address space of one CPU, kept apart from the CPU state. The host memory
+ * behind it belongs to the caller and may be shared by any number of
+ * address spaces: map_rom() pages are never written, map_image() pages are
+ * copied into memory owned by the bus on the first write to them. Only zero
+ * page and stack are always private, so an address space costs a few KB
+ * plus the pages its program actually writes.
+ */
+
+struct bus
+{
+  struct page pages[256];
+
+  const uint8_t* image[256]; // Shared contents of map_image() pages, NULL for other pages
+  uint8_t* copies[256]; // Private copies of written image pages
+  struct hooks* hooks[256]; // Pages with hooked addresses, NULL for the others
+
+  uint32_t version[256]; // Changes whenever a snapshot finds the page written, 0 while it holds its map_image() contents
+  uint32_t versions; // Last version handed out
+
+  uint8_t low[0x200]; // Zero page and stack, unless map_ram() put them elsewhere
+  uint8_t low_watch[0x200]; // WATCH_READ/WATCH_WRITE of zero page and stack addresses, see bus_watch()
+};
+
+uint8_t read_handled(MOS_6510* const c, uint16_t addr);
+void write_handled(MOS_6510* const c, uint16_t addr, uint8_t value);
+uint8_t fetch_slow(MOS_6510* const c, uint16_t pc);
+
+/* Mapping of the page, below its hooks if it has any */
+
+static inline struct page*
+page_mapping(struct bus* const b, uint8_t page)
+{
+  return b->hooks[page] ? &b->hooks[page]->under : &b->pages[page];
+}
+
+/* Marks the page for the next snapshot, zero page and stack are always saved whole */
+
+static inline void
+page_written(MOS_6510* const c, uint16_t addr)
+{
+  c->written_pages[addr >> 11] |= 1 << (addr >> 8 & 7);
+}
+
+/* Journals the byte about to be overwritten, see rewind.h */
+
+static inline void
+journal_write(MOS_6510* const c, uint16_t addr, const uint8_t* host)
+{
+#ifdef REWIND
+  if(__builtin_expect(c->rewind != NULL, 0)) rewind_journal(c, addr, *host);
+#else
+  (void) c;
+  (void) addr;
+  (void) host;
+#endif
+}
+
+/* Writes into pages that cached blocks were decoded from drop those blocks */
+
+static inline void
+code_write(MOS_6510* const c, uint16_t addr)
+{
+#ifdef BLOCK_CORE
+  if(c->code_pages[addr >> 11] & 1 << (addr >> 8 & 7)) code_written(c, addr >> 8);
+#else
+  (void) c;
+  (void) addr;
+#endif
+}
+
+/*
+ * Zero page and stack can't be hooked, with LOW_WATCHPOINTS their
+ * watchpoints are looked for while there are any. A hit is recorded as
+ * watch_hit() would, without a call that would cost every handler a stack
+ * frame.
+ */
+
+static inline void
+low_watch(MOS_6510* const c, uint16_t addr, uint8_t access)
+{
+#ifdef LOW_WATCHPOINTS
+  if(__builtin_expect(c->low_watches != 0, 0) && c->bus->low_watch[addr] & access)
+  {
+    c->breakpoints.hit |= access;
+    c->breakpoints.hit_addr = addr;
+    c->breakpoints.armed = true;
+  }
+#else
+  (void) c;
+  (void) addr;
+  (void) access;
+#endif
+}
+
+/*
+ * Zero page and stack are read straight from c->low, with a constant or
+ * 8-bit address the compiler drops the range check. Other plain memory
+ * pages are a pointer lookup, everything else calls the page handler.
+ */
+
+static inline uint8_t
+rb(MOS_6510* const c, uint16_t addr)
+{
+  if(addr < 0x200)
+  {
+    low_watch(c, addr, WATCH_READ);
+    return c->low[addr];
+  }
+
+  const uint8_t* const page = c->bus->pages[addr >> 8].read;
+
+  if(page) return page[addr & 0xFF];
+  return read_handled(c, addr);
+}
+
+static inline void
+wb(MOS_6510* const c, uint16_t addr, uint8_t value)
+{
+  if(addr < 0x200)
+  {
+    low_watch(c, addr, WATCH_WRITE);
+    journal_write(c, addr, &c->low[addr]);
+    c->low[addr] = value;
+    code_write(c, addr);
+    return;
+  }
+
+  uint8_t* const page = c->bus->pages[addr >> 8].write;
+
+  if(page)
+  {
+    journal_write(c, addr, &page[addr & 0xFF]);
+    page[addr & 0xFF] = value;
+    page_written(c, addr);
+    code_write(c, addr);
+  }
+  else write_handled(c, addr, value);
+}
+
+static inline uint16_t
+rw(MOS_6510* const c, uint16_t addr)
+{
+  return rb(c, addr + 1) << 8 | rb(c, addr);
+}
+
+/* Memory as the CPU sees it, without triggering I/O handlers: -1 where only a page handler knows */
+
+static inline int
+bus_peek(const MOS_6510* const c, uint16_t addr)
+{
+  if(addr < 0x200) return c->low[addr];
+
+  const uint8_t* const page = c->bus->pages[addr >> 8].read;
+  return page ? page[addr & 0xFF] : -1;
+}
+
+/* Instruction stream, read through the cached host pointer of the current code page */
+
+static inline uint8_t
+fetch_byte(MOS_6510* const c)
+{
+  const uint16_t pc = c->pc++;
+
+  if((pc >> 8) == c->code_page) return c->code[pc & 0xFF];
+  return fetch_slow(c, pc);
+}
+
+static inline uint16_t
+fetch_word(MOS_6510* const c)
+{
+  const uint8_t lo = fetch_byte(c);
+  return fetch_byte(c) << 8 | lo;
+}
+
+/* Stack */
+
+static inline uint8_t
+pop_byte(MOS_6510* const c)
+{
+  c->sp++;
+  low_watch(c, 0x100 + c->sp, WATCH_READ);
+  return c->low[0x100 + c->sp];
+}
+
+static inline uint16_t
+pop_word(MOS_6510* const c)
+{
+  const uint8_t lo = pop_byte(c);
+  return pop_byte(c) << 8 | lo;
+}
+
+static inline void
+push_byte(MOS_6510* const c, uint8_t byte)
+{
+  low_watch(c, 0x100 + c->sp, WATCH_WRITE);
+  journal_write(c, 0x100 + c->sp, &c->low[0x100 + c->sp]);
+  c->low[0x100 + c->sp] = byte;
+  code_write(c, 0x100 + c->sp--);
+}
+
+static inline void
+push_word(MOS_6510* const c, uint16_t word)
+{
+  const uint16_t addr = 0x100 + c->sp;
+  low_watch(c, addr, WATCH_WRITE);
+  low_watch(c, addr - 1, WATCH_WRITE);
+  journal_write(c, addr, &c->low[addr]);
+  journal_write(c, addr - 1, &c->low[addr - 1]);
+  c->low[addr] = word >> 8;
+  c->low[addr - 1] = word & 0xFF;
+  code_write(c, addr);
+  code_write(c, addr - 1);
+  c->sp -= 2;
+}
+
+/*
+ * Memory map, `first` and `count` are in 256 byte pages. bus_init() attaches
+ * `b` to the CPU with all of memory zeroed, bus_free() releases the private
+ * page copies again.
+ */
+
+void bus_init(MOS_6510* const c, struct bus* const b);
+void bus_free(struct bus* const b);
+
+void map_ram(MOS_6510* const c, uint8_t first, uint16_t count, uint8_t* host);
+void map_rom(MOS_6510* const c, uint8_t first, uint16_t count, const uint8_t* host);
+void map_image(MOS_6510* const c, uint8_t first, uint16_t count, const uint8_t* host);
+void map_io(MOS_6510* const c, uint8_t first, uint16_t count, read_handler read_fn, write_handler write_fn);
+
+uint8_t* bus_writable(MOS_6510* const c, uint8_t page);
+
+/*
+ * Device registers: read_fn/write_fn handle this one address (NULL leaves
+ * reads or writes to the mapping below), NULL for both removes the hook.
+ * Only the page holding the address leaves the pointer fast path, the rest
+ * of it is accessed through the mapping below, which map_*() keep changing
+ * as usual. False for zero page and stack, which can't be hooked, or when
+ * out of memory.
+ */
+
+bool hook_io(MOS_6510* const c, uint16_t addr, read_handler read_fn, write_handler write_fn);
+
+/*
+ * Watchpoints on `first` to `last`, `access` is WATCH_READ/WATCH_WRITE or 0
+ * to remove them. Handlers still run. Zero page and stack addresses are
+ * kept in b->low_watch, every access there looks them up while any is set.
+ * False for a range starting below $0200 without LOW_WATCHPOINTS, or when
+ * out of memory, the addresses up to there are watched.
+ */
+
+bool bus_watch(MOS_6510* const c, uint16_t first, uint16_t last, uint8_t access);
 
 #endif // _6510_BUS
@@ -0,0 +1,305 @@
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cpu.h"
+#include "debug.h"
+#include "compare.h"
+
+static const char* const field_names[FIELD_COUNT] = { "pc", "a", "x", "y", "sp", "p", "cyc" };
+
+#define P_MASK 0xCF // B and bit 5 only exist on the stack, emulators log them differently
+
+/*
+ * Opens a reference log. `format` lists comma separated fields, each one
+ * of pc, a, x, y, sp, p, cyc or "-" to skip a column:
+ *
+ *   "pc,a,x,y,sp,p,cyc"  the n-th field is the n-th whitespace separated column
+ *   "pc,a=A:,p=P:"       a label puts the field behind the word starting with
+ *                        that label instead, wherever it is on the line, without
+ *                        using up a column
+ *
+ * Values are hex with an optional "$" or "0x", cyc is decimal. A column like
+ * "A:1F" is read from behind its last ':' or '='.
+ */
+
+bool
+reference_open(struct reference* const r, const char* path, const char* format)
+{
+  *r = (struct reference){ 0 };
+
+  for(const char* f = format; *f; )
+  {
+    const char* const end = f + strcspn(f, ",");
+    const char* const equals = memchr(f, '=', end - f);
+    const size_t length = (equals ? equals : end) - f;
+    struct reference_column column = { -1, NULL, 0 };
+
+    for(int8_t i = 0; i < FIELD_COUNT; i++)
+    {
+      if(strlen(field_names[i]) == length && strncmp(f, field_names[i], length) == 0) column.field = i;
+    }
+
+    if(equals && equals + 1 < end && end - equals - 1 < 256)
+    {
+      column.label = equals + 1;
+      column.label_length = end - equals - 1;
+    }
+
+    const bool skip = length == 1 && *f == '-' && equals == NULL;
+
+    if(r->column_count == REFERENCE_COLUMNS || (column.field < 0 && !skip) || (equals && column.label == NULL)) return false;
+
+    if(column.field >= 0) r->fields |= 1 << column.field;
+    r->columns[r->column_count++] = column;
+    f = *end ? end + 1 : end;
+  }
+
+  if(r->fields == 0) return false;
+
+  const int fd = open(path, O_RDONLY);
+  struct stat st;
+
+  if(fd < 0) return false;
+
+  if(fstat(fd, &st) != 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  r->size = st.st_size;
+
+  if(r->size)
+  {
+    void* const data = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    r->data = data == MAP_FAILED ? NULL : data;
+    if(r->data) madvise(data, r->size, MADV_SEQUENTIAL);
+  }
+
+  close(fd);
+  return r->data || r->size == 0;
+}
+
+void
+reference_close(struct reference* const r)
+{
+  if(r->data) munmap((void*) r->data, r->size);
+  r->data = NULL;
+  r->size = 0;
+}
+
+static bool
+is_space(char ch)
+{
+  return ch == ' ' || ch == '\t' || ch == '\r';
+}
+
+static bool
+parse_number(const char* p, const char* end, bool decimal, uint64_t* value)
+{
+  if(p < end && *p == '$') p++;
+  else if(!decimal && end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) p += 2;
+
+  const char* const first = p;
+  uint64_t v = 0;
+
+  for(; p < end; p++)
+  {
+    const char ch = *p | 0x20; // Lower case letters, digits stay as they are
+
+    if(ch >= '0' && ch <= '9') v = v * (decimal ? 10 : 16) + ch - '0';
+    else if(!decimal && ch >= 'a' && ch <= 'f') v = v * 16 + ch - 'a' + 10;
+    else break;
+  }
+
+  *value = v;
+  return p > first;
+}
+
+static void
+parse_field(struct reference_state* const s, int8_t field, const char* value, const char* end)
+{
+  if(field >= 0 && parse_number(value, end, field == FIELD_CYC, &s->value[field])) s->present |= 1 << field;
+}
+
+/* One pass over the words of a line, each one is matched against the labels and taken by the next column */
+
+static void
+parse_line(const struct reference* const r, const char* p, const char* end, struct reference_state* const s)
+{
+  uint8_t column = 0;
+
+  s->present = 0;
+
+  while(true)
+  {
+    while(p < end && is_space(*p)) p++;
+    if(p == end) return;
+
+    const char* const word = p;
+    while(p < end && !is_space(*p)) p++;
+
+    for(uint8_t i = 0; i < r->column_count; i++)
+    {
+      const struct reference_column* const c = &r->columns[i];
+
+      if(c->label && p - word >= c->label_length && *word == *c->label && memcmp(word, c->label, c->label_length) == 0
+          && !(s->present & 1 << c->field))
+      {
+        parse_field(s, c->field, word + c->label_length, p);
+      }
+    }
+
+    while(column < r->column_count && r->columns[column].label) column++;
+    if(column == r->column_count) continue;
+
+    const char* value = word;
+
+    for(const char* q = word; q < p; q++)
+    {
+      if(*q == ':' || *q == '=') value = q + 1;
+    }
+
+    parse_field(s, r->columns[column++].field, value, p);
+  }
+}
+
+/*
+ * Reads the next line holding any of the fields, skipping empty lines,
+ * headers and comments starting with '#'. `start` gets the offset the line starts at.
+ */
+
+bool
+reference_next(struct reference* const r, struct reference_state* const s, size_t* start)
+{
+  while(r->offset < r->size)
+  {
+    const char* const line = r->data + r->offset;
+    const char* newline = memchr(line, '\n', r->size - r->offset);
+    const char* const end = newline ? newline : r->data + r->size;
+
+    *start = r->offset;
+    r->offset = end - r->data + 1;
+    r->line++;
+
+    if(line == end || *line == '#') continue;
+
+    parse_line(r, line, end, s);
+    if(s->present) return true;
+  }
+
+  return false;
+}
+
+static void
+print_line(const struct reference* const r, FILE* out, const char* marker, uint64_t line, size_t start)
+{
+  const char* const text = r->data + start;
+  const char* const newline = memchr(text, '\n', r->size - start);
+  size_t length = newline ? (size_t)(newline - text) : r->size - start;
+
+  if(length && text[length - 1] == '\r') length--;
+
+  fprintf(out, "%s %10" PRIu64 "  %.*s\n", marker, line, (int) length, text);
+}
+
+static void
+print_state(FILE* out, const struct reference_state* const s)
+{
+  fprintf(out, "   %10s  PC:%04" PRIX64 " A:%02" PRIX64 " X:%02" PRIX64 " Y:%02" PRIX64 " SP:%02" PRIX64 " P:%02" PRIX64 " CYC:%" PRIu64 "\n",
+      "ours", s->value[FIELD_PC], s->value[FIELD_A], s->value[FIELD_X], s->value[FIELD_Y],
+      s->value[FIELD_SP], s->value[FIELD_P], s->value[FIELD_CYC]);
+}
+
+/*
+ * Steps `c` one instruction per line of the log and stops at the first line
+ * that doesn't match, printing the lines in front of it, both sides of it
+ * and the lines that would have followed. Cycles are compared relative to
+ * the first line, as logs rarely start counting at the same point. True if
+ * the whole log matched.
+ */
+
+bool
+compare_run(MOS_6510* const c, struct reference* const r, FILE* out)
+{
+  struct reference_state history[REFERENCE_CONTEXT];
+  size_t starts[REFERENCE_CONTEXT];
+  uint64_t lines[REFERENCE_CONTEXT];
+  uint64_t count = 0;
+
+  int64_t cyc_offset = 0;
+  bool synced = false;
+
+  while(true)
+  {
+    if(c->irq_status) interrupt_handler(c);
+
+    struct reference_state expected;
+    size_t start;
+
+    if(!reference_next(r, &expected, &start))
+    {
+      fprintf(out, GREEN "✓" RESET " - %" PRIu64 " instructions match the reference\n", count);
+      return true;
+    }
+
+    if(!synced && (expected.present & 1 << FIELD_CYC))
+    {
+      cyc_offset = expected.value[FIELD_CYC] - c->cyc;
+      synced = true;
+    }
+
+    const struct reference_state actual = { { c->pc, c->a, c->x, c->y, c->sp, get_flags(c), c->cyc + cyc_offset }, r->fields };
+    uint8_t differ = 0;
+
+    for(uint8_t i = 0; i < FIELD_COUNT; i++)
+    {
+      const uint64_t mask = i == FIELD_P ? P_MASK : UINT64_MAX;
+
+      if((expected.present & 1 << i) && ((expected.value[i] ^ actual.value[i]) & mask)) differ |= 1 << i;
+    }
+
+    if(differ)
+    {
+      fprintf(out, RED "✘" RESET " - mismatch on line %" PRIu64 " after %" PRIu64 " instructions:", r->line, count);
+
+      const char* separator = " ";
+
+      for(uint8_t i = 0; i < FIELD_COUNT; i++)
+      {
+        if((differ & 1 << i) == 0) continue;
+
+        if(i == FIELD_CYC) fprintf(out, "%s%s is %" PRIu64 " instead of %" PRIu64, separator, field_names[i], actual.value[i], expected.value[i]);
+        else fprintf(out, "%s%s is $%02" PRIX64 " instead of $%02" PRIX64, separator, field_names[i], actual.value[i], expected.value[i]);
+        separator = ", ";
+      }
+
+      fprintf(out, "\n\n");
+
+      for(uint64_t i = count > REFERENCE_CONTEXT ? count - REFERENCE_CONTEXT : 0; i < count; i++)
+      {
+        print_line(r, out, " ", lines[i % REFERENCE_CONTEXT], starts[i % REFERENCE_CONTEXT]);
+        print_state(out, &history[i % REFERENCE_CONTEXT]);
+      }
+
+      print_line(r, out, ">", r->line, start);
+      print_state(out, &actual);
+
+      for(uint8_t i = 0; i < 3 && reference_next(r, &expected, &start); i++) print_line(r, out, " ", r->line, start);
+
+      return false;
+    }
+
+    history[count % REFERENCE_CONTEXT] = actual;
+    starts[count % REFERENCE_CONTEXT] = start;
+    lines[count % REFERENCE_CONTEXT] = r->line;
+    count++;
+
+    mnemonics(c);
+  }
+}
@@ -0,0 +1,66 @@
+#ifndef _6510_COMPARE
+#define _6510_COMPARE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cpu.h"
+
+/*
+ * Instruction by instruction comparison against the log of another
+ * emulator. The log is memory mapped and read one line at a time, so its
+ * size doesn't matter. Every line holds the state in front of one
+ * instruction, which fields and where is told by a format, see
+ * reference_open().
+ */
+
+enum REFERENCE_FIELD {
+  FIELD_PC,
+  FIELD_A,
+  FIELD_X,
+  FIELD_Y,
+  FIELD_SP,
+  FIELD_P,
+  FIELD_CYC,
+  FIELD_COUNT,
+};
+
+#define REFERENCE_COLUMNS 16
+#define REFERENCE_CONTEXT 8 // Lines shown in front of a mismatch
+
+/* Where a field is found: the n-th whitespace separated column, or after a label */
+
+struct reference_column
+{
+  int8_t field; // enum REFERENCE_FIELD, -1 for a skipped column
+  const char* label; // NULL for a positional column
+  uint8_t label_length;
+};
+
+struct reference_state
+{
+  uint64_t value[FIELD_COUNT];
+  uint8_t present; // One bit per field found on the line
+};
+
+struct reference
+{
+  const char* data; // Mapped file
+  size_t size;
+  size_t offset; // Start of the next line
+  uint64_t line; // Number of the last line read, counting from 1
+
+  struct reference_column columns[REFERENCE_COLUMNS];
+  uint8_t column_count;
+  uint8_t fields; // One bit per field the format names
+};
+
+bool reference_open(struct reference* const r, const char* path, const char* format);
+void reference_close(struct reference* const r);
+bool reference_next(struct reference* const r, struct reference_state* const s, size_t* start);
+
+bool compare_run(MOS_6510* const c, struct reference* const r, FILE* out);
+
+#endif // _6510_COMPARE
@@ -1,9 +1,17 @@
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
 
 #include "cpu.h"
 #include "bus.h"
 #include "debug.h"
+#include "opcodes.h"
+#include "jit.h"
+#include "profile.h"
+#include "trace.h"
+#include "rewind.h"
+#include "event.h"
 
 static inline bool
 page_crossed(uint16_t addr_1, uint16_t addr_2)
@@ -11,189 +19,453 @@ page_crossed(uint16_t addr_1, uint16_t addr_2)
   return (addr_1 & 0xFF00) != (addr_2 & 0xFF00);
 }
 
+/*
+ * Lazy flags: N and Z are kept as the last result (see c->zn) and V as the
+ * operands and result of the last ADC/SBC, they are only worked out when a
+ * branch, PHP, get_flags() or an interrupt asks for them.
+ */
+
 static inline void 
 set_zn(MOS_6510* const c, uint8_t value)
 {
-  c->zf = value == 0;
-  c->nf = value >> 7;
+  c->zn = value << 8 | value;
 }
 
-uint8_t 
-get_flags(MOS_6510* const c) 
+static inline void
+set_nz(MOS_6510* const c, bool n, bool z)
+{
+  c->zn = n << 15 | !z;
+}
+
+static inline void
+set_v(MOS_6510* const c, bool v)
+{
+  c->v_a = 0;
+  c->v_b = 0;
+  c->v_r = v << 7;
+}
+
+static inline bool
+flag_n(MOS_6510* const c)
+{
+  return c->zn >> 15;
+}
+
+static inline bool
+flag_z(MOS_6510* const c)
+{
+  return (c->zn & 0xFF) == 0;
+}
+
+static inline bool
+flag_v(MOS_6510* const c)
+{
+  return (~(c->v_a ^ c->v_b) & (c->v_a ^ c->v_r) & 0x80) != 0;
+}
+
+static inline __attribute__((always_inline)) uint8_t
+pack_flags(MOS_6510* const c)
 {
   uint8_t p = 0;
 
-  p |= c->nf << 7;
-  p |= c->vf << 6;
+  p |= flag_n(c) << 7;
+  p |= flag_v(c) << 6;
   p |= 1 << 5;
   p |= c->bf << 4;
   p |= c->df << 3;
   p |= c->idf << 2;
-  p |= c->zf << 1;
+  p |= flag_z(c) << 1;
   p |= c->cf;
 
   return p;
 }
 
+uint8_t 
+get_flags(MOS_6510* const c) 
+{
+  return pack_flags(c);
+}
+
 void
 set_flags(MOS_6510* const c, uint8_t value)
 {
-  c->nf = (value >> 7) & 1;
-  c->vf = (value >> 6) & 1;
+  set_nz(c, (value >> 7) & 1, (value >> 1) & 1);
+  set_v(c, (value >> 6) & 1);
   c->df = (value >> 3) & 1;
   c->bf = (value >> 4) & 1;
   c->idf = (value >> 2) & 1;
-  c->zf = (value >> 1) & 1;
   c->cf = value & 1;
 }
 
-/* Addressing modes */
+#ifdef CYCLE_CORE
+
+/*
+ * Cycle engine (make CORE=cycle).
+ *
+ * Every cycle of the 6510 is a bus access, so the clock is advanced by the
+ * accesses themselves: everything below, handlers included, sees the
+ * accessors of bus.h replaced by versions that count one cycle each. An
+ * access happens with c->cyc already counting its own cycle, so whatever
+ * sits behind the bus sees it at the cycle it really takes place. The
+ * dummy reads and writes the handlers would otherwise skip go through
+ * idle() and modify().
+ *
+ * Due events run and the interrupt lines are sampled at the start of every
+ * cycle, what was sampled in front of an instruction's last cycle is taken
+ * after it.
+ */
+
+static inline void
+tick(MOS_6510* const c)
+{
+  if(c->cyc >= c->events.next) events_run(c);
+  c->irq_sampled = c->irq_status & (c->idf ? 0x2 : 0x3);
+  c->cyc++;
+}
+
+static inline uint8_t
+cycle_rb(MOS_6510* const c, uint16_t addr)
+{
+  tick(c);
+  return rb(c, addr);
+}
+
+static inline void
+cycle_wb(MOS_6510* const c, uint16_t addr, uint8_t value)
+{
+  tick(c);
+  wb(c, addr, value);
+}
+
+static inline uint16_t
+cycle_rw(MOS_6510* const c, uint16_t addr)
+{
+  const uint8_t lo = cycle_rb(c, addr);
+  return cycle_rb(c, addr + 1) << 8 | lo;
+}
+
+static inline uint8_t
+cycle_fetch_byte(MOS_6510* const c)
+{
+  tick(c);
+  return fetch_byte(c);
+}
+
+static inline uint16_t
+cycle_fetch_word(MOS_6510* const c)
+{
+  const uint8_t lo = cycle_fetch_byte(c);
+  return cycle_fetch_byte(c) << 8 | lo;
+}
+
+static inline uint8_t
+cycle_pop_byte(MOS_6510* const c)
+{
+  tick(c);
+  return pop_byte(c);
+}
+
+static inline uint16_t
+cycle_pop_word(MOS_6510* const c)
+{
+  const uint8_t lo = cycle_pop_byte(c);
+  return cycle_pop_byte(c) << 8 | lo;
+}
 
 static inline void
-address_mode(MOS_6510* const c, uint8_t mode)
+cycle_push_byte(MOS_6510* const c, uint8_t byte)
+{
+  tick(c);
+  push_byte(c, byte);
+}
+
+static inline void
+cycle_push_word(MOS_6510* const c, uint16_t word)
+{
+  cycle_push_byte(c, word >> 8);
+  cycle_push_byte(c, word & 0xFF);
+}
+
+#define rb(c, addr) cycle_rb(c, addr)
+#define wb(c, addr, value) cycle_wb(c, addr, value)
+#define rw(c, addr) cycle_rw(c, addr)
+#define fetch_byte(c) cycle_fetch_byte(c)
+#define fetch_word(c) cycle_fetch_word(c)
+#define pop_byte(c) cycle_pop_byte(c)
+#define pop_word(c) cycle_pop_word(c)
+#define push_byte(c, byte) cycle_push_byte(c, byte)
+#define push_word(c, word) cycle_push_word(c, word)
+
+#endif // CYCLE_CORE
+
+/* Bus cycle whose value is thrown away, only the cycle engine performs it */
+
+static inline void
+idle(MOS_6510* const c, uint16_t addr)
+{
+#ifdef CYCLE_CORE
+  rb(c, addr);
+#else
+  (void) c;
+  (void) addr;
+#endif
+}
+
+/* Read-modify-write instructions store the unmodified byte once before the result */
+
+static inline void
+modify(MOS_6510* const c, uint16_t addr, uint8_t old, uint8_t value)
+{
+#ifdef CYCLE_CORE
+  wb(c, addr, old);
+#else
+  (void) old;
+#endif
+  wb(c, addr, value);
+}
+
+/* Addressing modes */
+
+/*
+ * Split in two so predecoded blocks can skip the fetch: operand() reads the
+ * operand bytes (for IMMEDIATE it yields the address of the byte instead),
+ * effective_address() turns them into the address the handler works on,
+ * for RELATIVE the branch target. Only ever called with a constant mode,
+ * so the switches fold away inside every opcode handler.
+ */
+
+static inline __attribute__((always_inline)) uint16_t
+operand(MOS_6510* const c, const enum ADDR_MODE mode)
 {
   switch (mode) {
 
     case IMPLIED:
     case ACCUMULATOR:
-      c->addr_ptr = 0;
-      break;
+      return 0;
 
     case IMMEDIATE:
-      c->addr_ptr = c->pc++;
-      break;
+      return c->pc++;
 
     case ABSOLUTE:
-      c->addr_ptr = fetch_word(c);
-      break;
-
     case ABSOLUTE_X:
-      c->addr_ptr = fetch_word(c) + c->x;
-      if(page_crossed(c->addr_ptr, c->addr_ptr - c->x)) c->page_crossed = 1;
-      break;
-
     case ABSOLUTE_Y:
-      c->addr_ptr = fetch_word(c) + c->y;
-      if(page_crossed(c->addr_ptr, c->addr_ptr - c->y)) c->page_crossed = 1;
-      break;
+    case INDIRECT:
+      return fetch_word(c);
 
     case ZEROPAGE:
-      c->addr_ptr = fetch_byte(c) & 0xFF;
-      break;
+    case ZEROPAGE_X:
+    case ZEROPAGE_Y:
+    case RELATIVE:
+    case INDIRECT_X:
+    case INDIRECT_Y:
+      return fetch_byte(c);
+  }
+
+  fprintf(stderr, "\n**" RED " Error " RESET "**" " invalid addressing mode\n");
+  exit(1);
+}
+
+static inline __attribute__((always_inline)) uint16_t
+effective_address(MOS_6510* const c, const enum ADDR_MODE mode, uint16_t operand, bool* const crossed)
+{
+  uint16_t addr;
+
+  switch (mode) {
+
+    case IMPLIED:
+    case ACCUMULATOR:
+    case IMMEDIATE:
+    case ABSOLUTE:
+    case ZEROPAGE:
+      return operand;
+
+    case ABSOLUTE_X:
+      addr = operand + c->x;
+      *crossed = page_crossed(addr, addr - c->x);
+      return addr;
+
+    case ABSOLUTE_Y:
+      addr = operand + c->y;
+      *crossed = page_crossed(addr, addr - c->y);
+      return addr;
 
     case ZEROPAGE_X:
-      c->addr_ptr = (fetch_byte(c) + c->x) & 0xFF;
-      break;
+      return (operand + c->x) & 0xFF;
 
     case ZEROPAGE_Y:
-      c->addr_ptr = (fetch_byte(c) + c->y) & 0xFF;
-      break;
+      return (operand + c->y) & 0xFF;
 
     case RELATIVE:
-      c->addr_rel = (int8_t)fetch_byte(c);
-      break; 
+      return c->pc + (int8_t)operand;
 
     case INDIRECT:
-      c->addr_ptr = fetch_word(c);
-      c->addr_ptr = rw(c, c->addr_ptr);
-      break;
+      return rw(c, operand);
 
     case INDIRECT_Y:
-      c->addr_ptr = rw(c, fetch_byte(c)) + c->y;
-      if(page_crossed(c->addr_ptr, c->addr_ptr - c->y)) c->page_crossed = 1;
+      addr = rw(c, operand) + c->y;
+      *crossed = page_crossed(addr, addr - c->y);
+      return addr;
+
+    case INDIRECT_X:
+      return rw(c, (operand + c->x) & 0xFF);
+  }
+
+  fprintf(stderr, "\n**" RED " Error " RESET "**" " invalid addressing mode\n");
+  exit(1);
+}
+
+#ifdef CYCLE_CORE
+
+/*
+ * operand() and effective_address() with the dummy cycles of the cycle
+ * engine. Indexed modes read the address before its high byte is fixed up,
+ * reads only when the index crossed a page, writes and read-modify-write
+ * always (`fixed`), then the handler does the access itself.
+ */
+
+static inline __attribute__((always_inline)) uint16_t
+cycle_address(MOS_6510* const c, const enum ADDR_MODE mode, const bool fixed, bool* const crossed)
+{
+  uint16_t base, addr;
+  uint8_t zp;
+
+  switch (mode) {
+
+    case IMPLIED:
+    case ACCUMULATOR:
+      idle(c, c->pc);
+      return 0;
+
+    case IMMEDIATE:
+      return c->pc++;
+
+    case RELATIVE:
+      base = (int8_t)fetch_byte(c);
+      return c->pc + base;
+
+    case ZEROPAGE:
+      return fetch_byte(c);
+
+    case ZEROPAGE_X:
+    case ZEROPAGE_Y:
+      zp = fetch_byte(c);
+      idle(c, zp);
+      return (zp + (mode == ZEROPAGE_X ? c->x : c->y)) & 0xFF;
+
+    case ABSOLUTE:
+      return fetch_word(c);
+
+    case INDIRECT:
+      return rw(c, fetch_word(c));
+
+    case ABSOLUTE_X:
+    case ABSOLUTE_Y:
+      base = fetch_word(c);
       break;
 
     case INDIRECT_X:
-      c->addr_ptr = (fetch_byte(c) + c->x) & 0xFF;
-      c->addr_ptr = rw(c, c->addr_ptr);
+      zp = fetch_byte(c);
+      idle(c, zp);
+      return rw(c, (zp + c->x) & 0xFF);
+
+    case INDIRECT_Y:
+      base = rw(c, fetch_byte(c));
       break;
 
     default:
       fprintf(stderr, "\n**" RED " Error " RESET "**" " invalid addressing mode\n");
       exit(1);
   }
+
+  addr = base + (mode == ABSOLUTE_X ? c->x : c->y);
+  *crossed = page_crossed(addr, base);
+
+  if(*crossed || fixed) idle(c, (base & 0xFF00) | (addr & 0xFF));
+  return addr;
 }
 
+#endif // CYCLE_CORE
+
 /* Documented opcodes */
 
 /* Load, Store, Transfer instructions */
 
 static inline void
-LDA(MOS_6510* const c)
+LDA(MOS_6510* const c, uint16_t addr)
 {
-  c->a = rb(c, c->addr_ptr);
+  c->a = rb(c, addr);
   set_zn(c, c->a);
 }
 
 static inline void
-LDX(MOS_6510* const c)
+LDX(MOS_6510* const c, uint16_t addr)
 {
-  c->x = rb(c, c->addr_ptr);
+  c->x = rb(c, addr);
   set_zn(c, c->x);
 }
 
 static inline void
-LDY(MOS_6510* const c)
+LDY(MOS_6510* const c, uint16_t addr)
 {
-  c->y = rb(c, c->addr_ptr);
+  c->y = rb(c, addr);
   set_zn(c, c->y);
 }
 
 static inline void
-STA(MOS_6510* const c)
+STA(MOS_6510* const c, uint16_t addr)
 {
-  wb(c, c->addr_ptr, c->a);
+  wb(c, addr, c->a);
 }
 
 static inline void
-STX(MOS_6510* const c)
+STX(MOS_6510* const c, uint16_t addr)
 {
-  wb(c, c->addr_ptr, c->x);
+  wb(c, addr, c->x);
 }
 
 static inline void
-STY(MOS_6510* const c)
+STY(MOS_6510* const c, uint16_t addr)
 {
-  wb(c, c->addr_ptr, c->y);
+  wb(c, addr, c->y);
 }
 
 static inline void
-TAX(MOS_6510* const c)
+TAX(MOS_6510* const c, uint16_t addr)
 {
   c->x = c->a;
   set_zn(c, c->x);
 }
 
 static inline void
-TAY(MOS_6510* const c)
+TAY(MOS_6510* const c, uint16_t addr)
 {
   c->y = c->a;
   set_zn(c, c->y);
 }
 
 static inline void
-TXA(MOS_6510* const c) 
+TXA(MOS_6510* const c, uint16_t addr) 
 {
   c->a = c->x;
   set_zn(c, c->a);
 }
 
 static inline void
-TYA(MOS_6510* const c)
+TYA(MOS_6510* const c, uint16_t addr)
 {
   c->a = c->y;
   set_zn(c, c->a);
 }
 
 static inline void
-TSX(MOS_6510* const c) 
+TSX(MOS_6510* const c, uint16_t addr) 
 {
   c->x = c->sp;
   set_zn(c, c->x);
 }
 
 static inline void
-TXS(MOS_6510* const c) 
+TXS(MOS_6510* const c, uint16_t addr) 
 {
   c->sp = c->x;
 }
@@ -202,9 +474,8 @@ TXS(MOS_6510* const c)
 /* Arithmethic instructions */
 
 static inline void
-ADC(MOS_6510* const c)
+add(MOS_6510* const c, uint8_t byte)
 {
-  const uint8_t byte = rb(c, c->addr_ptr);
   const bool carry = c->cf;
 
   if(c->df)
@@ -217,21 +488,24 @@ ADC(MOS_6510* const c)
     uint8_t ah = (c->a >> 4) + (byte >> 4) + (al > 0xF);
 
 
-    c->vf = ((ah << 4) ^ c->a) & ~(c->a ^ byte) & 0x80; 
+    c->v_a = c->a;
+    c->v_b = byte;
+    c->v_r = ah << 4;
 
     if(ah > 0x09) ah += 0x06;
 
-    c->nf = ah & 0x8;
     c->cf = ah > 0xF;
 
     c->a = (ah << 4) | (al & 0xF);
-    c->zf = c->a == 0;
+    set_nz(c, ah & 0x8, c->a == 0);
   }
   else 
   {
     const uint16_t result = c->a + byte + carry;
 
-    c->vf = ~(c->a ^ byte) & (c->a ^ result) & 0x80;  
+    c->v_a = c->a;
+    c->v_b = byte;
+    c->v_r = result;
 
     c->cf = result > 0xFF;
     set_zn(c, result & 0xFF);
@@ -241,9 +515,14 @@ ADC(MOS_6510* const c)
 }
 
 static inline void
-SBC(MOS_6510* const c)
+ADC(MOS_6510* const c, uint16_t addr)
+{
+  add(c, rb(c, addr));
+}
+
+static inline void
+subtract(MOS_6510* const c, uint8_t byte)
 {
-  const uint8_t byte = rb(c, c->addr_ptr);
   const bool com_carry = !c->cf;
 
   if(c->df)
@@ -257,7 +536,9 @@ SBC(MOS_6510* const c)
 
     uint8_t ah = (c->a >> 4) - (byte >> 4) - (al >> 7);
 
-    c->vf = (dec_result ^ c->a) & (c->a ^ byte) & 0x80;
+    c->v_a = c->a;
+    c->v_b = ~byte; // Subtraction overflows like an addition of the complement
+    c->v_r = dec_result;
     c->cf = !(dec_result > 255);
 
     if(ah >> 7) ah -= 0x06;
@@ -270,7 +551,9 @@ SBC(MOS_6510* const c)
   {
     const uint16_t result = c->a - byte - com_carry;
 
-    c->vf = (result ^ c->a) & (c->a ^ byte) & 0x80; 
+    c->v_a = c->a;
+    c->v_b = ~byte;
+    c->v_r = result;
 
     c->cf = !(result > 255);
     set_zn(c, result & 0xFF);
@@ -280,120 +563,130 @@ SBC(MOS_6510* const c)
 }
 
 static inline void
-DEC(MOS_6510* const c) 
+SBC(MOS_6510* const c, uint16_t addr)
 {
-  uint8_t value = rb(c, c->addr_ptr) - 1;
-  wb(c, c->addr_ptr, value);
+  subtract(c, rb(c, addr));
+}
+
+/* Read-modify-write handlers return the byte they stored, the undocumented ones work on with it */
+
+static inline uint8_t
+DEC(MOS_6510* const c, uint16_t addr) 
+{
+  const uint8_t byte = rb(c, addr);
+  const uint8_t value = byte - 1;
+
+  modify(c, addr, byte, value);
   set_zn(c, value);
+  return value;
 }
 
 static inline void
-DEX(MOS_6510* const c)
+DEX(MOS_6510* const c, uint16_t addr)
 {
   c->x--;
   set_zn(c, c->x);
 }
 static inline void
-DEY(MOS_6510* const c)
+DEY(MOS_6510* const c, uint16_t addr)
 {
   c->y--;
   set_zn(c, c->y);
 }
 
 static inline void
-INX(MOS_6510* const c)
+INX(MOS_6510* const c, uint16_t addr)
 {
   c->x++;
   set_zn(c, c->x);
 }
 
 static inline void
-INY(MOS_6510* const c) 
+INY(MOS_6510* const c, uint16_t addr) 
 {
   c->y++;
   set_zn(c, c->y);
 }
 
-static inline void 
-INC(MOS_6510* const c) 
+static inline uint8_t
+INC(MOS_6510* const c, uint16_t addr) 
 {
-  uint8_t value = rb(c, c->addr_ptr) + 1;
-  wb(c, c->addr_ptr, value);
+  const uint8_t byte = rb(c, addr);
+  const uint8_t value = byte + 1;
+
+  modify(c, addr, byte, value);
   set_zn(c, value);
+  return value;
 }
 
 /* Logical instructions */
 
 static inline void
-AND(MOS_6510* const c)
+AND(MOS_6510* const c, uint16_t addr)
 {
-  uint8_t value = rb(c, c->addr_ptr);
+  uint8_t value = rb(c, addr);
   c->a &= value;
   set_zn(c, c->a);
 }
 
 static inline void
-ORA(MOS_6510* const c)
+ORA(MOS_6510* const c, uint16_t addr)
 {
-  uint8_t value = rb(c, c->addr_ptr);
+  uint8_t value = rb(c, addr);
   c->a |= value;
   set_zn(c, c->a);
 }
 
 static inline void
-EOR(MOS_6510* const c)
+EOR(MOS_6510* const c, uint16_t addr)
 {
-  uint8_t value = rb(c, c->addr_ptr);
+  uint8_t value = rb(c, addr);
   c->a ^= value;
   set_zn(c, c->a);
 }
 
 static inline void
-BIT(MOS_6510* const c)
+BIT(MOS_6510* const c, uint16_t addr)
 {
-  uint8_t byte = rb(c, c->addr_ptr);
+  uint8_t byte = rb(c, addr);
   uint8_t value = c->a & byte;
 
-  c->vf = (byte >> 6) & 1;
-  c->zf = value == 0;
-  c->nf = byte >> 7;
+  set_v(c, (byte >> 6) & 1);
+  set_nz(c, byte >> 7, value == 0);
 }
 
 static inline void
-CMP(MOS_6510* const c)
+compare(MOS_6510* const c, uint8_t reg, uint8_t byte)
 {
-  uint8_t byte = rb(c, c->addr_ptr);
-  uint8_t result = c->a - byte;
+  uint8_t result = reg - byte;
 
-  c->cf = c->a >= byte;
+  c->cf = reg >= byte;
   set_zn(c, result);
 }
 
 static inline void
-CPX(MOS_6510* const c)
+CMP(MOS_6510* const c, uint16_t addr)
 {
-  uint8_t byte = rb(c, c->addr_ptr);
-  uint8_t result = c->x - byte;
-
-  c->cf = c->x >= byte;
-  set_zn(c, result);
+  compare(c, c->a, rb(c, addr));
 }
 
 static inline void
-CPY(MOS_6510* const c)
+CPX(MOS_6510* const c, uint16_t addr)
 {
-  uint8_t byte = rb(c, c->addr_ptr);
-  uint8_t result = c->y - byte;
+  compare(c, c->x, rb(c, addr));
+}
 
-  c->cf = c->y >= byte;
-  set_zn(c, result);
+static inline void
+CPY(MOS_6510* const c, uint16_t addr)
+{
+  compare(c, c->y, rb(c, addr));
 }
 
 
 /* Rotation instructions */
 
 static inline void
-ASL(MOS_6510* const c)
+ASL(MOS_6510* const c, uint16_t addr)
 {
   uint8_t value = c->a << 1;
 
@@ -403,20 +696,21 @@ ASL(MOS_6510* const c)
   c->a = value;
 }
 
-static inline void
-ASL_MEM(MOS_6510* const c)
+static inline uint8_t
+ASL_MEM(MOS_6510* const c, uint16_t addr)
 {
-  uint8_t byte = rb(c, c->addr_ptr);
+  uint8_t byte = rb(c, addr);
   uint8_t value = byte << 1;
 
   set_zn(c, value);
   c->cf = byte >> 7;
 
-  wb(c, c->addr_ptr, value);
+  modify(c, addr, byte, value);
+  return value;
 }
 
 static inline void
-LSR(MOS_6510* const c)
+LSR(MOS_6510* const c, uint16_t addr)
 {
   uint8_t value = c->a >> 1;
 
@@ -426,20 +720,21 @@ LSR(MOS_6510* const c)
   c->a = value;
 }
 
-static inline void
-LSR_MEM(MOS_6510* const c)
+static inline uint8_t
+LSR_MEM(MOS_6510* const c, uint16_t addr)
 {
-  uint8_t byte = rb(c, c->addr_ptr);
+  uint8_t byte = rb(c, addr);
   uint8_t value = byte >> 1;
 
   set_zn(c, value);
   c->cf = byte & 1;
 
-  wb(c, c->addr_ptr, value);
+  modify(c, addr, byte, value);
+  return value;
 }
 
 static inline void
-ROL(MOS_6510* const c)
+ROL(MOS_6510* const c, uint16_t addr)
 {
   uint8_t value = c->a << 1;
 
@@ -450,21 +745,22 @@ ROL(MOS_6510* const c)
   c->a = value;
 }
 
-static inline void
-ROL_MEM(MOS_6510* const c)
+static inline uint8_t
+ROL_MEM(MOS_6510* const c, uint16_t addr)
 {
-  uint8_t byte = rb(c, c->addr_ptr);
+  uint8_t byte = rb(c, addr);
   uint8_t value = byte << 1;
 
   value |= c->cf;  
   set_zn(c, value);
   c->cf = byte >> 7;
 
-  wb(c, c->addr_ptr, value);
+  modify(c, addr, byte, value);
+  return value;
 }
 
 static inline void
-ROR(MOS_6510* const c)
+ROR(MOS_6510* const c, uint16_t addr)
 {
   uint8_t value = c->a >> 1;
 
@@ -475,142 +771,130 @@ ROR(MOS_6510* const c)
   c->a = value;
 }
 
-static inline void
-ROR_MEM(MOS_6510* const c)
+static inline uint8_t
+ROR_MEM(MOS_6510* const c, uint16_t addr)
 {
-  uint8_t byte = rb(c, c->addr_ptr);
+  uint8_t byte = rb(c, addr);
   uint8_t value = byte >> 1;
 
   value |= c->cf << 7; 
   set_zn(c, value);
   c->cf = byte & 1;
  
-  wb(c, c->addr_ptr, value);
+  modify(c, addr, byte, value);
+  return value;
 }
 
 
 /* Branching instructions */
 
+/*
+ * A taken branch costs one cycle, plus one more if it lands on another page.
+ * The interrupt lines aren't sampled on the first of them, so without a page
+ * crossing the branch is taken as if it had ended one cycle earlier.
+ */
+
 static inline void
-BPL(MOS_6510* const c)
+branch(MOS_6510* const c, bool condition, uint16_t addr)
 {
-  if(!c->nf)
+  if(condition)
   {
-    if(page_crossed(c->pc, c->pc + c->addr_rel)) c->page_crossed = 1;
-    c->pc += c->addr_rel;
-    c->cyc++;
+#ifdef CYCLE_CORE
+    const uint8_t sampled = c->irq_sampled;
+
+    idle(c, c->pc);
+    c->irq_sampled = sampled;
+
+    if(page_crossed(c->pc, addr)) idle(c, (c->pc & 0xFF00) | (addr & 0xFF));
+#else
+    c->cyc += 1 + page_crossed(c->pc, addr);
+#endif
+    c->pc = addr;
   }
 }
 
 static inline void
-BMI(MOS_6510* const c)
+BPL(MOS_6510* const c, uint16_t addr)
 {
-  if(c->nf)
-  {
-    if(page_crossed(c->pc, c->pc + c->addr_rel)) c->page_crossed = 1;
-    c->pc += c->addr_rel;
-    c->cyc++;
-  }
+  branch(c, !flag_n(c), addr);
 }
 
 static inline void
-BVC(MOS_6510* const c)
+BMI(MOS_6510* const c, uint16_t addr)
 {
-  if(!c->vf)
-  {
-    if(page_crossed(c->pc, c->pc + c->addr_rel)) c->page_crossed = 1;
-    c->pc += c->addr_rel;
-    c->cyc++;
-  }
+  branch(c, flag_n(c), addr);
 }
 
 static inline void
-BVS(MOS_6510* const c)
+BVC(MOS_6510* const c, uint16_t addr)
 {
-  if(c->vf)
-  {
-    if(page_crossed(c->pc, c->pc + c->addr_rel)) c->page_crossed = 1;
-    c->pc += c->addr_rel;
-    c->cyc++;
-  }
+  branch(c, !flag_v(c), addr);
 }
 
 static inline void
-BCC(MOS_6510* const c)
+BVS(MOS_6510* const c, uint16_t addr)
 {
-  if(!c->cf)
-  {
-    if(page_crossed(c->pc, c->pc + c->addr_rel)) c->page_crossed = 1;
-    c->pc += c->addr_rel;
-    c->cyc++;
-  }
+  branch(c, flag_v(c), addr);
 }
 
 static inline void
-BCS(MOS_6510* const c)
+BCC(MOS_6510* const c, uint16_t addr)
 {
-  if(c->cf)
-  {
-    if(page_crossed(c->pc, c->pc + c->addr_rel)) c->page_crossed = 1;
-    c->pc += c->addr_rel;
-    c->cyc++;
-  }
+  branch(c, !c->cf, addr);
 }
 
 static inline void
-BNE(MOS_6510* const c)
+BCS(MOS_6510* const c, uint16_t addr)
 {
-  if(!c->zf)
-  {
-    if(page_crossed(c->pc, c->pc + c->addr_rel)) c->page_crossed = 1;
-    c->pc += c->addr_rel;
-    c->cyc++;
-  }
+  branch(c, c->cf, addr);
 }
 
 static inline void
-BEQ(MOS_6510* const c)
+BNE(MOS_6510* const c, uint16_t addr)
 {
-  if(c->zf)
-  {
-    if(page_crossed(c->pc, c->pc + c->addr_rel)) c->page_crossed = 1;
-    c->pc += c->addr_rel;
-    c->cyc++;
-  }
+  branch(c, !flag_z(c), addr);
+}
+
+static inline void
+BEQ(MOS_6510* const c, uint16_t addr)
+{
+  branch(c, flag_z(c), addr);
 }
 
-/* Stack instructions */
+/* Stack instructions, pulls spend a cycle on incrementing SP first */
 
 static inline void
-PHA(MOS_6510* const c)
+PHA(MOS_6510* const c, uint16_t addr)
 {
   push_byte(c, c->a);
 }
 
 static inline void
-PHP(MOS_6510* const c)
+PHP(MOS_6510* const c, uint16_t addr)
 {
   c->bf = 1;
   push_byte(c, get_flags(c));
 }
 
 static inline void
-PLA(MOS_6510* const c)
+PLA(MOS_6510* const c, uint16_t addr)
 {
+  idle(c, 0x100 + c->sp);
   c->a = pop_byte(c);
   set_zn(c, c->a);
 }
 
 static inline void
-PLP(MOS_6510* const c)
+PLP(MOS_6510* const c, uint16_t addr)
 {
+  idle(c, 0x100 + c->sp);
   set_flags(c, pop_byte(c));
 }
 
 /* System instructions */
 
 static inline void
-BRK(MOS_6510* const c)
+BRK(MOS_6510* const c, uint16_t addr)
 {
   c->bf = 1;
 
@@ -624,63 +908,87 @@ BRK(MOS_6510* const c)
   c->pc = rw(c, INTERRUPT_VECTOR);
 }
 
-void
-IRQ(MOS_6510* const c)
+/* Interrupt sequence, like BRK it reads the next opcode twice before pushing PC and P */
+
+static void
+interrupt(MOS_6510* const c, uint16_t vector)
 {
-  if(c->idf) return;
+  idle(c, c->pc);
+  idle(c, c->pc);
 
   push_word(c, c->pc);
   c->bf = 0;
   push_byte(c, get_flags(c));
   c->idf = 1;
 
-  c->pc = rw(c, INTERRUPT_VECTOR);
+  c->pc = rw(c, vector);
+  c->loop.head = -1; // The handler may change what the loop reads
+  c->busy_loop = -1;
 
+#ifdef CYCLE_CORE
+  c->irq_sampled = 0; // The first instruction of the handler always runs
+#else
   c->cyc += 7;
+#endif
+#ifdef PROFILER
+  profile_call(c, c->pc);
+#endif
 }
 
 void
-NMI(MOS_6510* const c)
+IRQ(MOS_6510* const c)
 {
-  push_word(c, c->pc);
-  c->bf = 0;
-  push_byte(c, get_flags(c));
-  c->idf = 1;
+  if(c->idf) return;
 
-  c->pc = rw(c, NMI_VECTOR);
+  interrupt(c, INTERRUPT_VECTOR);
+}
 
-  c->cyc += 7;
+void
+NMI(MOS_6510* const c)
+{
+  interrupt(c, NMI_VECTOR);
 }
 
 static inline void
-RTS(MOS_6510* const c)
+RTS(MOS_6510* const c, uint16_t addr)
 {
+  idle(c, 0x100 + c->sp);
   c->pc = pop_word(c);
+  idle(c, c->pc);
   c->pc++;
 }
 
 static inline void
-JMP(MOS_6510* const c)
+JMP(MOS_6510* const c, uint16_t addr)
 {
-  c->pc = c->addr_ptr;
+  c->pc = addr;
 }
 
 static inline void
-JSR(MOS_6510* const c)
+JSR(MOS_6510* const c, uint16_t addr)
 {
   push_word(c, c->pc - 1);
-  c->pc = c->addr_ptr;
+  c->pc = addr;
 }
 
 static inline void
-NOP(MOS_6510* const c) 
+NOP(MOS_6510* const c, uint16_t addr) 
 {
   (void) c;
 }
 
+/* The undocumented NOPs with an operand read it like LDA would */
+
 static inline void
-RTI(MOS_6510* const c)
+NOP_MEM(MOS_6510* const c, uint16_t addr)
 {
+  rb(c, addr);
+}
+
+static inline void
+RTI(MOS_6510* const c, uint16_t addr)
+{
+  idle(c, 0x100 + c->sp);
   set_flags(c, pop_byte(c));
   c->pc = pop_word(c);
 }
@@ -688,70 +996,70 @@ RTI(MOS_6510* const c)
 /* Clear, Set instructions */
 
 static inline void
-CLC(MOS_6510* const c) 
+CLC(MOS_6510* const c, uint16_t addr) 
 {
   c->cf = 0;
 }
 
 static inline void
-CLD(MOS_6510* const c) 
+CLD(MOS_6510* const c, uint16_t addr) 
 {
   c->df = 0;
 }
 
 static inline void
-CLI(MOS_6510* const c) 
+CLI(MOS_6510* const c, uint16_t addr) 
 {
   c->idf = 0;
 }
 
 static inline void
-CLV(MOS_6510* const c) 
+CLV(MOS_6510* const c, uint16_t addr) 
 {
-  c->vf = 0;
+  set_v(c, 0);
 }
 
 static inline void
-SEC(MOS_6510* const c) 
+SEC(MOS_6510* const c, uint16_t addr) 
 {
   c->cf = 1;
 }
 
 static inline void
-SED(MOS_6510* const c) 
+SED(MOS_6510* const c, uint16_t addr) 
 {
   c->df = 1;
 }
 
 static inline void
-SEI(MOS_6510* const c) 
+SEI(MOS_6510* const c, uint16_t addr) 
 {
   c->idf = 1;
 }
 
 /* Undocumented opcodes */
 
+/* Halts the CPU with PC on the JAM, run_cycles() reports STOP_JAM until reset() */
+
 static inline void
-JAM(MOS_6510* const c)
+JAM(MOS_6510* const c, uint16_t addr)
 {
-  (void) c;
-  while(1)
-  {
-    /* Does nothing */
-  }
+  (void) addr;
+  c->halted = true;
+  c->pc--;
 }
 
 static inline void 
-SLO(MOS_6510* const c)
+SLO(MOS_6510* const c, uint16_t addr)
 {
-  ASL_MEM(c);
-  ORA(c);
+  c->a |= ASL_MEM(c, addr);
+  set_zn(c, c->a);
 }
 
 static inline void
-ANC(MOS_6510* const c)
+ANC(MOS_6510* const c, uint16_t addr)
 {
-  AND(c);
+  AND(c, addr);
   uint8_t value = c->a << 1;
 
   set_zn(c, value);
@@ -759,116 +1067,126 @@ ANC(MOS_6510* const c)
 }
 
 static inline void
-RLA(MOS_6510* const c)
+RLA(MOS_6510* const c, uint16_t addr)
 {
-  ROL_MEM(c);
-  AND(c);
+  c->a &= ROL_MEM(c, addr);
+  set_zn(c, c->a);
 }
 
 static inline void
-SRE(MOS_6510* const c)
+SRE(MOS_6510* const c, uint16_t addr)
 {
-  LSR_MEM(c);
-  EOR(c);
+  c->a ^= LSR_MEM(c, addr);
+  set_zn(c, c->a);
 }
 
 static inline void
-ALR(MOS_6510* const c)
+ALR(MOS_6510* const c, uint16_t addr)
 {
-  AND(c);
-  LSR(c);
+  AND(c, addr);
+  LSR(c, addr);
 }
 
 static inline void
-RRA(MOS_6510* const c)
+RRA(MOS_6510* const c, uint16_t addr)
 {
-  ROR_MEM(c);
-  ADC(c);
+  add(c, ROR_MEM(c, addr));
 }
 
 static inline void
-SAX(MOS_6510* const c)
+SAX(MOS_6510* const c, uint16_t addr)
 {
-  wb(c, c->addr_ptr, c->a & c->x);
+  wb(c, addr, c->a & c->x);
 }
 
 static inline void
-LAX(MOS_6510* const c)
+LAX(MOS_6510* const c, uint16_t addr)
 {
-  set_zn(c, c->a = c->x = rb(c, c->addr_ptr));
+  set_zn(c, c->a = c->x = rb(c, addr));
 }
 
 static inline void
-DCP(MOS_6510* const c)
+DCP(MOS_6510* const c, uint16_t addr)
 {
-  DEC(c);
-  CMP(c);
+  compare(c, c->a, DEC(c, addr));
 }
 
 static inline void
-ARR(MOS_6510* const c)
+ARR(MOS_6510* const c, uint16_t addr)
 {
-  AND(c); 
-  ROR(c);
+  AND(c, addr); 
+  ROR(c, addr);
 }
 
 static inline void
-TAS(MOS_6510* const c)
+TAS(MOS_6510* const c, uint16_t addr)
 {
   c->sp = c->a & c->x;
-  wb(c, c->addr_ptr, c->a & c->x & ((c->addr_ptr >> 8) + 1));
+  wb(c, addr, c->a & c->x & ((addr >> 8) + 1));
 }
 
 static inline void
-LAS(MOS_6510* const c)
+LAS(MOS_6510* const c, uint16_t addr)
 {
-  c->a = c->x = c->sp = c->addr_ptr & c->sp;
+  set_zn(c, c->a = c->x = c->sp = rb(c, addr) & c->sp);
 }
 
 static inline void
-USBC(MOS_6510* const c)
+USBC(MOS_6510* const c, uint16_t addr)
 {
-  SBC(c);
-  NOP(c);
+  SBC(c, addr);
+  NOP(c, addr);
 }
 
 static inline void
-XAA(MOS_6510* const c) 
+XAA(MOS_6510* const c, uint16_t addr) 
 {
   c->a = (c->a | UNSTABLE_CONST) & c->x;
-  c->a &= c->addr_ptr;
+  c->a &= rb(c, addr);
   set_zn(c, c->a);
 }
 
 static inline void
-AHX(MOS_6510* const c) 
+AHX(MOS_6510* const c, uint16_t addr) 
+{
+  wb(c, addr, c->a & c->x & ((addr >> 8) + 1));
+}
+
+static inline void
+SHY(MOS_6510* const c, uint16_t addr) 
 {
-  wb(c, c->addr_ptr, c->a & c->x & ((c->addr_ptr >> 8) + 1));
+  wb(c, addr, c->y & ((addr >> 8) + 1));
 }
 
 static inline void
-SHY(MOS_6510* const c) 
+SHX(MOS_6510* const c, uint16_t addr) 
 {
-  wb(c, c->addr_ptr, c->y & ((c->addr_ptr >> 8) + 1));
+  wb(c, addr, c->x & ((addr >> 8) + 1));
 }
 
 static inline void
-SHX(MOS_6510* const c) 
+AXS(MOS_6510* const c, uint16_t addr) 
 {
-  wb(c, c->addr_ptr, c->x & ((c->addr_ptr >> 8) + 1));
+  wb(c, addr, c->x & c->a);
 }
 
 static inline void
-AXS(MOS_6510* const c) 
+ISC(MOS_6510* const c, uint16_t addr) 
 {
-  wb(c, c->addr_ptr, c->x & c->a);
+  subtract(c, INC(c, addr));
 }
 
+/* Journals the state in front of an instruction or interrupt sequence, see rewind.h */
+
 static inline void
-ISC(MOS_6510* const c) 
+rewind_step(MOS_6510* const c, bool interrupt)
 {
-  INC(c);
-  SBC(c);
+#ifdef REWIND
+  if(__builtin_expect(c->rewind != NULL, 0)) rewind_record(c, interrupt);
+#else
+  (void) c;
+  (void) interrupt;
+#endif
 }
 
 void 
@@ -876,320 +1194,966 @@ interrupt_handler(MOS_6510* const c)
 {
   if((c->irq_status & 0x2) == 0x2)
   {
+    rewind_step(c, true);
     NMI(c);
     c->irq_status &= ~0x2;
   }
   if(!c->idf && (c->irq_status & 0x1) == 0x1)
   {
+    rewind_step(c, true);
     IRQ(c);
     c->irq_status &= ~0x1;
   }
 }
 
+#ifdef CYCLE_CORE
+
+/*
+ * Takes the interrupt sampled in front of the last cycle of the previous
+ * instruction, with I as it was then: a line raised on that cycle waits
+ * for the next instruction, after SEI an IRQ still gets in, after CLI it
+ * doesn't yet.
+ */
+
+static inline void
+sampled_interrupt(MOS_6510* const c)
+{
+  rewind_step(c, true);
+
+  if(c->irq_sampled & 0x2)
+  {
+    NMI(c);
+    c->irq_status &= ~0x2;
+  }
+  else
+  {
+    interrupt(c, INTERRUPT_VECTOR);
+    c->irq_status &= ~0x1;
+  }
+}
+
+#endif // CYCLE_CORE
+
+
+#ifdef OPCODE_STATS
+
+/* A branch pays the page crossing penalty only when taken, on top of the cycle for taking it */
+
+static inline void
+opcode_counted(MOS_6510* const c, uint8_t op, enum ADDR_MODE mode, uint8_t cycle, uint64_t elapsed, bool page)
+{
+  struct opcode_stats* const s = &c->opcode_stats[op];
+
+  s->executed++;
+  s->cycles += elapsed;
+  s->crossed += mode == RELATIVE ? elapsed == cycle + 2u : page;
+}
+
+#define STATS_COUNT(op, cycle, mode, page) opcode_counted(c, op, mode, cycle, c->cyc - count_cyc, page)
+#else
+#define STATS_COUNT(op, cycle, mode, page)
+#endif // OPCODE_STATS
+
+#ifdef PROFILER
+#define PROFILE_COUNT(op) profile_counted(c, op, count_pc, c->cyc - count_cyc)
+#else
+#define PROFILE_COUNT(op)
+#endif
+
+/*
+ * Cycles and address of the instruction for the counters above, `charged`
+ * are the cycles and `fetched` the bytes of it used up before the handler.
+ */
+
+#if defined(OPCODE_STATS) || defined(PROFILER)
+#define COUNT_START(charged, fetched)                \
+  const uint64_t count_cyc = c->cyc - (charged);     \
+  const uint16_t count_pc = c->pc - (fetched);       \
+  (void) count_pc
+#else
+#define COUNT_START(charged, fetched)
+#endif
+
+#ifdef TRACER
+
+/* Appends the state in front of the instruction at `pc` that is about to run */
+
+static inline __attribute__((always_inline)) void
+trace_instruction(MOS_6510* const c, uint16_t pc, uint8_t opcode, uint64_t cyc)
+{
+  struct trace_record* r = c->trace_cursor;
+
+  if(__builtin_expect(r == NULL, 1)) return;
+  if(r == c->trace_end) r = trace_batch(c);
+
+  /*
+   * Byte-sized fields are copied one by one, a wide load over them would
+   * wait for the instruction that just stored one. B, D, I and V are
+   * stored rarely and copied in one go.
+   */
+  r->pc = pc;
+  r->opcode = opcode;
+  r->a = c->a;
+  r->x = c->x;
+  r->y = c->y;
+  r->sp = c->sp;
+  r->zn = c->zn;
+  r->cf = c->cf;
+  memcpy(&r->bf, &c->bf, offsetof(MOS_6510, v_r) + 1 - offsetof(MOS_6510, bf));
+  r->cyc = cyc;
+
+  c->trace_cursor = r + 1;
+}
+
+#define TRACE_START(op, charged, fetched) trace_instruction(c, c->pc - (fetched), op, c->cyc - (charged))
+#else
+#define TRACE_START(op, charged, fetched)
+#endif
+
+/*
+ * Instructions are traced where they are dispatched, in step() and the
+ * block loop, which leaves the handlers called through a pointer lean.
+ * The threaded core's handlers are inlined into its dispatch and trace
+ * themselves, which measured faster there.
+ */
+
+#ifdef THREADED_CORE
+#define THREADED_TRACE(op) TRACE_START(op, 0, 1)
+#else
+#define THREADED_TRACE(op)
+#endif
+
+/*
+ * One handler per opcode, generated from opcodes.h with the addressing
+ * mode, cycle count and page crossing penalty of that opcode inlined.
+ */
+
+#ifndef CYCLE_CORE
+
+#define HANDLER(op, mnemonic, func, cycle, mode, crossed)     \
+  static void                                                 \
+  op_##op(MOS_6510* const c)                                  \
+  {                                                           \
+    THREADED_TRACE(op);                                       \
+    COUNT_START(0, 1);                                        \
+    bool page = 0;                                            \
+    const uint16_t addr =                                     \
+      effective_address(c, mode, operand(c, mode), &page);    \
+                                                              \
+    c->cyc += cycle;                                          \
+    func(c, addr);                                            \
+                                                              \
+    if(page) c->cyc += crossed;                               \
+    STATS_COUNT(op, cycle, mode, page && crossed);            \
+    PROFILE_COUNT(op);                                        \
+  }
+
+#else
+
+/* JSR pushes the return address before it fetches the high byte of the target */
+
+static inline void
+cycle_jsr(MOS_6510* const c)
+{
+  const uint8_t lo = fetch_byte(c);
+
+  idle(c, 0x100 + c->sp);
+  push_word(c, c->pc);
+  c->pc = fetch_byte(c) << 8 | lo;
+}
+
+/*
+ * The cycle engine's handlers count cycles as they go, the opcode fetch is
+ * already counted. Opcodes without a page crossing penalty always spend
+ * the cycle fixing up an indexed address, see cycle_address().
+ */
+
+#define HANDLER(op, mnemonic, func, cycle, mode, crossed)     \
+  static void                                                 \
+  op_##op(MOS_6510* const c)                                  \
+  {                                                           \
+    COUNT_START(1, 1);                                        \
+    bool page = 0;                                            \
+                                                              \
+    if(op == 0x20) cycle_jsr(c);                              \
+    else func(c, cycle_address(c, mode, !(crossed), &page));  \
+                                                              \
+    STATS_COUNT(op, cycle, mode, page && crossed);            \
+    PROFILE_COUNT(op);                                        \
+  }
+
+#endif // CYCLE_CORE
+
+OPCODE_TABLE(HANDLER)
+#undef HANDLER
 
 /* Opcode execution array */
 
-struct instruction opcodes[256] = 
-{
-  {BRK, 7, IMPLIED, 0}, /* 0x00 */
-  {ORA, 6, INDIRECT_X, 0}, /* 0x01 */
-  {JAM, 2, IMPLIED, 0}, /* 0x02 */
-  {SLO, 8, INDIRECT_X, 0}, /* 0x03 */
-  {NOP, 3, ZEROPAGE, 0}, /* 0x04 */
-  {ORA, 3, ZEROPAGE, 0}, /* 0x05 */
-  {ASL_MEM, 5, ZEROPAGE, 0}, /* 0x06 */
-  {SLO, 5, ZEROPAGE, 0}, /* 0x07 */
-  {PHP, 3, IMPLIED, 0}, /* 0x08 */
-  {ORA, 2, IMMEDIATE, 0}, /* 0x09 */
-  {ASL, 2, ACCUMULATOR, 0}, /* 0x0A */
-  {ANC, 2, IMMEDIATE, 0}, /* 0x0B */
-  {NOP, 4, ABSOLUTE, 0}, /* 0x0C */
-  {ORA, 4, ABSOLUTE, 0}, /* 0x0D */
-  {ASL_MEM, 6, ABSOLUTE, 0}, /* 0x0E */
-  {SLO, 6, ABSOLUTE, 0}, /* 0x0F */
-  {BPL, 2, RELATIVE, 1}, /* 0x10 */
-  {ORA, 5, INDIRECT_Y, 1}, /* 0x11 */
-  {JAM, 0, IMPLIED, 0}, /* 0x12 */
-  {SLO, 8, INDIRECT_X, 0}, /* 0x13 */
-  {NOP, 4, ZEROPAGE_X, 0}, /* 0x14 */
-  {ORA, 4, ZEROPAGE_X, 0}, /* 0x15 */
-  {ASL_MEM, 6, ZEROPAGE_X, 0}, /* 0x16 */
-  {SLO, 6, ZEROPAGE, 0}, /* 0x17 */
-  {CLC, 2, IMPLIED, 0}, /* 0x18 */
-  {ORA, 4, ABSOLUTE_Y, 1}, /* 0x19 */
-  {NOP, 2, IMPLIED, 0}, /* 0x1A */
-  {SLO, 7, ABSOLUTE_Y, 0}, /* 0x1B */
-  {NOP, 4, ABSOLUTE_X, 1}, /* 0x1C */
-  {ORA, 4, ABSOLUTE_X, 1}, /* 0x1D */
-  {ASL_MEM, 7, ABSOLUTE_X, 0}, /* 0x1E */
-  {SLO, 7, ABSOLUTE_X, 0}, /* 0x1F */
-  {JSR, 6, ABSOLUTE, 0}, /* 0x20 */
-  {AND, 6, INDIRECT_X, 0}, /* 0x21 */
-  {JAM, 0, IMPLIED, 0}, /* .0x22 */
-  {RLA, 8, INDIRECT_X, 0}, /* 0x23 */
-  {BIT, 3, ZEROPAGE, 0}, /* 0x24 */
-  {AND, 3, ZEROPAGE, 0}, /* 0x25 */
-  {ROL_MEM, 5, ZEROPAGE, 0}, /* 0x26 */
-  {RLA, 5, ZEROPAGE, 0}, /* 0x27 */
-  {PLP, 4, IMPLIED, 0}, /* 0x28 */
-  {AND, 2, IMMEDIATE, 0}, /* 0x29 */
-  {ROL, 2, ACCUMULATOR, 0}, /* 0x2A */
-  {ANC, 2, IMMEDIATE, 0}, /* 0x2B */
-  {BIT, 4, ABSOLUTE, 0}, /* 0x2C */
-  {AND, 4, ABSOLUTE, 0}, /* 0x2D */
-  {ROL_MEM, 6, ABSOLUTE, 0}, /* 0x2E */
-  {RLA, 6, ABSOLUTE, 0}, /* 0x2F */
-  {BMI, 2, RELATIVE, 1}, /* 0x30 */
-  {AND, 5, INDIRECT_Y, 1}, /* 0x31 */
-  {JAM, 0, IMPLIED, 0}, /* 0x32 */
-  {RLA, 8, INDIRECT_Y, 0}, /* 0x33 */
-  {NOP, 4, ZEROPAGE_X, 0}, /* 0x34 */
-  {AND, 4, ZEROPAGE_X, 0}, /* 0x35 */
-  {ROL_MEM, 6, ZEROPAGE_X, 0}, /* 0x36 */
-  {RLA, 6, ZEROPAGE_X, 0}, /* 0x37 */
-  {SEC, 2, IMPLIED, 0}, /* 0x38 */
-  {AND, 4, ABSOLUTE_Y, 1}, /* 0x39 */
-  {NOP, 2, IMPLIED, 0}, /* 0x3A */
-  {RLA, 7, ABSOLUTE_Y, 0}, /* 0x3B */
-  {NOP, 4, ABSOLUTE_Y, 1}, /* 0x3C */
-  {AND, 4, ABSOLUTE_X, 1}, /* 0x3D */
-  {ROL_MEM, 7, ABSOLUTE_X, 0}, /* 0x3E */
-  {RLA, 7, ABSOLUTE_X, 0}, /* 0x3F */
-  {RTI, 6, IMPLIED, 0}, /* 0x40 */
-  {EOR, 6, INDIRECT_X, 0}, /* 0x41 */
-  {JAM, 0, IMPLIED, 0}, /* 0x42 */
-  {SRE, 8, INDIRECT_X, 0}, /* 0x43 */
-  {NOP, 3, ZEROPAGE, 0}, /* 0x44 */
-  {EOR, 3, ZEROPAGE, 0}, /* 0x45 */
-  {LSR_MEM, 5, ZEROPAGE, 0}, /* 0x46 */
-  {SRE, 5, ZEROPAGE, 0}, /* 0x47 */
-  {PHA, 3, IMPLIED, 0}, /* 0x48 */
-  {EOR, 2, IMMEDIATE, 0}, /* 0x49 */
-  {LSR, 2, ACCUMULATOR, 0}, /* 0x4A */
-  {ALR, 2, IMMEDIATE, 0}, /* 0x4B */
-  {JMP, 3, ABSOLUTE, 0}, /* 0x4C */
-  {EOR, 4, ABSOLUTE, 0}, /* 0x4D */
-  {LSR_MEM, 6, ABSOLUTE, 0}, /* 0x4E */
-  {SRE, 6, ABSOLUTE, 0}, /* 0x4F */
-  {BVC, 2, RELATIVE, 1}, /* 0x50 */
-  {EOR, 5, INDIRECT_Y, 1}, /* 0x51 */
-  {JAM, 0, IMPLIED, 0}, /* 0x52 */
-  {SRE, 8, INDIRECT_Y, 0}, /* 0x53 */
-  {NOP, 4, ZEROPAGE_X, 0}, /* 0x54 */
-  {EOR, 4, ZEROPAGE_X, 0}, /* 0x55 */
-  {LSR_MEM, 6, ZEROPAGE_X, 0}, /* 0x56 */
-  {SRE, 6, ZEROPAGE_X, 0}, /* 0x57 */
-  {CLI, 2, IMPLIED, 0}, /* 0x58 */
-  {EOR, 4, ABSOLUTE_Y, 1}, /* 0x59 */
-  {NOP, 2, IMPLIED, 0}, /* 0x5A */
-  {SRE, 7, ABSOLUTE_Y, 0}, /* 0x5B */
-  {NOP, 4, ABSOLUTE_X, 1}, /* 0x5C */
-  {EOR, 4, ABSOLUTE_X, 1}, /* 0x5D */
-  {LSR_MEM, 7, ABSOLUTE_X, 0}, /* 0x5E */
-  {SRE, 7, ABSOLUTE_X, 0}, /* 0x5F */
-  {RTS, 6, IMPLIED, 0}, /* 0x60 */
-  {ADC, 6, INDIRECT_X, 0}, /* 0x61 */
-  {JAM, 0, IMPLIED, 0}, /* 0x62 */
-  {RRA, 8, INDIRECT_X, 0}, /* 0x63 */
-  {NOP, 3, ZEROPAGE, 0}, /* 0x64 */
-  {ADC, 3, ZEROPAGE, 0}, /* 0x65 */
-  {ROR_MEM, 5, ZEROPAGE, 0}, /* 0x66 */
-  {RRA, 5, ZEROPAGE, 0}, /* 0x67 */
-  {PLA, 4, IMPLIED, 0}, /* 0x68 */
-  {ADC, 2, IMMEDIATE, 0}, /* 0x69 */
-  {ROR, 2, ACCUMULATOR, 0}, /* 0x6A */
-  {ARR, 2, IMMEDIATE, 0}, /* 0x6B */
-  {JMP, 5, INDIRECT, 0}, /* 0x6C */
-  {ADC, 4, ABSOLUTE, 0}, /* 0x6D */
-  {ROR_MEM, 6, ABSOLUTE, 0}, /* 0x6E */
-  {RRA, 6, ABSOLUTE, 0}, /* 0x6F */
-  {BVS, 2, RELATIVE, 1}, /* 0x70 */
-  {ADC, 5, INDIRECT_Y, 1}, /* 0x71 */
-  {JAM, 0, IMPLIED, 0}, /* 0x72 */
-  {RRA, 8, INDIRECT_Y, 0}, /* 0x73 */
-  {NOP, 4, ZEROPAGE_X, 0}, /* 0x74 */
-  {ADC, 4, ZEROPAGE_X, 0}, /* 0x75 */
-  {ROR_MEM, 6, ZEROPAGE_X, 0}, /* 0x76 */
-  {RRA, 6, ZEROPAGE_X, 0}, /* 0x77 */
-  {SEI, 2, IMPLIED, 0}, /* 0x78 */
-  {ADC, 4, ABSOLUTE_Y, 1}, /* 0x79 */
-  {NOP, 2, IMPLIED, 0}, /* 0x7A */
-  {RRA, 7, ABSOLUTE_Y, 0}, /* 0x7B */
-  {NOP, 4, ABSOLUTE_X, 1}, /* 0x7C */
-  {ADC, 4, ABSOLUTE_X, 1}, /* 0x7D */
-  {ROR_MEM, 7, ABSOLUTE_X, 0}, /* 0x7E */
-  {RRA, 7, ABSOLUTE_X, 0}, /* 0x7F */ 
-  {NOP, 2, IMMEDIATE, 0}, /* 0x80 */
-  {STA, 6, INDIRECT_X, 0}, /* 0x81 */
-  {NOP, 2, IMMEDIATE, 0}, /* 0x82 */
-  {SAX, 6, INDIRECT_X, 0}, /* 0x83 */
-  {STY, 3, ZEROPAGE, 0}, /* 0x84 */
-  {STA, 3, ZEROPAGE, 0}, /* 0x85 */
-  {STX, 3, ZEROPAGE, 0}, /* 0x86 */
-  {SAX, 3, ZEROPAGE, 0}, /* 0x87 */
-  {DEY, 2, IMPLIED, 0}, /* 0x88 */
-  {NOP, 2, IMMEDIATE, 0}, /* 0x89 */
-  {TXA, 2, IMPLIED, 0}, /* 0x8A */
-  {XAA, 2, IMMEDIATE, 0}, /* 0x8B */
-  {STY, 4, ABSOLUTE, 0}, /* 0x8C */
-  {STA, 4, ABSOLUTE, 0}, /* 0x8D */
-  {STX, 4, ABSOLUTE, 0}, /* 0x8E */
-  {SAX, 4, ABSOLUTE, 0}, /* 0x8F */
-  {BCC, 2, RELATIVE, 1}, /* 0x90 */
-  {STA, 6, INDIRECT_Y, 0}, /* 0x91 */
-  {JAM, 0, IMPLIED, 0}, /* 0x92 */
-  {AHX, 6, INDIRECT_Y, 0}, /* 0x93 */
-  {STY, 4, ZEROPAGE_X, 0}, /* 0x94 */
-  {STA, 4, ZEROPAGE_X, 0}, /* 0x95 */
-  {STX, 4, ZEROPAGE_Y, 0}, /* 0x96 */
-  {SAX, 4, ZEROPAGE_Y, 0}, /* 0x97 */
-  {TYA, 2, IMPLIED, 0}, /* 0x98 */
-  {STA, 5, ABSOLUTE_Y, 0}, /* 0x99 */
-  {TXS, 2, IMPLIED, 0}, /* 0x9A */
-  {TAS, 5, ABSOLUTE_Y, 0}, /* 0x9B */
-  {SHY, 5, ABSOLUTE_X, 0}, /* 0x9C */
-  {STA, 5, ABSOLUTE_X, 0}, /* 0x9D */
-  {SHX, 5, ABSOLUTE_Y, 0}, /* 0x9E */
-  {AHX, 5, ABSOLUTE_Y, 0}, /* 0x9F */ 
-  {LDY, 2, IMMEDIATE, 0}, /* 0xA0 */
-  {LDA, 6, INDIRECT_X, 0}, /* 0xA1 */
-  {LDX, 2, IMMEDIATE, 0}, /* 0xA2 */
-  {LAX, 6, INDIRECT_X, 0}, /* 0xA3 */
-  {LDY, 3, ZEROPAGE, 0}, /* 0xA4 */
-  {LDA, 3, ZEROPAGE, 0}, /* 0xA5 */
-  {LDX, 3, ZEROPAGE, 0}, /* 0xA6 */
-  {LAX, 3, ZEROPAGE, 0}, /* 0xA7 */
-  {TAY, 2, IMPLIED, 0}, /* 0xA8 */
-  {LDA, 2, IMMEDIATE, 0}, /* 0xA9 */
-  {TAX, 2, IMPLIED, 0}, /* 0xAA */
-  {LAX, 2, IMMEDIATE, 0}, /* 0xAB */
-  {LDY, 4, ABSOLUTE, 0}, /* 0xAC */
-  {LDA, 4, ABSOLUTE, 0}, /* 0xAD */
-  {LDX, 4, ABSOLUTE, 0}, /* 0xAE */
-  {LAX, 4, ABSOLUTE, 0}, /* 0xAF */
-  {BCS, 2, RELATIVE, 1}, /* 0xB0 */
-  {LDA, 5, INDIRECT_Y, 1}, /* 0xB1 */
-  {JAM, 0, IMPLIED, 0}, /* 0xB2 */
-  {LAX, 5, INDIRECT_Y, 1}, /* 0xB3 */
-  {LDY, 4, ZEROPAGE_X, 0}, /* 0xB4 */
-  {LDA, 4, ZEROPAGE_X, 0}, /* 0xB5 */
-  {LDX, 4, ZEROPAGE_Y, 0}, /* 0xB6 */
-  {LAX, 4, ZEROPAGE_Y, 0}, /* 0xB7 */
-  {CLV, 2, IMPLIED, 0}, /* 0xB8 */
-  {LDA, 4, ABSOLUTE_Y, 1}, /* 0xB9 */
-  {TSX, 2, IMPLIED, 0}, /* 0xBA */
-  {LAS, 4, ABSOLUTE_Y, 1}, /* 0xBB */
-  {LDY, 4, ABSOLUTE_X, 1}, /* 0xBC */
-  {LDA, 4, ABSOLUTE_X, 1}, /* 0xBD */
-  {LDX, 4, ABSOLUTE_Y, 1}, /* 0xBE */
-  {LAX, 4, ABSOLUTE_Y, 1}, /* 0xBF */ 
-  {CPY, 2, IMMEDIATE, 0}, /* 0xC0 */
-  {CMP, 6, INDIRECT_X, 0}, /* 0xC1 */
-  {NOP, 2, IMMEDIATE, 0}, /* 0xC2 */
-  {DCP, 8, INDIRECT_X, 0}, /* 0xC3 */
-  {CPY, 3, ZEROPAGE, 0}, /* 0xC4 */
-  {CMP, 3, ZEROPAGE, 0}, /* 0xC5 */
-  {DEC, 5, ZEROPAGE, 0}, /* 0xC6 */
-  {DCP, 5, ZEROPAGE, 0}, /* 0xC7 */
-  {INY, 2, IMPLIED, 0}, /* 0xC8 */
-  {CMP, 2, IMMEDIATE, 0}, /* 0xC9 */
-  {DEX, 2, IMPLIED, 0}, /* 0xCA */
-  {AXS, 2, IMMEDIATE, 0}, /* 0xCB */
-  {CPY, 4, ABSOLUTE, 0}, /* 0xCC */
-  {CMP, 4, ABSOLUTE, 0}, /* 0xCD */
-  {DEC, 6, ABSOLUTE, 0}, /* 0xCE */
-  {DCP, 6, ABSOLUTE_X, 0}, /* 0xCF */
-  {BNE, 2, RELATIVE, 1}, /* 0xD0 */
-  {CMP, 5, INDIRECT_Y, 1}, /* 0xD1 */
-  {JAM, 0, IMPLIED, 0}, /* 0xD2 */
-  {DCP, 8, INDIRECT_Y, 0}, /* 0xD3 */
-  {NOP, 4, ZEROPAGE_X, 0}, /* 0xD4 */
-  {CMP, 4, ZEROPAGE_X, 0}, /* 0xD5 */
-  {DEC, 6, ZEROPAGE_X, 0}, /* 0xD6 */
-  {DCP, 6, ZEROPAGE_X, 0}, /* 0xD7 */
-  {CLD, 2, IMPLIED, 0}, /* 0xD8 */
-  {CMP, 4, ABSOLUTE_Y, 1}, /* 0xD9 */
-  {NOP, 2, IMPLIED, 0}, /* 0xDA */
-  {DCP, 7, ABSOLUTE_Y, 0}, /* 0xDB */
-  {NOP, 4, ABSOLUTE_X, 1}, /* 0xDC */
-  {CMP, 4, ABSOLUTE_X, 1}, /* 0xDD */
-  {DEC, 7, ABSOLUTE_X, 0}, /* 0xDE */
-  {DCP, 7, ABSOLUTE_X, 0}, /* 0xDF */ 
-  {CPX, 2, IMMEDIATE, 0}, /* 0xE0 */
-  {SBC, 6, INDIRECT_X, 0}, /* 0xE1 */
-  {NOP, 2, IMMEDIATE, 0}, /* 0xE2 */
-  {ISC, 8, INDIRECT_X, 0}, /* 0xE3 */
-  {CPX, 3, ZEROPAGE, 0}, /* 0xE4 */
-  {SBC, 3, ZEROPAGE, 0}, /* 0xE5 */
-  {INC, 5, ZEROPAGE, 0}, /* 0xE6 */
-  {ISC, 5, ZEROPAGE, 0}, /* 0xE7 */
-  {INX, 2, IMPLIED, 0}, /* 0xE8 */
-  {SBC, 2, IMMEDIATE, 0}, /* 0xE9 */
-  {NOP, 2, IMPLIED, 0}, /* 0xEA */
-  {USBC, 2, IMMEDIATE, 0}, /* 0xEB */
-  {CPX, 4, ABSOLUTE, 0}, /* 0xEC */
-  {SBC, 4, ABSOLUTE, 0}, /* 0xED */
-  {INC, 6, ABSOLUTE, 0}, /* 0xEE */
-  {ISC, 6, ABSOLUTE, 0}, /* 0xEF */
-  {BEQ, 2, RELATIVE, 1}, /* 0xF0 */
-  {SBC, 5, INDIRECT_Y, 1}, /* 0xF1 */
-  {JAM, 0, IMPLIED, 0}, /* 0xF2 */
-  {ISC, 8, INDIRECT_Y, 0}, /* 0xF3 */
-  {NOP, 4, ZEROPAGE_X, 0}, /* 0xF4 */
-  {SBC, 4, ZEROPAGE_X, 0}, /* 0xF5 */
-  {INC, 6, ZEROPAGE_X, 0}, /* 0xF6 */
-  {ISC, 6, ZEROPAGE_X, 0}, /* 0xF7 */
-  {SED, 2, IMPLIED, 0}, /* 0xF8 */
-  {SBC, 4, ABSOLUTE_Y, 1}, /* 0xF9 */
-  {NOP, 2, IMPLIED, 0}, /* 0xFA */
-  {ISC, 7, ABSOLUTE_Y, 0}, /* 0xFB */
-  {NOP, 4, ABSOLUTE_X, 1}, /* 0xFC */
-  {SBC, 4, ABSOLUTE_X, 1}, /* 0xFD */
-  {INC, 7, ABSOLUTE_X, 0}, /* 0xFE */
-  {ISC, 7, IMPLIED, 0}, /* 0xFF */ 
+#define INSTRUCTION(op, mnemonic, func, cycle, mode, crossed) {op_##op, cycle, mode, crossed},
+const struct instruction opcodes[256] = 
+{
+  OPCODE_TABLE(INSTRUCTION)
 };
+#undef INSTRUCTION
 
 void initialise(MOS_6510* const c)
 {
+  c->pc = rw(c, RESET_VECTOR); // Counted by the cycle engine, so before the counters are cleared
+
   c->cyc = 0;
+  c->instructions = 0;
+#ifdef OPCODE_STATS
+  memset(c->opcode_stats, 0, sizeof(c->opcode_stats));
+#endif
 
   c->a = 0;
   c->x = 0;
   c->y = 0;
 
-  c->nf = 0;
-  c->vf = 0;
+  set_nz(c, 0, 0);
+  set_v(c, 0);
   c->bf = 0;
   c->df = 0;
   c->idf = 0;
-  c->zf = 0;
   c->cf = 0;
 
   c->sp = 0xFD;
-  c->pc = rw(c, RESET_VECTOR);
-
-  c->addr_ptr = 0;
-  c->addr_rel = 0;
 
   c->irq_status = 0;
+  events_clear(c);
+#ifdef CYCLE_CORE
+  c->irq_sampled = 0;
+#endif
+
+  c->halted = false;
+  c->loop.head = -1;
+  c->busy_loop = -1;
+
+#ifdef BLOCK_CORE
+  blocks_flush(c); // Memory may have been loaded behind the bus' back
+#endif
   // c->ram[0x0000] = 0x2F; /* All inputs! */
   // c->ram[0x0001] = 0x37;
 }  
 
+/*
+ * RESET line: the CPU goes through an interrupt sequence with its writes
+ * suppressed and fetches the reset vector. A, X, Y, memory and pending
+ * events are kept, this is the only way out of a JAM.
+ */
+
 void
-mnemonics(MOS_6510* const c)
+reset(MOS_6510* const c)
 {
-  const uint8_t opcode = fetch_byte(c);
+  rewind_step(c, true);
+
+  idle(c, c->pc);
+  idle(c, c->pc);
+
+  for(uint8_t i = 0; i < 3; i++) idle(c, 0x100 + c->sp--);
+
+  c->halted = false;
+  c->idf = 1;
+  c->pc = rw(c, RESET_VECTOR);
+  c->loop.head = -1;
+  c->busy_loop = -1;
 
-  c->cyc += opcodes[opcode].cycle;
-  c->page_crossed = 0;  
+#ifdef CYCLE_CORE
+  c->irq_sampled = 0;
+#else
+  c->cyc += 7;
+#endif
+}
 
-  address_mode(c, opcodes[opcode].address_mode);
+/* Releases what the CPU allocated for itself, the address space belongs to the caller */
 
+void
+cpu_free(MOS_6510* const c)
+{
+#ifdef JIT_CORE
+  jit_free(c);
+#endif
+#ifdef PROFILER
+  profile_stop(c);
+#endif
+#ifdef TRACER
+  trace_stop(c);
+#endif
+#ifdef REWIND
+  rewind_stop(c);
+#endif
+  (void) c;
+}
+
+static inline void
+step(MOS_6510* const c)
+{
+  rewind_step(c, false);
+
+  const uint8_t opcode = fetch_byte(c);
+#if defined(CYCLE_CORE)
+  TRACE_START(opcode, 1, 1); // The opcode fetch is already counted
+#elif !defined(THREADED_CORE)
+  TRACE_START(opcode, 0, 1);
+#endif
   opcodes[opcode].func(c);
+  c->instructions++;
+}
 
-  if(c->page_crossed)
+void
+mnemonics(MOS_6510* const c)
+{
+  if(!c->halted) step(c);
+}
+
+#define IDLE_LOOP 32 // Bytes an idle loop may span at most
+
+/*
+ * Instructions that neither write memory nor touch the stack or I, marked
+ * by handler. IDLE_SAFE(func) is 1 for a marked handler and 0 otherwise:
+ * a mark expands to two arguments, which moves the 1 in front of the 0.
+ */
+
+#define IDLE_SAFE_LDA ~, 1
+#define IDLE_SAFE_LDX ~, 1
+#define IDLE_SAFE_LDY ~, 1
+#define IDLE_SAFE_LAX ~, 1
+#define IDLE_SAFE_CMP ~, 1
+#define IDLE_SAFE_CPX ~, 1
+#define IDLE_SAFE_CPY ~, 1
+#define IDLE_SAFE_BIT ~, 1
+#define IDLE_SAFE_AND ~, 1
+#define IDLE_SAFE_ORA ~, 1
+#define IDLE_SAFE_EOR ~, 1
+#define IDLE_SAFE_ADC ~, 1
+#define IDLE_SAFE_SBC ~, 1
+#define IDLE_SAFE_TAX ~, 1
+#define IDLE_SAFE_TAY ~, 1
+#define IDLE_SAFE_TXA ~, 1
+#define IDLE_SAFE_TYA ~, 1
+#define IDLE_SAFE_TSX ~, 1
+#define IDLE_SAFE_INX ~, 1
+#define IDLE_SAFE_INY ~, 1
+#define IDLE_SAFE_DEX ~, 1
+#define IDLE_SAFE_DEY ~, 1
+#define IDLE_SAFE_CLC ~, 1
+#define IDLE_SAFE_SEC ~, 1
+#define IDLE_SAFE_CLV ~, 1
+#define IDLE_SAFE_CLD ~, 1
+#define IDLE_SAFE_SED ~, 1
+#define IDLE_SAFE_NOP ~, 1
+#define IDLE_SAFE_NOP_MEM ~, 1
+#define IDLE_SAFE_BPL ~, 1
+#define IDLE_SAFE_BMI ~, 1
+#define IDLE_SAFE_BVC ~, 1
+#define IDLE_SAFE_BVS ~, 1
+#define IDLE_SAFE_BCC ~, 1
+#define IDLE_SAFE_BCS ~, 1
+#define IDLE_SAFE_BNE ~, 1
+#define IDLE_SAFE_BEQ ~, 1
+
+#define SECOND(first, second, ...) second
+#define PICK_SECOND(...) SECOND(__VA_ARGS__)
+#define IDLE_SAFE(func) PICK_SECOND(IDLE_SAFE_##func, 0, )
+
+/* JMP $nnnn is the only jump, JMP ($nnnn) shares its handler */
+#define SAFE(op, mnemonic, func, cycle, mode, crossed) [op] = IDLE_SAFE(func) || op == 0x4C,
+static const bool idle_safe[256] = { OPCODE_TABLE(SAFE) };
+#undef SAFE
+
+/* Code bytes, without calling handlers. False if the address isn't plain memory */
+
+static bool
+code_peek(const MOS_6510* const c, uint16_t addr, uint8_t* byte)
+{
+  const uint8_t* const page = addr < 0x200 ? c->low : c->bus->pages[addr >> 8].read;
+
+  if(page == NULL) return false;
+
+  *byte = page[addr < 0x200 ? addr : addr & 0xFF];
+  return true;
+}
+
+/* True if a read of one of `count` addresses from `first` on calls a hook_io() handler or hits a watchpoint */
+
+static bool
+reads_hooked(const MOS_6510* const c, uint16_t first, uint16_t count)
+{
+  for(uint16_t i = 0; i < count; i++)
   {
-    c->cyc += opcodes[opcode].crossed_cycles;
+    const uint16_t addr = first + i;
+    const struct hooks* const h = c->bus->hooks[addr >> 8];
+
+    if(addr < 0x200 && c->bus->low_watch[addr] & WATCH_READ) return true;
+    if(h && (h->read_fn[addr & 0xFF] || h->watch[addr & 0xFF] & WATCH_READ)) return true;
   }
+  return false;
 }
+
+/*
+ * Whether the instruction may read through a hook or a watchpoint. Pointers
+ * in zero page stay as they are, the loop doesn't write memory, but X and Y
+ * may differ along the body, so every address an index can reach counts.
+ */
+
+static bool
+operand_hooked(const MOS_6510* const c, enum ADDR_MODE mode, uint16_t operand)
+{
+  const bool low = c->low_watches != 0; // Only watchpoints see zero page reads
+
+  switch (mode) {
+    case ZEROPAGE:
+      return low && reads_hooked(c, operand, 1);
+
+    case ZEROPAGE_X:
+    case ZEROPAGE_Y:
+      return low && reads_hooked(c, 0, 0x100);
+
+    case INDIRECT_X:
+      if(low && reads_hooked(c, 0, 0x100)) return true; // The pointers
+
+      for(uint16_t i = 0; i < 0x100; i++)
+      {
+        if(reads_hooked(c, c->low[(i + 1) & 0xFF] << 8 | c->low[i], 1)) return true;
+      }
+      return false;
+
+    case INDIRECT_Y:
+      if(low && (reads_hooked(c, operand & 0xFF, 1) || reads_hooked(c, (operand + 1) & 0xFF, 1))) return true; // The pointer
+      return reads_hooked(c, c->low[(operand + 1) & 0xFF] << 8 | c->low[operand & 0xFF], 0x100);
+
+    case ABSOLUTE:
+      return reads_hooked(c, operand, 1);
+
+    case ABSOLUTE_X:
+    case ABSOLUTE_Y:
+      return reads_hooked(c, operand, 0x100);
+
+    default:
+      return false;
+  }
+}
+
+/*
+ * Every instruction from `head` to the jump at `pc` is idle_safe, jumps
+ * nowhere else and reads nothing that a hook would see
+ */
+
+static bool
+idle_body(const MOS_6510* const c, uint16_t head, uint16_t pc)
+{
+  uint32_t addr = head;
+
+  while(addr <= pc)
+  {
+    uint8_t opcode, lo = 0, hi = 0;
+
+    if(!code_peek(c, addr, &opcode) || !idle_safe[opcode]) return false;
+
+    const enum ADDR_MODE mode = opcodes[opcode].address_mode;
+    const uint8_t length = instruction_length(mode);
+    const uint32_t next = addr + length;
+
+    if(length > 1 && !code_peek(c, addr + 1, &lo)) return false;
+    if(length > 2 && !code_peek(c, addr + 2, &hi)) return false;
+    if(operand_hooked(c, mode, hi << 8 | lo)) return false;
+
+    uint32_t target = next;
+    if(mode == RELATIVE) target = (uint16_t)(next + (int8_t) lo);
+    else if(opcode == 0x4C) target = hi << 8 | lo;
+
+    if(target < head || target > pc + length) return false;
+    if(addr == pc) return true;
+
+    addr = next;
+  }
+  return false;
+}
+
+static inline bool
+interrupt_pending(const MOS_6510* const c)
+{
+#ifdef CYCLE_CORE
+  if(c->irq_sampled) return true;
+#endif
+  return c->irq_status & NMI_LINE || (c->irq_status & IRQ_LINE && !c->idf);
+}
+
+static inline bool
+same_registers(const struct loop_state* const a, const struct loop_state* const b)
+{
+  return a->a == b->a && a->x == b->x && a->y == b->y && a->sp == b->sp
+    && a->df == b->df && a->idf == b->idf && a->cf == b->cf && a->zn == b->zn
+    && a->v_a == b->v_a && a->v_b == b->v_b && a->v_r == b->v_r;
+}
+
+/*
+ * Called after the instruction at `pc` jumped back to c->pc. A loop that
+ * gets back to its head with the same registers, and whose body only
+ * reads memory, does the same turn after turn until an event or an
+ * interrupt changes something; devices whose registers change on their
+ * own have to do so from events, see event.h. The turns that end before
+ * the next event (or the end of the budget) are skipped by adding their
+ * cycles and instructions, so the event runs where it would have.
+ *
+ * True if there is nothing to wait for and the caller should report a
+ * trap, which a jump to itself is right away, or the CPU is halted.
+ */
+
+static __attribute__((noinline)) bool
+idle_loop(MOS_6510* const c, uint16_t pc, uint64_t end)
+{
+  struct loop_state* const l = &c->loop;
+  const struct loop_state now = {
+    c->pc, c->a, c->x, c->y, c->sp, c->df, c->idf, c->cf, c->zn, c->v_a, c->v_b, c->v_r, c->cyc, c->instructions
+  };
+
+  uint8_t opcode;
+
+  if(c->halted) return true;
+  if(interrupt_pending(c)) return false;
+  if(c->pc == pc && c->events.next == UINT64_MAX
+     && (!code_peek(c, pc, &opcode) || (opcode != 0x60 && opcode != 0x40))) // An RTS or RTI landing on itself unwinds
+    return true;
+  if(pc - c->pc >= IDLE_LOOP || c->pc == c->busy_loop) return false;
+
+  if(l->head != c->pc || !same_registers(l, &now))
+  {
+    *l = now;
+    return false;
+  }
+
+  if(!idle_body(c, c->pc, pc))
+  {
+    c->busy_loop = c->pc;
+    l->head = -1;
+    return false;
+  }
+
+  if(c->events.next == UINT64_MAX) return true;
+
+  const uint64_t period = c->cyc - l->cyc;
+  const uint64_t until = c->events.next < end ? c->events.next : end;
+  const uint64_t turns = until > c->cyc ? (until - c->cyc) / period : 0;
+
+  c->cyc += turns * period;
+  c->instructions += turns * (c->instructions - l->instructions);
+
+  l->cyc = c->cyc;
+  l->instructions = c->instructions;
+  return false;
+}
+
+/*
+ * Checks made when run_cycles() is entered, STOP_BUDGET if it may go on.
+ * The watchdog's cycle limit shortens the budget, so it is as exact as
+ * the budget.
+ */
+
+static inline enum STOP_REASON
+run_start(MOS_6510* const c, uint64_t budget, uint64_t* end)
+{
+  c->loop.head = -1; // Memory may have been changed in between
+  c->busy_loop = -1;
+  c->breakpoints.hit = 0; // Only what the run's own instructions hit counts
+  c->breakpoints.armed = c->breakpoints.count;
+
+  if(c->halted) return STOP_JAM;
+  if(watchdog_fired(c)) return STOP_WATCHDOG;
+
+  *end = c->cycle_limit && c->cycle_limit - c->cyc < budget ? c->cycle_limit : c->cyc + budget;
+  return STOP_BUDGET;
+}
+
+/* Once the budget is used up, which may have been the watchdog's doing */
+
+static inline enum STOP_REASON
+run_end(const MOS_6510* const c)
+{
+  return watchdog_fired(c) ? STOP_WATCHDOG : STOP_BUDGET;
+}
+
+static inline bool
+breakpoint_at(const MOS_6510* const c, uint16_t pc)
+{
+  return c->breakpoints.bitmap[pc >> 3] & 1 << (pc & 7);
+}
+
+/* Out of line, the run loops only test the bits inline */
+
+static __attribute__((noinline)) enum STOP_REASON
+breakpoint_reached(MOS_6510* const c)
+{
+  if(c->breakpoints.hit) return STOP_WATCH;
+  return breakpoint_hit(c) ? STOP_BREAK : STOP_BUDGET;
+}
+
+/* After every instruction, STOP_BUDGET unless a breakpoint or a watchpoint stops the run */
+
+static inline __attribute__((always_inline)) enum STOP_REASON
+breakpoint_stop(MOS_6510* const c)
+{
+  if(__builtin_expect(!c->breakpoints.armed, 1)) return STOP_BUDGET;
+
+  if(__builtin_expect(c->breakpoints.hit || breakpoint_at(c, c->pc), 0)) return breakpoint_reached(c);
+  return STOP_BUDGET;
+}
+
+/*
+ * Executes instructions until at least `budget` cycles have been used
+ * (the last instruction may overshoot) or a stop condition fires.
+ * Due events run and pending lines in c->irq_status are serviced between
+ * instructions, the lines by the cycle engine after the instruction that
+ * sampled them. A JAM halts the CPU until reset(), the watchdog in
+ * c->cycle_limit and c->instruction_limit stops any run.
+ */
+
+#if !defined(THREADED_CORE) && !defined(BLOCK_CORE)
+
+enum STOP_REASON
+run_cycles(MOS_6510* const c, uint64_t budget)
+{
+  uint64_t end;
+  const enum STOP_REASON start = run_start(c, budget, &end);
+
+  if(start != STOP_BUDGET) return start;
+
+  while(c->cyc < end)
+  {
+#ifdef CYCLE_CORE
+    if(c->irq_sampled) sampled_interrupt(c);
+#else
+    if(c->cyc >= c->events.next) events_run(c);
+    if(c->irq_status) interrupt_handler(c);
+#endif
+
+    const uint16_t pc = c->pc;
+    step(c);
+
+    const enum STOP_REASON stop = breakpoint_stop(c);
+    if(stop != STOP_BUDGET) return stop;
+    if(c->pc <= pc && idle_loop(c, pc, end)) return c->halted ? STOP_JAM : STOP_TRAP;
+  }
+
+  return run_end(c);
+}
+
+#elif defined(THREADED_CORE)
+
+/*
+ * Threaded core (make CORE=threaded), needs GCC/Clang labels as values.
+ *
+ * Every opcode gets its own label with its handler inlined, and every label ends in its own indirect jump to the next
+ * opcode, so the host branch predictor sees 256 dispatch sites instead of one.
+ */
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+enum STOP_REASON
+run_cycles(MOS_6510* const c, uint64_t budget)
+{
+#define LABEL(op, mnemonic, func, cycle, mode, crossed) &&label_##op,
+  static const void* const dispatch[256] = { OPCODE_TABLE(LABEL) };
+#undef LABEL
+
+  uint64_t end;
+  const enum STOP_REASON start = run_start(c, budget, &end);
+  enum STOP_REASON stop;
+  uint16_t pc;
+
+  if(start != STOP_BUDGET) return start;
+  if(c->cyc >= end) return STOP_BUDGET;
+  if(c->cyc >= c->events.next) events_run(c);
+  if(c->irq_status) interrupt_handler(c);
+
+  pc = c->pc;
+  rewind_step(c, false);
+  goto *dispatch[fetch_byte(c)];
+
+#define HANDLER(op, mnemonic, func, cycle, mode, crossed) \
+  label_##op:                                         \
+    op_##op(c);                                       \
+    c->instructions++;                                \
+                                                      \
+    if((stop = breakpoint_stop(c)) != STOP_BUDGET)    \
+      return stop;                                    \
+    if(c->pc <= pc && idle_loop(c, pc, end))          \
+      return c->halted ? STOP_JAM : STOP_TRAP;        \
+    if(c->cyc >= end) return run_end(c);              \
+    if(c->cyc >= c->events.next) events_run(c);       \
+    if(c->irq_status) interrupt_handler(c);           \
+                                                      \
+    pc = c->pc;                                       \
+    rewind_step(c, false);                            \
+    goto *dispatch[fetch_byte(c)];
+
+  OPCODE_TABLE(HANDLER)
+#undef HANDLER
+}
+
+#pragma GCC diagnostic pop
+
+#elif defined(BLOCK_CORE)
+
+/*
+ * Block engine (make CORE=blocks).
+ *
+ * Straight-line code up to the next branch or jump is decoded once into a
+ * block of records holding the predecoded handler, operand and static cycle
+ * cost, and cached by start address. Blocks remember which pages they were
+ * decoded from; a write into such a page bumps its generation, which drops
+ * exactly the blocks decoded from it the next time they are looked up.
+ */
+
+#define PREDECODED(op, mnemonic, func, cycle, mode, crossed)   \
+  static void                                                 \
+  predecoded_##op(MOS_6510* const c, uint16_t operand)        \
+  {                                                           \
+    /* Cycles charged and PC moved on by the block loop */    \
+    COUNT_START(cycle, instruction_length(mode));             \
+    bool page = 0;                                            \
+    func(c, effective_address(c, mode, operand, &page));      \
+                                                              \
+    if(page) c->cyc += crossed;                               \
+    STATS_COUNT(op, cycle, mode, page && crossed);            \
+    PROFILE_COUNT(op);                                        \
+  }
+
+OPCODE_TABLE(PREDECODED)
+#undef PREDECODED
+
+#define PREDECODED(op, mnemonic, func, cycle, mode, crossed) predecoded_##op,
+static void (* const predecoded[256])(MOS_6510* const c, uint16_t operand) =
+{
+  OPCODE_TABLE(PREDECODED)
+};
+#undef PREDECODED
+
+void
+blocks_flush(MOS_6510* const c)
+{
+  for(int i = 0; i < BLOCK_CACHE_SIZE; i++)
+  {
+    c->blocks[i].length = 0;
+  }
+
+  for(int i = 0; i < 32; i++)
+  {
+    c->code_pages[i] = 0;
+  }
+
+  c->code_writes++;
+
+#ifdef JIT_CORE
+  jit_flush(c);
+#endif
+}
+
+void
+code_written(MOS_6510* const c, uint8_t page)
+{
+  c->code_pages[page >> 3] &= ~(1 << (page & 7));
+  c->page_generation[page]++;
+  c->code_writes++;
+}
+
+/* Jumps, calls and returns end a block just like branches do */
+
+static inline bool
+ends_block(uint8_t opcode)
+{
+  switch (opcode) {
+    case 0x00: // BRK
+    case 0x20: // JSR
+    case 0x40: // RTI
+    case 0x4C: // JMP
+    case 0x60: // RTS
+    case 0x6C: // JMP (INDIRECT)
+      return true;
+
+    case 0x02: case 0x12: case 0x22: case 0x32: case 0x42: case 0x52: // JAM
+    case 0x62: case 0x72: case 0x92: case 0xB2: case 0xD2: case 0xF2:
+      return true;
+
+    default:
+      return opcodes[opcode].address_mode == RELATIVE;
+  }
+}
+
+/* Only code in plain memory pages is decoded, NULL if there is none at `pc` */
+
+static struct block*
+block_decode(MOS_6510* const c, struct block* const b, uint16_t pc)
+{
+  const uint8_t first = pc >> 8;
+  uint8_t n = 0;
+
+  b->pc = pc;
+
+  while(n < BLOCK_LENGTH)
+  {
+    const uint8_t opcode_page = pc >> 8;
+    const uint8_t* const page = c->bus->pages[opcode_page].read;
+    if(page == NULL) break;
+
+    const uint8_t opcode = page[pc & 0xFF];
+    const enum ADDR_MODE mode = opcodes[opcode].address_mode;
+    const uint8_t length = instruction_length(mode);
+
+    /* All bytes of the instruction must be in plain memory within the block's two pages */
+
+    const uint16_t end = pc + length - 1;
+    const uint8_t* const end_page = c->bus->pages[end >> 8].read;
+    if(end_page == NULL) break;
+    if((end >> 8) != first && (end >> 8) != ((first + 1) & 0xFF)) break;
+
+    struct block_record* const r = &b->records[n++];
+
+    r->func = predecoded[opcode];
+    r->opcode = opcode;
+    r->cycles = opcodes[opcode].cycle;
+    r->next = pc + length;
+
+    if(mode == IMMEDIATE) r->operand = pc + 1;
+    else if(length == 2) r->operand = c->bus->pages[(uint16_t)(pc + 1) >> 8].read[(pc + 1) & 0xFF];
+    else if(length == 3) r->operand = end_page[end & 0xFF] << 8 | c->bus->pages[(uint16_t)(pc + 1) >> 8].read[(pc + 1) & 0xFF];
+    else r->operand = 0;
+
+    b->last_pc = pc;
+    b->pages[1] = end >> 8;
+    pc = r->next;
+
+    if(ends_block(opcode) || breakpoint_at(c, pc)) break;
+  }
+
+  if(n == 0) return NULL;
+
+  b->length = n;
+  b->pages[0] = first;
+
+#ifdef JIT_CORE
+  b->native = NULL;
+  b->hits = 0;
+  b->max_cycles = 0;
+
+  for(uint8_t i = 0; i < n; i++)
+  {
+    const struct instruction* const op = &opcodes[b->records[i].opcode];
+
+    /* A taken branch pays one cycle on top of its page crossing penalty */
+    b->max_cycles += op->cycle + op->crossed_cycles + (op->address_mode == RELATIVE);
+  }
+#endif
+
+  for(int i = 0; i < 2; i++)
+  {
+    const uint8_t page = b->pages[i];
+
+    c->code_pages[page >> 3] |= 1 << (page & 7);
+    b->generation[i] = c->page_generation[page];
+  }
+
+  return b;
+}
+
+static inline struct block*
+block_lookup(MOS_6510* const c, uint16_t pc)
+{
+  struct block* const b = &c->blocks[pc & (BLOCK_CACHE_SIZE - 1)];
+
+  if(b->length && b->pc == pc
+      && b->generation[0] == c->page_generation[b->pages[0]]
+      && b->generation[1] == c->page_generation[b->pages[1]])
+  {
+    return b;
+  }
+
+  return block_decode(c, b, pc);
+}
+
+enum STOP_REASON
+run_cycles(MOS_6510* const c, uint64_t budget)
+{
+  uint64_t end;
+  const enum STOP_REASON start = run_start(c, budget, &end);
+
+  if(start != STOP_BUDGET) return start;
+
+  while(c->cyc < end)
+  {
+    if(c->cyc >= c->events.next) events_run(c);
+    if(c->irq_status) interrupt_handler(c);
+
+    struct block* const b = block_lookup(c, c->pc);
+
+    if(b == NULL)
+    {
+      const uint16_t pc = c->pc;
+      step(c);
+
+      const enum STOP_REASON stop = breakpoint_stop(c);
+      if(stop != STOP_BUDGET) return stop;
+      if(c->pc <= pc && idle_loop(c, pc, end)) return c->halted ? STOP_JAM : STOP_TRAP;
+      continue;
+    }
+
+#ifdef JIT_CORE
+    /* Running out of code space flushed the cache, `b` included */
+
+    if(b->native == NULL && ++b->hits == JIT_THRESHOLD && !jit_translate(c, b) && b->length == 0) continue;
+
+    /* Native code can't stop in between, a block the end of the run or an event falls into is left to the records below */
+
+    if(b->native && c->events.next - c->cyc >= b->max_cycles && end - c->cyc >= b->max_cycles)
+    {
+      const uint32_t written = b->native(c);
+
+      if(written == JIT_STEP) step(c); // Left in front of decimal mode ADC/SBC or a JSR wrapping SP
+      else if(written) code_written(c, written & 0xFF); // Left right after a store into cached code
+      else if(b->native_length != b->length) continue; // Left in front of code it couldn't translate, no breakpoint there
+
+      const enum STOP_REASON stop = breakpoint_stop(c);
+      if(stop != STOP_BUDGET) return stop;
+      if(!written && c->pc <= b->last_pc && idle_loop(c, b->last_pc, end)) return c->halted ? STOP_JAM : STOP_TRAP;
+      continue;
+    }
+#endif
+
+    /*
+     * Leave early when the budget is used up, an event is due, an interrupt
+     * line is raised or cached code was written to, so all of them are seen
+     * between the same instructions as in the other cores.
+     */
+
+    const uint32_t code_writes = c->code_writes;
+    const struct block_record* r = b->records;
+    const struct block_record* const last = r + b->length - 1;
+
+    while(true)
+    {
+      rewind_step(c, false);
+      TRACE_START(r->opcode, 0, 0);
+      c->pc = r->next;
+      c->cyc += r->cycles;
+      r->func(c, r->operand);
+      c->instructions++;
+
+      const enum STOP_REASON stop = breakpoint_stop(c);
+      if(stop != STOP_BUDGET) return stop;
+
+      if(r == last)
+      {
+        if(c->pc <= b->last_pc && idle_loop(c, b->last_pc, end)) return c->halted ? STOP_JAM : STOP_TRAP;
+        break;
+      }
+
+      if(c->cyc >= end || c->cyc >= c->events.next || c->irq_status || c->code_writes != code_writes) break;
+      r++;
+    }
+  }
+
+  return run_end(c);
+}
+
+#endif // CORE
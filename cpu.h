@@ -4,11 +4,20 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "event.h"
+#include "breakpoint.h"
+
 #define NMI_VECTOR 0xFFFA
 #define RESET_VECTOR 0xFFFC
 #define INTERRUPT_VECTOR 0xFFFE
 #define UNSTABLE_CONST 0xEE // Common values beeing 0x00, 0xEE, 0xFF 
 
+#define IRQ_LINE 0x1 // Bits of c->irq_status
+#define NMI_LINE 0x2
+
+#define PAL_FRAME_CYCLES 19656 // 312 raster lines * 63 cycles
+#define PAL_CLOCK 985248 // Hz, C64 PAL system clock
+
 enum ADDR_MODE {
   IMPLIED,
   ACCUMULATOR,
@@ -25,6 +34,102 @@ enum ADDR_MODE {
   INDIRECT_Y,
 };
 
+/* Opcode plus operand bytes */
+
+static inline uint8_t
+instruction_length(enum ADDR_MODE mode)
+{
+  switch (mode) {
+    case IMPLIED:
+    case ACCUMULATOR:
+      return 1;
+
+    case ABSOLUTE:
+    case ABSOLUTE_X:
+    case ABSOLUTE_Y:
+    case INDIRECT:
+      return 3;
+
+    default:
+      return 2;
+  }
+}
+
+/* Why run_cycles() returned */
+enum STOP_REASON {
+  STOP_BUDGET, // Cycle budget used up
+  STOP_TRAP, // Instruction jumped or branched to itself, or an idle loop with no event to wait for
+  STOP_BREAK, // PC reached a breakpoint, see breakpoint.h
+  STOP_WATCH, // The last instruction hit a watchpoint, c->breakpoints tells which
+  STOP_JAM, // A JAM opcode halted the CPU, only reset() or initialise() get it going again
+  STOP_WATCHDOG, // c->cycle_limit or c->instruction_limit reached
+};
+
+struct MOS_6510;
+struct bus;
+
+#ifdef BLOCK_CORE
+
+#define BLOCK_CACHE_SIZE 1024 // Cached blocks, power of two
+#define BLOCK_LENGTH 16 // Instructions per block at most
+
+/* Predecoded instruction, see the block engine in cpu.c */
+
+struct block_record
+{
+  void (*func)(struct MOS_6510* const c, uint16_t operand);
+  uint16_t operand; // Operand bytes, for IMMEDIATE the address of the byte
+  uint16_t next; // PC of the following instruction
+  uint8_t cycles; // Static cycle cost, without page crossing penalties
+  uint8_t opcode;
+};
+
+struct block
+{
+  uint16_t pc; // Start address
+  uint16_t last_pc; // Address of the last instruction
+  uint8_t length; // Records in use, 0 if the entry is empty
+  uint8_t pages[2]; // First and last page the block's bytes are on
+  uint16_t generation[2]; // Generation of those pages when it was decoded
+
+  struct block_record records[BLOCK_LENGTH];
+
+#ifdef JIT_CORE
+  uint32_t (*native)(struct MOS_6510* const c); // Translated code, see jit.c
+  uint8_t native_length; // Records covered by it
+  uint8_t max_cycles; // Cycles of the whole block with every penalty paid
+  uint16_t hits; // Entries counted until it gets translated
+#endif
+};
+
+#endif // BLOCK_CORE
+
+/* Registers at the head of the last loop closed by a backward jump, see idle_loop() in cpu.c */
+
+struct loop_state
+{
+  int32_t head; // -1 if none
+  uint8_t a, x, y, sp;
+  bool df, idf, cf;
+  uint16_t zn;
+  uint8_t v_a, v_b, v_r;
+  uint64_t cyc; // When the head was reached
+  uint64_t instructions;
+};
+
+#ifdef OPCODE_STATS
+
+/* Per opcode counters (make STATS=1), see opcode_stats_dump() in debug.c */
+
+struct opcode_stats
+{
+  uint64_t executed;
+  uint64_t cycles; // Including page crossing and taken branch penalties
+  uint64_t crossed; // Times the page crossing penalty was paid
+};
+
+#endif // OPCODE_STATS
+
 typedef struct MOS_6510 
 {
   uint8_t a, 
@@ -34,16 +139,70 @@ typedef struct MOS_6510
   uint8_t sp; 
   uint16_t pc; 
 
-  bool nf, vf, bf, df, idf, zf, cf;
+  uint16_t zn; // Lazy N and Z: N is bit 15, Z is set when the low byte is 0
+  bool cf;
+  bool bf, df, idf; // Together with V, the tracer copies the rarely written flags at once
+  uint8_t v_a, v_b, v_r; // Lazy V: operands and result of the last ADC/SBC
   uint64_t cyc;
-  bool page_crossed;
+  uint64_t instructions; // Retired since initialise(), interrupts not counted
+#ifdef TRACER
+  struct trace_record* trace_cursor; // Next record of the trace, NULL unless tracing, see trace.h
+  struct trace_record* trace_end; // End of the current batch of records
+#endif
 
-  uint8_t ram[65536]; // 64KB
+  struct bus* bus; // Address space, see bus.h
 
-  uint16_t addr_ptr; // For normal addressing modes
-  int8_t addr_rel; // For relative mode (Branching)
+  uint8_t* low; // Zero page and stack, $0000-$01FF
+  uint16_t low_watches; // Watchpoints in there, see bus_watch(). Always 0 without LOW_WATCHPOINTS
+  const uint8_t* code; // Host memory of the page PC is in
+  int16_t code_page; // Page c->code belongs to, -1 if none
 
   uint8_t irq_status;
+  struct events events; // Cleared by initialise(), see event.h
+#ifdef CYCLE_CORE
+  uint8_t irq_sampled; // Lines of c->irq_status the last cycle started with, IRQ only while I was clear
+#endif
+
+  uint8_t written_pages[32]; // One bit per page above the stack written since the last snapshot, see snapshot.h
+
+  bool halted; // Set by JAM, PC stays on it
+
+  /* Watchdog, 0 for no limit. Set by the caller, initialise() leaves them alone */
+  uint64_t cycle_limit; // Exact, run_cycles() stops at the instruction that reaches it
+  uint64_t instruction_limit; // Checked whenever run_cycles() is entered or used up its budget
+
+  struct loop_state loop; // Forgotten whenever memory may have changed under it
+  int32_t busy_loop; // Head of a loop found not to be idle, -1 if none
+
+  struct breakpoints breakpoints; // Set by the caller, initialise() leaves them alone
+
+#ifdef BLOCK_CORE
+  struct block blocks[BLOCK_CACHE_SIZE]; // Indexed by start address
+  uint8_t code_pages[32]; // One bit per page that cached blocks were decoded from
+  uint16_t page_generation[256]; // Bumped when a page with cached code is written
+  uint32_t code_writes; // Bumped on every such write
+#endif
+
+#ifdef JIT_CORE
+  uint8_t* jit_code; // Native code buffer
+  uint32_t jit_used;
+#endif
+
+#ifdef OPCODE_STATS
+  struct opcode_stats opcode_stats[256]; // Cleared by initialise()
+#endif
+
+#ifdef PROFILER
+  struct profile* profile; // NULL unless profile_start() was called, see profile.h
+#endif
+
+#ifdef TRACER
+  struct trace* trace; // NULL unless trace_start() was called, see trace.h
+#endif
+
+#ifdef REWIND
+  struct rewind* rewind; // NULL unless rewind_start() was called, see rewind.h
+#endif
 
 } MOS_6510;
 
@@ -55,12 +214,30 @@ struct instruction
   uint8_t crossed_cycles;
 };
 
+/* True once the watchdog's cycle or instruction limit is reached */
+
+static inline bool
+watchdog_fired(const MOS_6510* const c)
+{
+  return (c->cycle_limit && c->cyc >= c->cycle_limit) || (c->instruction_limit && c->instructions >= c->instruction_limit);
+}
+
 void initialise(MOS_6510* const c);
+void reset(MOS_6510* const c);
+void cpu_free(MOS_6510* const c);
+extern const struct instruction opcodes[256];
+
 void mnemonics(MOS_6510* const c);
+enum STOP_REASON run_cycles(MOS_6510* const c, uint64_t budget);
 
 uint8_t get_flags(MOS_6510* const c);
 void set_flags(MOS_6510* const c, uint8_t value); 
 
 void interrupt_handler(MOS_6510* const c);
 
+#ifdef BLOCK_CORE
+void blocks_flush(MOS_6510* const c);
+void code_written(MOS_6510* const c, uint8_t page);
+#endif
+
 #endif // _6510_CPU
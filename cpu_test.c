@@ -1,188 +1,1163 @@
 #include <time.h>
+#include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <inttypes.h>
 
 #include "cpu.h"
 #include "bus.h"
 #include "debug.h"
+#include "profile.h"
+#include "trace.h"
+#include "compare.h"
+#include "loader.h"
+#include "snapshot.h"
+#include "rewind.h"
 
-int 
-load_file(MOS_6510* const c, const char* file_to_load, uint16_t addr)
+static double
+now(void)
 {
-  FILE *f = fopen(file_to_load, "rb");
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
 
-  if(f == NULL) 
-  {
-    fprintf(stderr, "**" RED " Error " RESET "** " "file couldn't be opened"); 
-    fclose(f); 
-    return 1;
+/* Maps a program on the CPU's bus, see loader.h. It has to outlive the mapping, free it after bus_free() */
+
+static bool
+load_file(MOS_6510* const c, struct program* const program, FILE* out, const char* file_to_load, uint16_t addr)
+{
+  if(program_load(c, program, file_to_load, addr)) return true;
+
+  fprintf(out, "\n**" RED " Error " RESET "** " "file \"%s\": %s\n", file_to_load, program->error);
+  return false;
+}
+
+/* Runs frame-sized batches until something other than the budget stops the CPU */
+
+static enum STOP_REASON
+run_until(MOS_6510* const c, int32_t stop_pc)
+{
+  enum STOP_REASON reason;
+
+  if(stop_pc >= 0) breakpoint_set(c, stop_pc, NULL);
+  while((reason = run_cycles(c, PAL_FRAME_CYCLES)) == STOP_BUDGET);
+  if(stop_pc >= 0) breakpoint_clear(c, stop_pc);
+
+  return reason;
+}
+
+/* How the report of a program that didn't run to where it should puts it */
+
+static const char*
+stopped(enum STOP_REASON reason)
+{
+  switch (reason) {
+    case STOP_JAM: return "halted by a JAM";
+    case STOP_WATCHDOG: return "stopped by the watchdog";
+    case STOP_BREAK: return "stopped at a breakpoint";
+    case STOP_WATCH: return "stopped by a watchpoint";
+    default: return "trapped";
   }
+}
+
+static int 
+execute_allsuiteasm(MOS_6510* const c, struct program* const program, FILE* out, const char* file_to_load)
+{
+  if(!load_file(c, program, out, file_to_load, 0x4000)) return 1;
+  initialise(c);
+
+  fprintf(out, "\n** file loaded: " BOLD "%s" RESET " **\n", file_to_load);
 
-  fseek(f, 0, SEEK_END);
-  size_t file_size = ftell(f);
-  rewind(f);
+  const enum STOP_REASON reason = run_until(c, 0x45C0);
+  const bool passed = reason == STOP_BREAK && c->pc == 0x45C0 && rb(c, 0x0210) == 0xFF;
+  if (passed) {
+    fprintf(out, GREEN "✓" RESET " - test passed!\n");
+  }
+  else {
+    fprintf(out, RED "✘" RESET " - test failed! (%s at " BOLD "0x%04X" RESET ")\n", stopped(reason), c->pc);
+  }
 
-  if(file_size + addr > 0x10000) 
+  return passed ? 0 : 1;
+}
+static int
+execute_6502_decimal_test(MOS_6510* const c, struct program* const program, FILE* out, const char* file_to_load)
+{
+  if(!load_file(c, program, out, file_to_load, 0x200)) return 1;
+  initialise(c);
+
+  fprintf(out, "\n** file loaded: " BOLD "%s" RESET " **\n", file_to_load);
+
+  c->pc = 0x200;
+
+  const enum STOP_REASON reason = run_until(c, 0x024B);
+  const bool passed = reason == STOP_BREAK && c->pc == 0x024B && c->a == 0;
+  if(passed)
   {
-    fprintf(stderr, "\n**" RED "Error" RESET "** " "file size to large\n"); 
-    fclose(f); 
-    return 1;
+    fprintf(out, GREEN "✓" RESET " - test passed!\n");
+  }
+  else
+  {
+    fprintf(out, RED "✘" RESET " - test failed! (%s at " BOLD "0x%04X" RESET ")\n", stopped(reason), c->pc);
   }
 
-  size_t file_read = fread(&c->ram[addr], sizeof(uint8_t), file_size, f);
+  return passed ? 0 : 1;
+}
+
+/* Feedback register of the interrupt test, its bits are the IRQ and NMI lines */
 
-  if(file_read != file_size) 
+static uint8_t
+feedback_read(MOS_6510* const c, uint16_t addr)
+{
+  (void) addr;
+  return c->irq_status;
+}
+
+static void
+feedback_write(MOS_6510* const c, uint16_t addr, uint8_t value)
+{
+  (void) addr;
+  c->irq_status = value & (IRQ_LINE | NMI_LINE);
+}
+
+static int
+execute_6502_interrupt_test(MOS_6510* const c, struct program* const program, FILE* out, const char* file_to_load)
+{
+  if(!load_file(c, program, out, file_to_load, 0xA)) return 1;
+  initialise(c);
+  hook_io(c, 0xBFFC, feedback_read, feedback_write);
+
+  fprintf(out, "\n** file loaded: " BOLD "%s" RESET " **\n", file_to_load);
+  
+  c->pc = 0x400;
+
+  const enum STOP_REASON reason = run_until(c, -1);
+  const bool passed = reason == STOP_TRAP && c->pc == 0x06F5;
+  if(passed)
   {
-    fprintf(stderr, "**" RED " Error " RESET "** " "file \"%s\" couldn't be read into memory" , file_to_load); 
-    fclose(f); 
-    return 1;
+    fprintf(out, GREEN "✓" RESET " - test passed!\n");
+  }
+  else
+  {
+    fprintf(out, RED "✘" RESET " - test failed! (%s at " BOLD "0x%04X" RESET ")\n", stopped(reason), c->pc);
   }
 
-  fclose(f);
-  return 0;
+  return passed ? 0 : 1;
 }
 
+static int
+execute_6502_functional_test(MOS_6510* const c, struct program* const program, FILE* out, const char* file_to_load)
+{
+  if(!load_file(c, program, out, file_to_load, 0)) return 1;
+  initialise(c);
+
+  fprintf(out, "\n** file loaded: " BOLD "%s" RESET " **\n", file_to_load);
+
+  c->pc = 0x400;
+
+  const enum STOP_REASON reason = run_until(c, -1);
+  const bool passed = reason == STOP_TRAP && c->pc == 0x3469;
+  if(passed)
+  {
+    fprintf(out, GREEN "✓" RESET " - test passed!\n");
+  }
+  else
+  {
+    fprintf(out, RED "✘" RESET " - test failed! (%s at " BOLD "0x%04X" RESET ")\n", stopped(reason), c->pc);
+  }
+
+  return passed ? 0 : 1;
+}
 
 static int 
-execute_allsuiteasm(MOS_6510* const c, const char* file_to_load)
+execute_timingtest(MOS_6510* const c, struct program* const program, FILE* out, const char* file_to_load)
 {
-  memset(c->ram, 0, 0x10000);
-  load_file(c, file_to_load, 0x4000);
+  if(!load_file(c, program, out, file_to_load, 0x1000)) return 1;
   initialise(c);
 
-  printf("\n** file loaded: " BOLD "%s" RESET " **\n", file_to_load);
+  fprintf(out, "\n** file loaded: " BOLD "%s" RESET " **\n", file_to_load);
+
+  c->pc = 0x1000;
 
-  while(1)
+  const enum STOP_REASON reason = run_until(c, 0x1269);
+  const bool passed = reason == STOP_BREAK && c->pc == 0x1269 && c->cyc == 1141;
+  if(passed)
   {
-    mnemonics(c);
-    if (c->pc == 0x45C0) {
-      if (rb(c, 0x0210) == 0xFF) {
-        printf(GREEN "✓" RESET " - test passed!\n");
-      }
-      else {
-        printf(RED "✘" RESET " - test failed!\n");
-      }
-      break;
-    }
+    fprintf(out, GREEN "✓" RESET " - test passed!\n");
+  }
+  else
+  {
+    fprintf(out, RED "✘" RESET " - test failed! (%s at " BOLD "0x%04X" RESET ")\n", stopped(reason), c->pc);
+  }
+
+  return passed ? 0 : 1;
+}
+
+/*
+ * Checks of the APIs around the CPU, run like the suites on one of their
+ * images. Each drives the image through the API it checks, compares what
+ * it gets with states recorded along the way and then lets the image run
+ * to its end.
+ */
+
+#define CHECK_BUDGET 1000000 // Cycles between the points a check compares
+
+/* What the checks compare: registers, P packed, and the cycle count */
+
+struct state
+{
+  uint16_t pc;
+  uint8_t a, x, y, sp, p;
+  uint64_t cyc;
+};
+
+static struct state
+state_of(MOS_6510* const c)
+{
+  return (struct state){ c->pc, c->a, c->x, c->y, c->sp, get_flags(c), c->cyc };
+}
+
+static bool
+same_state(const struct state* const a, const struct state* const b)
+{
+  return a->pc == b->pc && a->a == b->a && a->x == b->x && a->y == b->y && a->sp == b->sp
+    && a->p == b->p && a->cyc == b->cyc;
+}
+
+/* All 64 KB as bus_peek() sees them, what only a page handler knows reads as 0 */
+
+static void
+memory_of(const MOS_6510* const c, uint8_t* memory)
+{
+  for(uint32_t addr = 0; addr < 0x10000; addr++)
+  {
+    const int byte = bus_peek(c, addr);
+    memory[addr] = byte < 0 ? 0 : byte;
   }
+}
+
+static bool
+same_as(MOS_6510* const c, const struct state* const state, const uint8_t* memory, uint8_t* scratch)
+{
+  const struct state current = state_of(c);
 
-  return 0;
+  memory_of(c, scratch);
+  return same_state(&current, state) && memcmp(memory, scratch, 0x10000) == 0;
 }
+
+/* Report of a check, NULL if nothing went wrong */
+
 static int
-execute_6502_decimal_test(MOS_6510* const c, const char* file_to_load)
+checked(MOS_6510* const c, FILE* out, const char* failure)
 {
-  memset(c->ram, 0, 0x10000);
-  if(load_file(c, file_to_load, 0x200) != 0) return 1;
+  if(failure == NULL)
+  {
+    fprintf(out, GREEN "✓" RESET " - check passed!\n");
+    return 0;
+  }
+
+  fprintf(out, RED "✘" RESET " - check failed! (%s at " BOLD "0x%04X" RESET ")\n", failure, c->pc);
+  return 1;
+}
+
+#define SNAPSHOT_ROUNDS 1000
+
+/*
+ * Functional test: a restore brings back the registers and all of memory
+ * as saved, and running on from there does what it did the first time.
+ * Saving and restoring one frame apart is timed as well.
+ */
+
+static int
+check_snapshots(MOS_6510* const c, struct program* const program, FILE* out, const char* file_to_load)
+{
+  if(!load_file(c, program, out, file_to_load, 0)) return 1;
   initialise(c);
 
-  printf("\n** file loaded: " BOLD "%s" RESET " **\n", file_to_load);
+  fprintf(out, "\n** checking snapshots on: " BOLD "%s" RESET " **\n", file_to_load);
 
-  c->pc = 0x200;
+  c->pc = 0x400;
 
-  while(true)
+  struct snapshot saved = { 0 }, frame = { 0 };
+  uint8_t* const memory = malloc(3 * 0x10000); // When saved, a run later, scratch
+  const char* failure = NULL;
+  double saving = 0, restoring = 0;
+
+  if(memory == NULL) return checked(c, out, "out of memory");
+
+  run_cycles(c, CHECK_BUDGET);
+  if(!snapshot_save(c, &saved)) failure = "no memory for the snapshot";
+
+  const struct state at_save = state_of(c);
+  memory_of(c, memory);
+
+  run_cycles(c, CHECK_BUDGET);
+  const struct state later = state_of(c);
+  memory_of(c, memory + 0x10000);
+
+  snapshot_restore(c, &saved);
+  if(!failure && !same_as(c, &at_save, memory, memory + 0x20000)) failure = "a restore didn't bring back what was saved";
+
+  run_cycles(c, CHECK_BUDGET);
+  if(!failure && !same_as(c, &later, memory + 0x10000, memory + 0x20000)) failure = "running on from a restore went elsewhere";
+
+  for(uint32_t i = 0; i < SNAPSHOT_ROUNDS && !failure; i++)
   {
-    mnemonics(c);
-    if(c->pc == 0x024B)
+    snapshot_restore(c, &saved);
+    run_cycles(c, PAL_FRAME_CYCLES);
+
+    double start = now();
+    if(!snapshot_save(c, &frame)) failure = "no memory for the snapshot";
+    saving += now() - start;
+
+    start = now();
+    snapshot_restore(c, &saved);
+    restoring += now() - start;
+  }
+
+  if(!failure && !same_as(c, &at_save, memory, memory + 0x20000)) failure = "restoring over and over went elsewhere";
+  if(!failure && run_until(c, -1) != STOP_TRAP) failure = "didn't get to the end after the restores";
+  if(!failure && c->pc != 0x3469) failure = "trapped after the restores";
+
+  fprintf(out, "  one frame apart: save %.2f µs, restore %.2f µs\n",
+      saving / SNAPSHOT_ROUNDS * 1e6, restoring / SNAPSHOT_ROUNDS * 1e6);
+
+  snapshot_free(&saved);
+  snapshot_free(&frame);
+  free(memory);
+  return checked(c, out, failure);
+}
+
+#define EVENT_PERIOD 1000
+#define EVENT_LATE 7 // An event runs at the end of the instruction it fell into, which takes 7 cycles at most
+
+/* What the events of check_events() saw */
+
+struct event_log
+{
+  uint64_t first; // Cycle of the periodic event's first run
+  uint64_t periodic; // Runs of the periodic event
+  bool untimely; // An event ran in front of its cycle or too long after it
+  uint8_t order[4]; // One-shot events in the order they ran
+  uint8_t ran;
+};
+
+struct one_shot
+{
+  struct event_log* log;
+  uint8_t id;
+};
+
+static void
+timely(MOS_6510* const c, struct event_log* const log, uint64_t cycle)
+{
+  if(c->cyc < cycle || c->cyc - cycle >= EVENT_LATE) log->untimely = true;
+}
+
+static void
+periodic_event(MOS_6510* const c, void* data, uint64_t cycle)
+{
+  struct event_log* const log = data;
+
+  timely(c, log, cycle);
+  log->periodic++;
+  event_schedule(c, cycle + EVENT_PERIOD, periodic_event, data);
+}
+
+static void
+one_shot_event(MOS_6510* const c, void* data, uint64_t cycle)
+{
+  struct one_shot* const shot = data;
+
+  timely(c, shot->log, cycle);
+  if(shot->log->ran < sizeof(shot->log->order)) shot->log->order[shot->log->ran++] = shot->id;
+}
+
+/*
+ * Functional test with a periodic event and a few one-shot ones: every
+ * event runs within the instruction its cycle falls into, events of the
+ * same cycle in the order they were scheduled, a cancelled one not at
+ * all, and none of it changes how the test runs. Afterwards IRQs raised
+ * by events have to get a CLI / JMP * loop into its handler.
+ */
+
+static int
+check_events(MOS_6510* const c, struct program* const program, FILE* out, const char* file_to_load)
+{
+  if(!load_file(c, program, out, file_to_load, 0)) return 1;
+  initialise(c);
+
+  fprintf(out, "\n** checking events on: " BOLD "%s" RESET " **\n", file_to_load);
+
+  c->pc = 0x400;
+
+  struct event_log log = { .first = c->cyc + EVENT_PERIOD };
+  struct one_shot shots[4] = { { &log, 1 }, { &log, 2 }, { &log, 3 }, { &log, 4 } };
+  const char* failure = NULL;
+
+  event_schedule(c, log.first, periodic_event, &log);
+  event_schedule(c, c->cyc + 5000, one_shot_event, &shots[0]);
+  event_schedule(c, c->cyc + 5000, one_shot_event, &shots[1]);
+  event_schedule(c, c->cyc + 4000, one_shot_event, &shots[2]);
+  event_schedule(c, c->cyc + 6000, one_shot_event, &shots[3]);
+
+  if(event_cancel(c, one_shot_event, &shots[3]) != 1) failure = "cancelling didn't remove the event";
+
+  /* With the periodic event pending the final JMP * is skipped up to it, not reported */
+  if(!failure && (run_until(c, 0x3469) != STOP_BREAK || c->pc != 0x3469)) failure = "didn't get to the end with events";
+
+  const uint64_t next = log.first + log.periodic * EVENT_PERIOD; // Cycle of the periodic event still pending
+
+  if(!failure && log.untimely) failure = "an event didn't run at its cycle";
+  if(!failure && (next + EVENT_LATE <= c->cyc || next - EVENT_PERIOD > c->cyc)) failure = "the periodic event missed runs";
+  if(!failure && (log.ran != 3 || log.order[0] != 3 || log.order[1] != 1 || log.order[2] != 2)) failure = "one-shot events ran out of order";
+  if(failure) return checked(c, out, failure);
+
+  /* $0300: CLI, JMP $0301; IRQ handler at $0310: INX, RTI */
+  const uint8_t code[] = { 0x58, 0x4C, 0x01, 0x03 };
+  const uint8_t handler[] = { 0xE8, 0x40 };
+
+  for(uint8_t i = 0; i < sizeof(code); i++) wb(c, 0x0300 + i, code[i]);
+  for(uint8_t i = 0; i < sizeof(handler); i++) wb(c, 0x0310 + i, handler[i]);
+  wb(c, 0xFFFE, 0x10);
+  wb(c, 0xFFFF, 0x03);
+
+  event_cancel(c, periodic_event, &log);
+  c->pc = 0x0300;
+  c->x = 0;
+
+  event_raise(c, c->cyc + 100, IRQ_LINE);
+  event_raise(c, c->cyc + 200, IRQ_LINE);
+
+  if(run_until(c, -1) != STOP_TRAP || c->pc != 0x0301) failure = "the CLI / JMP * loop didn't trap";
+  else if(c->x != 2 || c->irq_status) failure = "raised IRQs weren't taken once each";
+
+  return checked(c, out, failure);
+}
+
+/*
+ * AllSuiteA with a write watchpoint on $0210, which every test stores its
+ * progress to: each stop has to come right after a STA $0210, or the
+ * INC $0210 that makes it $FF, and the suite still has to pass. Hooking
+ * zero page has to be refused, and without LOW_WATCHPOINTS watching a
+ * range that starts in the stack too.
+ */
+
+static int
+check_watchpoints(MOS_6510* const c, struct program* const program, FILE* out, const char* file_to_load)
+{
+  if(!load_file(c, program, out, file_to_load, 0x4000)) return 1;
+  initialise(c);
+
+  fprintf(out, "\n** checking watchpoints on: " BOLD "%s" RESET " **\n", file_to_load);
+
+  enum STOP_REASON reason;
+  uint32_t stores = 0;
+  const char* failure = NULL;
+
+  watch_set(c, 0x0210, 0x0210, WATCH_WRITE);
+  breakpoint_set(c, 0x45C0, NULL);
+
+  while((reason = run_cycles(c, PAL_FRAME_CYCLES)) == STOP_BUDGET || reason == STOP_WATCH)
+  {
+    if(reason == STOP_BUDGET) continue;
+
+    stores++;
+    if(c->breakpoints.hit != WATCH_WRITE || c->breakpoints.hit_addr != 0x0210) failure = "the watchpoint reported another access";
+    else if((bus_peek(c, c->pc - 3) != 0x8D && bus_peek(c, c->pc - 3) != 0xEE) || bus_peek(c, c->pc - 2) != 0x10 || bus_peek(c, c->pc - 1) != 0x02)
+      failure = "stopped other than after a store to $0210";
+    if(failure) break;
+  }
+
+  if(!failure && (reason != STOP_BREAK || c->pc != 0x45C0 || rb(c, 0x0210) != 0xFF)) failure = "the suite didn't pass with the watchpoint";
+  if(!failure && stores == 0) failure = "the watchpoint never stopped";
+  if(!failure && hook_io(c, 0x0010, feedback_read, NULL)) failure = "zero page was hooked";
+#ifndef LOW_WATCHPOINTS
+  if(!failure && watch_set(c, 0x01F0, 0x0210, WATCH_WRITE)) failure = "the stack was watched without LOW_WATCHPOINTS";
+#endif
+
+  watch_set(c, 0x0210, 0x0210, 0);
+  breakpoint_clear(c, 0x45C0);
+
+  if(!failure) fprintf(out, "  %" PRIu32 " stores to $0210\n", stores);
+  return checked(c, out, failure);
+}
+
+#ifdef LOW_WATCHPOINTS
+
+#ifdef CYCLE_CORE
+#define JSR_STACK (WATCH_READ | WATCH_WRITE) // Reads the top of the stack before it pushes, as the 6510 does
+#else
+#define JSR_STACK WATCH_WRITE
+#endif
+
+/*
+ * Zero page and stack watchpoints on a loop planted into AllSuiteA's
+ * memory, run hot first so CORE=jit has translated it. Every turn, STX
+ * and LDA zp,X on $10, then PHA, PLA, JSR and RTS on $01FF have to stop
+ * right after they touch them, and with the watchpoints gone nothing may
+ * stop.
+ */
+
+static int
+check_low_watchpoints(MOS_6510* const c, struct program* const program, FILE* out, const char* file_to_load)
+{
+  if(!load_file(c, program, out, file_to_load, 0x4000)) return 1;
+  initialise(c);
+
+  fprintf(out, "\n** checking zero page and stack watchpoints on: " BOLD "%s" RESET " **\n", file_to_load);
+
+  /* $0300: LDX #1, STX $10, LDA $0F,X, PHA, PLA, JSR $030E, JMP $0300; $030E: RTS */
+  const uint8_t code[] = { 0xA2, 0x01, 0x86, 0x10, 0xB5, 0x0F, 0x48, 0x68, 0x20, 0x0E, 0x03, 0x4C, 0x00, 0x03, 0x60 };
+  const struct { uint16_t pc; uint8_t access; uint16_t addr; } stops[] = {
+    { 0x0304, WATCH_WRITE, 0x0010 }, { 0x0306, WATCH_READ, 0x0010 },
+    { 0x0307, WATCH_WRITE, 0x01FF }, { 0x0308, WATCH_READ, 0x01FF },
+    { 0x030E, JSR_STACK, 0x01FF }, { 0x030B, WATCH_READ, 0x01FF },
+  };
+  const char* failure = NULL;
+
+  for(uint8_t i = 0; i < sizeof(code); i++) wb(c, 0x0300 + i, code[i]);
+
+  c->pc = 0x0300;
+  c->sp = 0xFF;
+
+  if(run_cycles(c, PAL_FRAME_CYCLES) != STOP_BUDGET) failure = "the loop stopped without watchpoints";
+
+  c->pc = 0x0300;
+
+  if(!failure && (!watch_set(c, 0x0010, 0x0010, WATCH_READ | WATCH_WRITE) || !watch_set(c, 0x01FF, 0x01FF, WATCH_READ | WATCH_WRITE)))
+    failure = "the watchpoints weren't taken";
+
+  for(uint8_t turn = 0; turn < 64 && !failure; turn++) // Enough block entries for CORE=jit to translate again
+  {
+    for(uint8_t i = 0; i < sizeof(stops) / sizeof(stops[0]) && !failure; i++)
     {
-      printf("%s", c->a == 0 ? GREEN "✓" RESET " - test passed!\n" : RED "✘" RESET " - test failed!\n");
-      break;
+      if(run_cycles(c, PAL_FRAME_CYCLES) != STOP_WATCH || c->pc != stops[i].pc
+          || c->breakpoints.hit != stops[i].access || c->breakpoints.hit_addr != stops[i].addr)
+        failure = "a zero page or stack access didn't stop where it should";
     }
   }
-  return 0;
+
+  watch_set(c, 0x0010, 0x0010, 0);
+  watch_set(c, 0x01FF, 0x01FF, 0);
+
+  if(!failure && run_cycles(c, PAL_FRAME_CYCLES) != STOP_BUDGET) failure = "stopped after the watchpoints were removed";
+  if(!failure && c->low_watches != 0) failure = "the watchpoints weren't all removed";
+
+  return checked(c, out, failure);
 }
 
+#endif // LOW_WATCHPOINTS
+
+/*
+ * Functional test: its first loops count X down to 0 with A at 0, so of
+ * "X==5" on $042A (X is 4 there) and "X==2 && A==$0" on $042C only the
+ * second holds. Then a read watchpoint on the test number at $0200 has to
+ * stop after the LDA $0200 at $0438, and the test still has to pass.
+ */
+
 static int
-execute_6502_interrupt_test(MOS_6510* const c, const char* file_to_load)
+check_breakpoints(MOS_6510* const c, struct program* const program, FILE* out, const char* file_to_load)
 {
-  memset(c->ram, 0, 0x10000);
-  load_file(c, file_to_load, 0xA);
+  if(!load_file(c, program, out, file_to_load, 0)) return 1;
   initialise(c);
 
-  printf("\n** file loaded: " BOLD "%s" RESET " **\n", file_to_load);
-  
+  fprintf(out, "\n** checking breakpoints on: " BOLD "%s" RESET " **\n", file_to_load);
+
   c->pc = 0x400;
 
-  uint16_t previous_pc = 0;
-  wb(c, 0xBFFC, 0);
-  while(true) 
+  const char* failure = NULL;
+
+  if(breakpoint_set(c, 0x042A, "Q==1") || breakpoint_set(c, 0x042A, "X==0x10") || breakpoint_set(c, 0x042A, "X=1"))
+    failure = "a condition that doesn't parse was taken";
+  else if(!breakpoint_set(c, 0x042A, "X==5") || !breakpoint_set(c, 0x042C, "X==2 && A==$0"))
+    failure = "a condition didn't parse";
+  else if(run_until(c, -1) != STOP_BREAK || c->pc != 0x042C || c->x != 2)
+    failure = "didn't stop where the condition holds";
+
+  breakpoint_clear(c, 0x042A);
+  breakpoint_clear(c, 0x042C);
+
+  if(!failure && !watch_set(c, 0x0200, 0x0200, WATCH_READ)) failure = "the watchpoint wasn't taken";
+  else if(!failure && (run_until(c, -1) != STOP_WATCH || c->pc != 0x043B || c->breakpoints.hit != WATCH_READ || c->breakpoints.hit_addr != 0x0200))
+    failure = "the read watchpoint didn't stop after LDA $0200";
+
+  watch_set(c, 0x0200, 0x0200, 0);
+
+  if(!failure && (run_until(c, -1) != STOP_TRAP || c->pc != 0x3469)) failure = "didn't get to the end after stopping";
+  return checked(c, out, failure);
+}
+
+/*
+ * A loop calls an RTS on page 4, so the page holds cached code, then
+ * stores into it. With CORE=jit the store runs translated after
+ * JIT_THRESHOLD turns and leaves the native block early, the breakpoint
+ * on the instruction after it still has to stop where X==$10.
+ */
+
+static int
+check_code_breakpoint(MOS_6510* const c, struct program* const program, FILE* out, const char* file_to_load)
+{
+  if(!load_file(c, program, out, file_to_load, 0x4000)) return 1;
+  initialise(c);
+
+  fprintf(out, "\n** checking a breakpoint after a store into code on: " BOLD "%s" RESET " **\n", file_to_load);
+
+  /* $0300: LDX #$40, JSR $0400, STX $0480, DEX, BNE $0302, JMP $030B; $0400: RTS */
+  const uint8_t code[] = { 0xA2, 0x40, 0x20, 0x00, 0x04, 0x8E, 0x80, 0x04, 0xCA, 0xD0, 0xF7, 0x4C, 0x0B, 0x03 };
+  const char* failure = NULL;
+
+  for(uint8_t i = 0; i < sizeof(code); i++) wb(c, 0x0300 + i, code[i]);
+  wb(c, 0x0400, 0x60);
+
+  c->pc = 0x0300;
+
+  if(!breakpoint_set(c, 0x0308, "X==$10")) failure = "the condition didn't parse";
+  else if(run_until(c, -1) != STOP_BREAK || c->pc != 0x0308 || c->x != 0x10 || rb(c, 0x0480) != 0x10)
+    failure = "didn't stop after the store";
+
+  breakpoint_clear(c, 0x0308);
+
+  if(!failure && (run_until(c, -1) != STOP_TRAP || c->pc != 0x030B || c->x != 0)) failure = "didn't get to the end after stopping";
+  return checked(c, out, failure);
+}
+
+/*
+ * AllSuiteA entered through reset() out of a JAM: the JAM has to keep the
+ * CPU halted across runs, reset() has to keep A, X and Y, push nothing
+ * but move SP down by 3, set I, take 7 cycles and fetch the reset vector,
+ * from where the suite has to pass as usual.
+ */
+
+static int
+check_reset(MOS_6510* const c, struct program* const program, FILE* out, const char* file_to_load)
+{
+  if(!load_file(c, program, out, file_to_load, 0x4000)) return 1;
+  initialise(c);
+
+  fprintf(out, "\n** checking reset on: " BOLD "%s" RESET " **\n", file_to_load);
+
+  const char* failure = NULL;
+
+  wb(c, 0x0300, 0x02); // JAM
+  wb(c, RESET_VECTOR, 0x00);
+  wb(c, RESET_VECTOR + 1, 0x40);
+
+  c->pc = 0x0300;
+  c->a = 0x12;
+  c->x = 0x34;
+  c->y = 0x56;
+  c->idf = 0;
+  memset(c->low + 0x100, 0xA5, 0x100); // Whatever reset() might push shows
+
+  if(run_cycles(c, PAL_FRAME_CYCLES) != STOP_JAM || c->pc != 0x0300 || !c->halted) failure = "the JAM didn't halt";
+
+  const struct state jammed = state_of(c);
+
+  const enum STOP_REASON again = run_cycles(c, PAL_FRAME_CYCLES);
+  const struct state still = state_of(c);
+
+  if(!failure && (again != STOP_JAM || !same_state(&still, &jammed))) failure = "the CPU didn't stay halted";
+
+  reset(c);
+
+  if(!failure && (c->halted || c->pc != 0x4000 || !c->idf || c->cyc != jammed.cyc + 7)) failure = "reset() didn't start at the reset vector";
+  if(!failure && (c->a != 0x12 || c->x != 0x34 || c->y != 0x56 || c->sp != (uint8_t)(jammed.sp - 3))) failure = "reset() changed the registers";
+  for(uint16_t i = 0x100; i < 0x200 && !failure; i++)
   {
-    mnemonics(c);
-    // cpu_debug(c);
+    if(c->low[i] != 0xA5) failure = "reset() wrote to the stack";
+  }
+  if(!failure && (run_until(c, 0x45C0) != STOP_BREAK || c->pc != 0x45C0 || rb(c, 0x0210) != 0xFF)) failure = "the suite didn't pass after reset()";
 
-    c->irq_status = rb(c, 0xBFFC);
-    interrupt_handler(c);
-    wb(c, 0xBFFC, c->irq_status);
-    if(previous_pc == c->pc)
+  return checked(c, out, failure);
+}
+
+#define RECURSION 100 // Calls deep, more than PROFILE_DEPTH
+
+/*
+ * A routine calling itself RECURSION deep, planted into AllSuiteA's
+ * memory, has to return all the way and trap. With PROFILE=1 the calls
+ * below PROFILE_DEPTH have to be charged to the deepest node followed:
+ * the call tree stays one node per level, every folded stack fits, they
+ * add up to all cycles charged, and the shadow stack is empty again.
+ */
+
+static int
+check_recursion(MOS_6510* const c, struct program* const program, FILE* out, const char* file_to_load)
+{
+  if(!load_file(c, program, out, file_to_load, 0x4000)) return 1;
+  initialise(c);
+
+  fprintf(out, "\n** checking deep recursion on: " BOLD "%s" RESET " **\n", file_to_load);
+
+  /* $0300: LDX #RECURSION, JSR $0310, JMP $0305; $0310: DEX, BEQ $0316, JSR $0310, RTS */
+  const uint8_t code[] = { 0xA2, RECURSION, 0x20, 0x10, 0x03, 0x4C, 0x05, 0x03 };
+  const uint8_t routine[] = { 0xCA, 0xF0, 0x03, 0x20, 0x10, 0x03, 0x60 };
+  const char* failure = NULL;
+
+  for(uint8_t i = 0; i < sizeof(code); i++) wb(c, 0x0300 + i, code[i]);
+  for(uint8_t i = 0; i < sizeof(routine); i++) wb(c, 0x0310 + i, routine[i]);
+
+  c->pc = 0x0300;
+  c->sp = 0xFF;
+
+  if(run_until(c, -1) != STOP_TRAP || c->pc != 0x0305 || c->x != 0 || c->sp != 0xFF) failure = "the recursion didn't return all the way";
+
+#ifdef PROFILER
+  const struct profile* const p = c->profile;
+  char* folded = NULL;
+  size_t size = 0;
+  FILE* const stacks = open_memstream(&folded, &size);
+
+  if(p && stacks)
+  {
+    profile_folded(c, stacks, "recursion");
+    fclose(stacks);
+
+    uint64_t hits = 0;
+    uint32_t frames = 0;
+
+    for(const char* line = folded; line && *line; line++)
     {
-      if(c->pc == 0x06F5)
+      if(*line == ';') frames++;
+      else if(*line == ' ')
       {
-        printf(GREEN "✓" RESET " - test passed!\n");
-        break;
+        hits += strtoull(line + 1, (char**)&line, 10);
+        if(frames >= PROFILE_DEPTH) failure = "a folded stack is deeper than the profiler follows";
+        frames = 0;
       }
-      printf(RED "✘" RESET " - test failed! (trapped at " BOLD "0x%04X" RESET ")\n", c->pc);
-      break;
     }
-    previous_pc = c->pc;
+
+    if(!failure && p->node_count != PROFILE_DEPTH) failure = "the call tree grew past PROFILE_DEPTH";
+    if(!failure && p->depth != 1) failure = "the shadow stack wasn't left";
+    if(!failure && hits != p->total) failure = "the folded stacks don't add up";
   }
-  return 0;
+  else if(!failure) failure = "no profile to look at";
+
+  free(folded);
+#endif
+
+  return checked(c, out, failure);
 }
 
+#ifdef REWIND
+
+#define REWIND_STEPS 20000
+
+/*
+ * Functional test, one instruction at a time with every state recorded:
+ * going back any number of steps gets to the state recorded there, all of
+ * memory included where it was recorded too. Steps run by run_cycles()
+ * are undone as well, stepping on from there repeats the recorded states,
+ * and going back to the last write of the test number lands on the
+ * instruction that stores it.
+ */
+
 static int
-execute_6502_functional_test(MOS_6510* const c, const char *file_to_load)
+check_rewind(MOS_6510* const c, struct program* const program, FILE* out, const char* file_to_load)
 {
-  memset(c->ram, 0, 0x10000);
-  if(load_file(c, file_to_load, 0) != 0) return 1;
+  if(!load_file(c, program, out, file_to_load, 0)) return 1;
   initialise(c);
 
-  printf("\n** file loaded: " BOLD "%s" RESET " **\n", file_to_load);
+  fprintf(out, "\n** checking rewind on: " BOLD "%s" RESET " **\n", file_to_load);
 
   c->pc = 0x400;
 
-  uint16_t previous_pc = 0;
+  struct state* const states = malloc((REWIND_STEPS + 1) * sizeof(struct state));
+  uint8_t* const memory = malloc(3 * 0x10000); // At step 0, halfway, scratch
+  const char* failure = NULL;
 
-  while(true) 
+  if(states == NULL || memory == NULL || !rewind_start(c, 16, 16, 4096, 8))
+  {
+    free(states);
+    free(memory);
+    return checked(c, out, "out of memory");
+  }
+
+  for(uint32_t i = 0; i <= REWIND_STEPS; i++)
+  {
+    states[i] = state_of(c);
+    if(i == 0) memory_of(c, memory);
+    if(i == REWIND_STEPS / 2) memory_of(c, memory + 0x10000);
+    if(i < REWIND_STEPS) mnemonics(c);
+  }
+
+  const struct state* const stepped = &states[REWIND_STEPS - 1];
+  struct state current;
+
+  if(!rewind_back(c, 1) || (current = state_of(c), !same_state(&current, stepped))) failure = "one step back isn't the last state";
+  else if(!rewind_back(c, 999) || (current = state_of(c), !same_state(&current, &states[REWIND_STEPS - 1000]))) failure = "1000 steps back isn't the state there";
+  else if(!rewind_back(c, REWIND_STEPS / 2 - 1000) || !same_as(c, &states[REWIND_STEPS / 2], memory + 0x10000, memory + 0x20000)) failure = "halfway back isn't the state there";
+  else if(!rewind_back(c, REWIND_STEPS / 2) || !same_as(c, &states[0], memory, memory + 0x20000)) failure = "all the way back isn't the first state";
+
+  const uint64_t instructions = c->instructions;
+
+  if(!failure)
+  {
+    run_cycles(c, REWIND_STEPS);
+    if(!rewind_back(c, c->instructions - instructions) || !same_as(c, &states[0], memory, memory + 0x20000)) failure = "run_cycles() wasn't undone";
+  }
+
+  for(uint32_t i = 0; i < REWIND_STEPS && !failure; i++)
   {
     mnemonics(c);
-    if(previous_pc == c->pc)
+    current = state_of(c);
+    if(!same_state(&current, &states[i + 1])) failure = "stepping on after going back went elsewhere";
+  }
+
+  if(!failure && (!rewind_to_write(c, 0x0200) || bus_peek(c, c->pc + 1) != 0x00 || bus_peek(c, c->pc + 2) != 0x02))
+    failure = "going back to the last write of $0200 isn't in front of a store to it";
+
+  rewind_stop(c);
+  if(!failure && (run_until(c, -1) != STOP_TRAP || c->pc != 0x3469)) failure = "didn't get to the end after rewinding";
+
+  free(states);
+  free(memory);
+  return checked(c, out, failure);
+}
+
+#endif // REWIND
+
+/*
+ * Extra binaries from the command line, given as FILE[:LOAD[:START[:PASS]]]
+ * with the addresses in hex. LOAD defaults to $0000 and is only used for raw
+ * images, START defaults to the image's entry point or else the reset
+ * vector. The program runs until it traps and passes if it trapped at PASS,
+ * without PASS only where it stopped is reported. A JAM or the watchdog
+ * (see main()) stopping it is a failure.
+ */
+
+static bool
+load_binary(MOS_6510* const c, struct program* const program, FILE* out, const char* spec, int32_t addresses[3])
+{
+  char file_to_load[4096];
+  const char* field = strchr(spec, ':');
+  const size_t length = field ? (size_t)(field - spec) : strlen(spec);
+
+  addresses[0] = 0; // LOAD
+  addresses[1] = -1; // START
+  addresses[2] = -1; // PASS
+
+  for(int i = 0; i < 3 && field; i++)
+  {
+    char* end;
+
+    addresses[i] = strtol(field + 1, &end, 16) & 0xFFFF;
+
+    if(end == field + 1 || (*end != ':' && *end != '\0') || (*end == ':' && i == 2))
     {
-      if(c->pc == 0x3469)
+      fprintf(out, "\n**" RED " Error " RESET "** " "expected FILE[:LOAD[:START[:PASS]]], got \"%s\"\n", spec);
+      return false;
+    }
+
+    field = *end == ':' ? end : NULL;
+  }
+
+  if(length >= sizeof(file_to_load))
+  {
+    fprintf(out, "\n**" RED " Error " RESET "** " "file name too long\n");
+    return false;
+  }
+
+  memcpy(file_to_load, spec, length);
+  file_to_load[length] = '\0';
+
+  if(!load_file(c, program, out, file_to_load, addresses[0])) return false;
+  initialise(c);
+
+  fprintf(out, "\n** file loaded: " BOLD "%s" RESET " **\n", file_to_load);
+
+  if(addresses[1] >= 0) c->pc = addresses[1];
+  else if(program->entry >= 0) c->pc = program->entry;
+  return true;
+}
+
+static int
+execute_binary(MOS_6510* const c, struct program* const program, FILE* out, const char* spec)
+{
+  int32_t addresses[3];
+  if(!load_binary(c, program, out, spec, addresses)) return 1;
+
+  const enum STOP_REASON reason = run_until(c, -1);
+  const bool passed = addresses[2] < 0 ? reason == STOP_TRAP : reason == STOP_TRAP && c->pc == addresses[2];
+  if(addresses[2] < 0)
+  {
+    fprintf(out, "- %s at " BOLD "0x%04X" RESET "\n", stopped(reason), c->pc);
+  }
+  else if(passed)
+  {
+    fprintf(out, GREEN "✓" RESET " - test passed!\n");
+  }
+  else
+  {
+    fprintf(out, RED "✘" RESET " - test failed! (%s at " BOLD "0x%04X" RESET ")\n", stopped(reason), c->pc);
+  }
+
+  return passed ? 0 : 1;
+}
+
+/* Runs a binary (see execute_binary(), PASS is ignored) against the log of another emulator, see compare.h */
+
+static int
+execute_compare(MOS_6510* const c, struct program* const program, FILE* out, const char* spec, const char* log, const char* format)
+{
+  struct reference reference;
+
+  if(!reference_open(&reference, log, format))
+  {
+    fprintf(out, "\n**" RED " Error " RESET "** " "couldn't read \"%s\" as \"%s\"\n", log, format);
+    return 1;
+  }
+
+  int32_t addresses[3];
+  if(!load_binary(c, program, out, spec, addresses))
+  {
+    reference_close(&reference);
+    return 1;
+  }
+
+  fprintf(out, "- comparing against " BOLD "%s" RESET "\n", log);
+  const bool passed = compare_run(c, &reference, out);
+
+  reference_close(&reference);
+  return passed ? 0 : 1;
+}
+
+/* One suite, run by a worker thread on a CPU of its own */
+
+struct job
+{
+  int (*execute)(MOS_6510* const c, struct program* const program, FILE* out, const char* file_to_load);
+  const char* file;
+  const char* reference; // Log of another emulator to compare against, see execute_compare()
+
+  char* output; // What the suite printed, shown in submission order
+  size_t output_size;
+  int result;
+  bool done;
+
+  double seconds; // Wall time of the whole run, loading included
+  uint64_t instructions;
+  uint64_t cycles;
+
+#ifdef PROFILER
+  char* folded; // Folded call stacks, rooted at the file name
+  size_t folded_size;
+#endif
+};
+
+struct pool
+{
+  struct job* jobs;
+  size_t count;
+  size_t next; // First job no worker has picked up yet
+  const char* format; // Columns of the reference logs, see reference_open()
+  uint64_t cycle_limit; // Watchdog of every suite, 0 for none
+  uint64_t instruction_limit;
+
+#ifdef TRACER
+  const char* trace; // File name prefix, NULL to only keep the last instructions
+#endif
+
+#ifdef PROFILER
+  uint32_t period; // See profile_start()
+  struct profile_range ranges[PROFILE_RANGES];
+  uint8_t range_count;
+#endif
+
+  pthread_mutex_t lock;
+  pthread_cond_t finished;
+};
+
+static void*
+worker(void* arg)
+{
+  struct pool* const p = arg;
+
+  while(true)
+  {
+    pthread_mutex_lock(&p->lock);
+    const size_t i = p->next < p->count ? p->next++ : p->count;
+    pthread_mutex_unlock(&p->lock);
+
+    if(i == p->count) return NULL;
+
+    struct job* const j = &p->jobs[i];
+    MOS_6510* const c = calloc(1, sizeof(MOS_6510)); // Zeroed, nothing allocated yet
+    FILE* const out = open_memstream(&j->output, &j->output_size);
+    int result = 1;
+
+#ifdef PROFILER
+    if(c && !profile_start(c, p->period)) fprintf(stderr, "\n**" RED " Error " RESET "**" " no memory to profile \"%s\"\n", j->file);
+
+    for(uint8_t r = 0; c && r < p->range_count; r++) profile_range(c, p->ranges[r].first, p->ranges[r].last, p->ranges[r].name);
+#endif
+
+#ifdef TRACER
+    char trace[4096];
+    snprintf(trace, sizeof(trace), "%s%zu.trace", p->trace ? p->trace : "", i);
+
+    if(c && !trace_start(c, p->trace ? trace : NULL, 16)) fprintf(stderr, "\n**" RED " Error " RESET "**" " couldn't trace \"%s\"\n", j->file);
+#endif
+
+    /* The address space outlives the suite, the reports below still look at memory */
+    struct bus bus;
+    struct program program = { 0 };
+
+    if(c && out)
+    {
+      bus_init(c, &bus);
+      c->cycle_limit = p->cycle_limit;
+      c->instruction_limit = p->instruction_limit;
+
+      const double start = now();
+      result = j->reference ? execute_compare(c, &program, out, j->file, j->reference, p->format) : j->execute(c, &program, out, j->file);
+      j->seconds = now() - start;
+      j->instructions = c->instructions;
+      j->cycles = c->cyc;
+#ifdef OPCODE_STATS
+      fprintf(out, "\n");
+      opcode_stats_dump(c, out);
+#endif
+#ifdef TRACER
+      if(result)
+      {
+        fprintf(out, "\nLast instructions:\n");
+        trace_dump(c, out, 32);
+      }
+
+      if(!trace_stop(c))
       {
-        printf(GREEN "✓" RESET " - test passed!\n");
-        break;
+        fprintf(out, "\n**" RED " Error " RESET "**" " couldn't save the trace to \"%s\"\n", trace);
+        result = 1;
       }
-      printf(RED "✘" RESET " - test failed! (trapped at " BOLD "0x%04X" RESET ")\n", c->pc);
-      break;
+#endif
+#ifdef PROFILER
+      fprintf(out, "\n");
+      profile_report(c, out, 10);
+
+      FILE* const folded = open_memstream(&j->folded, &j->folded_size);
+      if(folded)
+      {
+        profile_folded(c, folded, j->file);
+        fclose(folded);
+      }
+#endif
+
+      bus_free(&bus);
+      program_free(&program);
     }
-    previous_pc = c->pc;
+    else fprintf(stderr, "\n**" RED " Error " RESET "**" " out of memory running \"%s\"\n", j->file);
+
+    if(out) fclose(out);
+    if(c) cpu_free(c);
+    free(c);
+
+    pthread_mutex_lock(&p->lock);
+    j->result = result;
+    j->done = true;
+    pthread_cond_broadcast(&p->finished);
+    pthread_mutex_unlock(&p->lock);
   }
-  return 0;
 }
 
-static int 
-execute_timingtest(MOS_6510* const c, const char* file_to_load)
+/* Throughput of a finished job, MIPS and speed relative to a real PAL 6510 */
+
+static double
+mips(const struct job* const j)
 {
-  memset(c->ram, 0, 0x10000);
-  if(load_file(c, file_to_load, 0x1000) != 0) return 1;
-  initialise(c);
+  return j->seconds > 0 ? j->instructions / j->seconds / 1e6 : 0;
+}
 
-  printf("\n** file loaded: " BOLD "%s" RESET " **\n", file_to_load);
+static double
+speed(const struct job* const j)
+{
+  return j->seconds > 0 ? j->cycles / j->seconds / PAL_CLOCK : 0;
+}
 
-  c->pc = 0x1000;
+static void
+print_stats(FILE* out, const struct job* const j)
+{
+  fprintf(out, "  %.3f s, %" PRIu64 " instructions, %" PRIu64 " cycles, %.1f MIPS, %.1fx real speed\n",
+      j->seconds, j->instructions, j->cycles, mips(j), speed(j));
+}
 
-  while(true)
+static void
+write_csv(FILE* out, const struct job* const jobs, size_t count)
+{
+  fprintf(out, "file,passed,seconds,instructions,cycles,mips,speed\n");
+
+  for(size_t i = 0; i < count; i++)
   {
-    mnemonics(c);
-    // cpu_debug(c);
-    if(c->pc == 0x1269)
+    const struct job* const j = &jobs[i];
+
+    fputc('"', out);
+    for(const char* p = j->file; *p; p++)
+    {
+      if(*p == '"') fputc('"', out);
+      fputc(*p, out);
+    }
+
+    fprintf(out, "\",%d,%.6f,%" PRIu64 ",%" PRIu64 ",%.3f,%.3f\n",
+        j->result == 0, j->seconds, j->instructions, j->cycles, mips(j), speed(j));
+  }
+}
+
+static void
+write_json(FILE* out, const struct job* const jobs, size_t count)
+{
+  fprintf(out, "[\n");
+
+  for(size_t i = 0; i < count; i++)
+  {
+    const struct job* const j = &jobs[i];
+
+    fprintf(out, "  {\"file\": \"");
+    for(const char* p = j->file; *p; p++)
     {
-      printf("%s", c->cyc == 1141 ? GREEN "✓" RESET " - test passed!\n" : RED "✘" RESET " - test failed!\n");
-      break;
+      if(*p == '"' || *p == '\\') fprintf(out, "\\%c", *p);
+      else if((unsigned char)*p < 0x20) fprintf(out, "\\u%04x", *p);
+      else fputc(*p, out);
     }
+
+    fprintf(out, "\", \"passed\": %s, \"seconds\": %.6f, \"instructions\": %" PRIu64 ", \"cycles\": %" PRIu64
+        ", \"mips\": %.3f, \"speed\": %.3f}%s\n",
+        j->result == 0 ? "true" : "false", j->seconds, j->instructions, j->cycles, mips(j), speed(j),
+        i + 1 < count ? "," : "");
   }
-  return 0;
+
+  fprintf(out, "]\n");
 }
 
+/*
+ * Runs the conformance suites, then any binaries named on the command line,
+ * each on its own CPU in a pool of one thread per core. Output is printed
+ * in that order as the suites finish, each followed by its wall time,
+ * instructions, cycles, MIPS and speed relative to a real PAL 6510.
+ * `--csv FILE` and `--json FILE` also write those numbers to FILE ("-" for
+ * stdout). The exit status is 1 if any suite failed.
+ *
+ * Built with PROFILE=1 every suite also gets its hot spots listed, sampled
+ * every `--period N` cycles (every instruction by default), and `--folded
+ * FILE` writes the call stacks of all of them for flamegraph tools.
+ * `--range NAME=FIRST-LAST` (hex) adds up the hits of an address range.
+ *
+ * `--max-cycles N` and `--max-instructions N` stop any suite that runs
+ * longer, so a program stuck in a loop it never leaves fails instead of
+ * running forever. A JAM halts a suite too.
+ *
+ * `--compare LOG FILE[...]` runs the binary one instruction at a time
+ * against LOG, the trace of another emulator, and stops at the first
+ * difference. `--format COLUMNS` tells where the fields are on each line
+ * of the logs, see reference_open().
+ *
+ * Built with TRACE=1 the last instructions of a failed suite are printed,
+ * `--trace PREFIX` saves the whole trace of suite N to PREFIX<N>.trace.
+ */
+
 int 
-main(void)
+main(int argc, char** argv)
 {
   char* array[8];
   array[0] = " ________    ________    ______       ________ \n";
@@ -198,18 +1173,167 @@ main(void)
     printf("%s", array[i]);
   }
 
-  MOS_6510 c;
+  const struct job suites[] = {
+    { .execute = execute_allsuiteasm, .file = "test_files/AllSuiteA.bin" },
+    { .execute = execute_6502_decimal_test, .file = "test_files/6502_decimal_test.bin" },
+    { .execute = execute_6502_interrupt_test, .file = "test_files/6502_interrupt_test.bin" },
+    { .execute = execute_6502_functional_test, .file = "test_files/6502_functional_test.bin" },
+    { .execute = execute_timingtest, .file = "test_files/timingtest-1.bin" },
+    { .execute = check_snapshots, .file = "test_files/6502_functional_test.bin" },
+    { .execute = check_events, .file = "test_files/6502_functional_test.bin" },
+    { .execute = check_watchpoints, .file = "test_files/AllSuiteA.bin" },
+#ifdef LOW_WATCHPOINTS
+    { .execute = check_low_watchpoints, .file = "test_files/AllSuiteA.bin" },
+#endif
+    { .execute = check_breakpoints, .file = "test_files/6502_functional_test.bin" },
+    { .execute = check_code_breakpoint, .file = "test_files/AllSuiteA.bin" },
+    { .execute = check_reset, .file = "test_files/AllSuiteA.bin" },
+    { .execute = check_recursion, .file = "test_files/AllSuiteA.bin" },
+#ifdef REWIND
+    { .execute = check_rewind, .file = "test_files/6502_functional_test.bin" },
+#endif
+  };
+  const size_t builtin = sizeof(suites) / sizeof(suites[0]);
 
-  const time_t time_start = time(NULL);
+  struct pool pool = { .count = builtin, .format = "pc,a,x,y,sp,p,cyc", .lock = PTHREAD_MUTEX_INITIALIZER, .finished = PTHREAD_COND_INITIALIZER };
+  const char* csv = NULL;
+  const char* json = NULL;
+  const char* folded = NULL;
+  const char* period = NULL;
+  const char* reference = NULL;
+  const char* cycle_limit = NULL;
+  const char* instruction_limit = NULL;
 
-  execute_allsuiteasm(&c, "test_files/AllSuiteA.bin");
-  execute_6502_decimal_test(&c, "test_files/6502_decimal_test.bin");
-  execute_6502_interrupt_test(&c, "test_files/6502_interrupt_test.bin");
-  execute_6502_functional_test(&c, "test_files/6502_functional_test.bin");
-  execute_timingtest(&c, "test_files/timingtest-1.bin");
-  
-  const time_t time_end = time(NULL);
+  pool.jobs = calloc(builtin + argc, sizeof(struct job));
+  if(pool.jobs == NULL) return 1;
+
+  memcpy(pool.jobs, suites, sizeof(suites));
+  for(int i = 1; i < argc; i++)
+  {
+    const char** option = NULL;
+
+    if(strcmp(argv[i], "--csv") == 0) option = &csv;
+    else if(strcmp(argv[i], "--json") == 0) option = &json;
+    else if(strcmp(argv[i], "--compare") == 0) option = &reference;
+    else if(strcmp(argv[i], "--format") == 0) option = &pool.format;
+    else if(strcmp(argv[i], "--max-cycles") == 0) option = &cycle_limit;
+    else if(strcmp(argv[i], "--max-instructions") == 0) option = &instruction_limit;
+#ifdef PROFILER
+    else if(strcmp(argv[i], "--folded") == 0) option = &folded;
+    else if(strcmp(argv[i], "--period") == 0) option = &period;
+    else if(strcmp(argv[i], "--range") == 0 && i + 1 < argc)
+    {
+      char* const range = argv[++i];
+      char* const equals = strchr(range, '=');
+      char* end = NULL;
+      const unsigned long first = equals ? strtoul(equals + 1, &end, 16) : 0;
+      const unsigned long last = end && *end == '-' ? strtoul(end + 1, &end, 16) : 0;
+
+      if(equals == NULL || *end != '\0' || first > last || last > 0xFFFF || pool.range_count == PROFILE_RANGES)
+      {
+        fprintf(stderr, "**" RED " Error " RESET "** " "expected --range NAME=FIRST-LAST, got \"%s\"\n", range);
+        return 1;
+      }
+
+      *equals = '\0';
+      pool.ranges[pool.range_count++] = (struct profile_range){ first, last, range };
+      continue;
+    }
+#endif
+#ifdef TRACER
+    else if(strcmp(argv[i], "--trace") == 0) option = &pool.trace;
+#endif
+
+    if(option && i + 1 == argc)
+    {
+      fprintf(stderr, "**" RED " Error " RESET "** " "%s needs a value\n", argv[i]);
+      return 1;
+    }
+
+    if(option) *option = argv[++i];
+    else
+    {
+      pool.jobs[pool.count++] = (struct job){ .execute = execute_binary, .file = argv[i], .reference = reference };
+      reference = NULL;
+    }
+  }
+
+#ifdef PROFILER
+  pool.period = period ? strtoul(period, NULL, 0) : 0;
+#endif
+  pool.cycle_limit = cycle_limit ? strtoull(cycle_limit, NULL, 0) : 0;
+  pool.instruction_limit = instruction_limit ? strtoull(instruction_limit, NULL, 0) : 0;
+
+  const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  const size_t workers = cores < 1 ? 1 : (size_t)cores < pool.count ? (size_t)cores : pool.count;
+  pthread_t threads[workers];
+  size_t started = 0;
+
+  const double time_start = now();
+
+  while(started < workers && pthread_create(&threads[started], NULL, worker, &pool) == 0) started++;
+  if(started == 0) worker(&pool); // No threads to be had, run everything right here
+
+  int failed = 0;
+
+  for(size_t i = 0; i < pool.count; i++)
+  {
+    struct job* const j = &pool.jobs[i];
+
+    pthread_mutex_lock(&pool.lock);
+    while(!j->done) pthread_cond_wait(&pool.finished, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+
+    if(j->output) fwrite(j->output, 1, j->output_size, stdout);
+    free(j->output);
+    print_stats(stdout, j);
+    failed |= j->result;
+  }
+
+  for(size_t i = 0; i < started; i++) pthread_join(threads[i], NULL);
+
+  printf("\nProgram executed in %.3f seconds\n", now() - time_start);
+
+#ifdef PROFILER
+  FILE* const stacks = folded ? fopen(folded, "w") : NULL;
+
+  if(folded && stacks == NULL)
+  {
+    fprintf(stderr, "**" RED " Error " RESET "** " "couldn't write \"%s\"\n", folded);
+    failed = 1;
+  }
+
+  for(size_t i = 0; i < pool.count; i++)
+  {
+    if(stacks && pool.jobs[i].folded) fwrite(pool.jobs[i].folded, 1, pool.jobs[i].folded_size, stacks);
+    free(pool.jobs[i].folded);
+  }
+
+  if(stacks) fclose(stacks);
+#else
+  (void) folded;
+  (void) period;
+#endif
+
+  const char* const reports[2] = { csv, json };
+
+  for(int i = 0; i < 2; i++)
+  {
+    if(reports[i] == NULL) continue;
+
+    FILE* const f = strcmp(reports[i], "-") == 0 ? stdout : fopen(reports[i], "w");
+
+    if(f == NULL)
+    {
+      fprintf(stderr, "**" RED " Error " RESET "** " "couldn't write \"%s\"\n", reports[i]);
+      failed = 1;
+      continue;
+    }
+
+    (i == 0 ? write_csv : write_json)(f, pool.jobs, pool.count);
+    if(f != stdout) fclose(f);
+  }
 
-  printf("\nProgram executed in %ld seconds\n", (time_end - time_start) / 1000);
-	return 0;
+  free(pool.jobs);
+	return failed;
 }
@@ -1,266 +1,31 @@
+#include <inttypes.h>
+
 #include "cpu.h"
 #include "bus.h"
 #include "debug.h"
+#include "disasm.h"
+#include "opcodes.h"
+
+#define MODE_NAME_IMPLIED "IMPLIED"
+#define MODE_NAME_ACCUMULATOR "ACCUMULATOR"
+#define MODE_NAME_RELATIVE "RELATIVE"
+#define MODE_NAME_IMMEDIATE "IMMEDIATE"
+#define MODE_NAME_ZEROPAGE "ZEROPAGE"
+#define MODE_NAME_ZEROPAGE_X "ZEROPAGE X"
+#define MODE_NAME_ZEROPAGE_Y "ZEROPAGE Y"
+#define MODE_NAME_ABSOLUTE "ABSOLUTE"
+#define MODE_NAME_ABSOLUTE_X "ABSOLUTE X"
+#define MODE_NAME_ABSOLUTE_Y "ABSOLUTE Y"
+#define MODE_NAME_INDIRECT "INDIRECT"
+#define MODE_NAME_INDIRECT_X "(INDIRECT, X)"
+#define MODE_NAME_INDIRECT_Y "(INDIRECT, Y)"
 
-struct debug debug_output[256] = 
+#define DEBUG_OUTPUT(op, mnemonic, func, cycle, mode, crossed) {#mnemonic, MODE_NAME_##mode},
+const struct debug debug_output[256] = 
 {
-  {"BRK", "IMPLIED"}, 
-  {"ORA", "(INDIRECT, X)"}, 
-  {"JAM", "IMPLIED"}, 
-  {"SLO", "(INDIRECT, X)"}, 
-  {"NOP", "ZEROPAGE"}, 
-  {"ORA", "ZEROPAGE"},  
-  {"ASL", "ZEROPAGE"},  
-  {"SLO", "ZEROPAGE"},  
-  {"PHP", "IMPLIED"},  
-  {"ORA", "IMMEDIATE"},  
-  {"ASL", "ACCUMULATOR"},  
-  {"ANC", "IMMEDIATE"}, 
-  {"NOP", "ABSOLUTE"},  
-  {"ORA", "ABSOLUTE"},  
-  {"ASL", "ABSOLUTE"},  
-  {"SLO", "ABSOLUTE"},  
-  {"BPL", "RELATIVE"},  
-  {"ORA", "(INDIRECT, Y)"},  
-  {"JAM", "IMPLIED"},  
-  {"SLO", "(INDIRECT, X)"},  
-  {"NOP", "ZEROPAGE X"},  
-  {"ORA", "ZEROPAGE X"},  
-  {"ASL", "ZEROPAGE X"},  
-  {"SLO", "ZEROPAGE"},  
-  {"CLC", "IMPLIED"},  
-  {"ORA", "ABSOLUTE Y"},  
-  {"NOP", "IMPLIED"},  
-  {"SLO", "ABSOLUTE Y"},  
-  {"NOP", "ABSOLUTE X"},  
-  {"ORA", "ABSOLUTE X"},  
-  {"ASL", "ABSOLUTE X"},  
-  {"SLO", "ABSOLUTE X"},  
-  {"JSR", "ABSOLUTE"},  
-  {"AND", "(INDIRECT, X)"},  
-  {"JAM", "IMPLIED"},  
-  {"RLA", "(INDIRECT, X)"},  
-  {"BIT", "ZEROPAGE"},  
-  {"AND", "ZEROPAGE"},  
-  {"ROL", "ZEROPAGE"},  
-  {"RLA", "ZEROPAGE"},  
-  {"PLP", "IMPLIED"},  
-  {"AND", "IMMEDIATE"},  
-  {"ROL", "ACCUMULATOR"},  
-  {"ANC", "IMMEDIATE"}, 
-  {"BIT", "ABSOLUTE"},  
-  {"AND", "ABSOLUTE"},  
-  {"ROL", "ABSOLUTE"},  
-  {"RLA", "ABSOLUTE"},  
-  {"BMI", "RELATIVE"},  
-  {"AND", "(INDIRECT, Y)"},  
-  {"JAM", "IMPLIED"},  
-  {"RLA", "(INDIRECT, Y)"},  
-  {"NOP", "ZEROPAGE X"},  
-  {"AND", "ZEROPAGE X"},  
-  {"ROL", "ZEROPAGE X"},  
-  {"RLA", "ZEROPAGE Y"},  
-  {"SEC", "IMPLIED"},  
-  {"AND", "ABSOLUTE Y"},  
-  {"NOP", "IMPLIED"},  
-  {"RLA", "ABSOLUTE Y"}, 
-  {"NOP", "ABSOLUTE X"},  
-  {"AND", "ABSOLUTE X"},  
-  {"ROL", "ABSOLUTE X"},  
-  {"RLA", "ABSOLUTE X"},  
-  {"RTI", "IMPLIED"},  
-  {"EOR", "(INDIRECT, X)"},  
-  {"JAM", ""},  
-  {"SRE", "(INDIRECT, X)"},  
-  {"NOP", "ZEROPAGE"},  
-  {"EOR", "ZEROPAGE"},  
-  {"LSR", "ZEROPAGE"},  
-  {"SRE", "ZEROPAGE"},  
-  {"PHA", "IMPLIED"},  
-  {"EOR", "IMMEDIATE"},  
-  {"LSR", "ACCUMULATOR"},  
-  {"ALR", "IMMEDIATE"}, 
-  {"JMP", "ABSOLUTE"},  
-  {"EOR", "ABSOLUTE"},  
-  {"LSR", "ABSOLUTE"},  
-  {"SRE", "ABSOLUTE"},  
-  {"BVC", "RELATIVE"},  
-  {"EOR", "(INDIRECT, Y)"},  
-  {"JAM", ""},  
-  {"SRE", "(INDIRECT, Y)"},  
-  {"NOP", "ZEROPAGE X"},  
-  {"EOR", "ZEROPAGE X"},  
-  {"LSR", "ZEROPAGE X"},  
-  {"SRE", "ZEROPAGE X"},  
-  {"CLI", "IMPLIED"},  
-  {"EOR", "ABSOLUTE Y"},  
-  {"NOP", "IMPLIED"},  
-  {"SRE", "ABSOLUTE Y"}, 
-  {"NOP", "ABSOLUTE X"},  
-  {"EOR", "ABSOLUTE X"},  
-  {"LSR", "ABSOLUTE X"},  
-  {"SRE", "ABSOLUTE X"},  
-  {"RTS", "IMPLIED"},  
-  {"ADC", "(INDIRECT, X)"},  
-  {"JAM", "IMPLIED"},  
-  {"RRA", "(INDIRECT, X)"},  
-  {"NOP", "ZEROPAGE"},  
-  {"ADC", "ZEROPAGE"},  
-  {"ROR", "ZEROPAGE"},  
-  {"RRA", "ZEROPAGE"},  
-  {"PLA", "IMPLIED"},  
-  {"ADC", "IMMEDIATE"},  
-  {"ROR", "ACCUMULATOR"},  
-  {"ARR", "IMMEDIATE"}, 
-  {"JMP", "INDIRECT"},  
-  {"ADC", "ABSOLUTE"},  
-  {"ROR", "ABSOLUTE"},  
-  {"RRA", "ABSOLUTE X"},  
-  {"BVS", "RELATIVE"},  
-  {"ADC", "(INDIRECT, Y)"},  
-  {"JAM", ""},  
-  {"RRA", "(INDIRECT, Y)"},  
-  {"NOP", "ZEROPAGE X"},  
-  {"ADC", "ZEROPAGE X"},  
-  {"ROR", "ZEROPAGE X"},  
-  {"RRA", "ZEROPAGE X"},  
-  {"SEI", "IMPLIED"},  
-  {"ADC", "ABSOLUTE Y"},  
-  {"NOP", "IMPLIED"},  
-  {"RRA", "ABSOLUTE Y"},  
-  {"NOP", "ABSOLUTE X"},  
-  {"ADC", "ABSOLUTE X"},  
-  {"ROR", "ABSOLUTE X"},  
-  {"RRA", "ABSOLUTE X"},   
-  {"NOP", "IMMEDIATE"},  
-  {"STA", "(INDIRECT, X)"},  
-  {"NOP", "IMMEDIATE"},  
-  {"SAX", "(INDIRECT, X)"},  
-  {"STY", "ZEROPAGE"},  
-  {"STA", "ZEROPAGE"},  
-  {"STX", "ZEROPAGE"},  
-  {"SAX", "ZEROPAGE"},  
-  {"DEY", "IMPLIED"},  
-  {"NOP", "IMPLIED"},  
-  {"TXA", "IMPLIED"}, 
-  {"XAA", "IMMEDIATE"},  
-  {"STY", "ABSOLUTE"},  
-  {"STA", "ABSOLUTE"},  
-  {"STX", "ABSOLUTE"},  
-  {"SAX", "ABSOLUTE"},  
-  {"BCC", "RELATIVE"},  
-  {"STA", "(INDIRECT, Y)"},  
-  {"JAM", "IMPLIED"},  
-  {"AHX", "(INDIRECT, Y)"},  
-  {"STY", "ZEROPAGE"},  
-  {"STA", "ZEROPAGE"},  
-  {"STX", "ZEROPAGE"},  
-  {"SAX", "ZEROPAGE Y"},  
-  {"TYA", "IMPLIED"},  
-  {"STA", "ABSOLUTE Y"},  
-  {"TXS", "IMPLIED"},  
-  {"TAS", "ABSOLUTE Y"},  
-  {"SHY", "ABSOLUTE X"}, 
-  {"STA", "ABSOLUTE X"},  
-  {"SHX", "ABSOLUTE Y"},  
-  {"AHX", "ABSOLUTE Y"},   
-  {"LDY", "IMMEDIATE"},  
-  {"LDA", "(INDIRECT, X)"},  
-  {"LDX", "IMMEDIATE"}, 
-  {"LAX", "(INDIRECT, X)"},  
-  {"LDY", "ZEROPAGE"}, 
-  {"LDA", "ZEROPAGE"},  
-  {"LDX", "ZEROPAGE"},  
-  {"LAX", "ZEROPAGE"},  
-  {"TAY", "IMPLIED"},  
-  {"LDA", "IMMEDIATE"},  
-  {"TAX", "IMPLIED"},  
-  {"LAX", "IMMEDIATE"},  
-  {"LDY", "ABSOLUTE"},  
-  {"LDA", "ABSOLUTE"},  
-  {"LDX", "ABSOLUTE"},  
-  {"LAX", "ABSOLUTE"},  
-  {"BCS", "RELATIVE"}, 
-  {"LDA", "(INDIRECT, Y)"},  
-  {"JAM", "IMPLIED"}, 
-  {"LAX", "(INDIRECT, Y)"},  
-  {"LDY", "ZEROPAGE X"}, 
-  {"LDA", "ZEROPAGE X"}, 
-  {"LDX", "ZEROPAGE Y"}, 
-  {"LAX", "ZEROPAGE Y"}, 
-  {"CLV", "IMPLIED"}, 
-  {"LDA", "ABSOLUTE Y"}, 
-  {"TSX", "IMPLIED"},  
-  {"LAS", "ABSOLUTE Y"},  
-  {"LDY", "ABSOLUTE X"},  
-  {"LDA", "ABSOLUTE X"},  
-  {"LDX", "ABSOLUTE Y"},  
-  {"LAX", "ABSOLUTE Y"},   
-  {"CPY", "IMMEDIATE"},  
-  {"CMP", "(INDIRECT, X)"},  
-  {"NOP", "IMMEDIATE"}, 
-  {"DCP", "(INDIRECT, X)"},  
-  {"CPY", "ZEROPAGE"}, 
-  {"CMP", "ZEROPAGE"}, 
-  {"DEC", "ZEROPAGE"}, 
-  {"DCP", "ZEROPAGE"}, 
-  {"INY", "IMPLIED"}, 
-  {"CMP", "IMMEDIATE"}, 
-  {"DEX", "IMPLIED"},
-  {"AXS", "IMMEDIATE"}, 
-  {"CPY", "ABSOLUTE"}, 
-  {"CMP", "ABSOLUTE"}, 
-  {"DEC", "ABSOLUTE"}, 
-  {"DCP", "ABSOLUTE X"}, 
-  {"BNE", "RELATIVE"}, 
-  {"CMP", "(INDIRECT, Y)"}, 
-  {"JAM", "IMPLIED"}, 
-  {"DCP", "(INDIRECT, Y)"}, 
-  {"NOP", "ZEROPAGE X"}, 
-  {"CMP", "ZEROPAGE X"}, 
-  {"DEC", "ZEROPAGE X"}, 
-  {"DCP", "ZEROPAGE X"}, 
-  {"CLD", "IMPLIED"}, 
-  {"CMP", "ABSOLUTE Y"}, 
-  {"NOP", "IMPLIED"}, 
-  {"DCP", "ABSOLUTE Y"}, 
-  {"NOP", "ABSOLUTE X"}, 
-  {"CMP", "ABSOLUTE X"}, 
-  {"DEC", "ABSOLUTE X"}, 
-  {"DCP", "ABSOLUTE X"},  
-  {"CPX", "IMMEDIATE"}, 
-  {"SBC", "(INDIRECT, X)"}, 
-  {"NOP", "IMMEDIATE"}, 
-  {"ISC", "(INDIRECT, X)"}, 
-  {"CPX", "ZEROPAGE"}, 
-  {"SBC", "ZEROPAGE"}, 
-  {"INC", "ZEROPAGE"}, 
-  {"ISC", "ZEROPAGE"}, 
-  {"INX", "IMPLIED"}, 
-  {"SBC", "IMMEDIATE"}, 
-  {"NOP", "IMPLIED"}, 
-  {"SBC", "IMMEDIATE"}, 
-  {"CPX", "ABSOLUTE"}, 
-  {"SBC", "ABSOLUTE"},  
-  {"INC", "ABSOLUTE"}, 
-  {"ISC", "ABSOLUTE"}, 
-  {"BEQ", "RELATIVE"}, 
-  {"SBC", "(INDIRECT, Y)"}, 
-  {"JAM", "IMPLIED"}, 
-  {"ISC", "(INDIRECT, Y)"}, 
-  {"NOP", "ZEROPAGE X"}, 
-  {"SBC", "ZEROPAGE X"}, 
-  {"INC", "ZEROPAGE X"}, 
-  {"ISC", "ZEROPAGE X"}, 
-  {"SED", "IMPLIED"}, 
-  {"SBC", "ABSOLUTE Y"}, 
-  {"NOP", "IMPLIED"}, 
-  {"ISC", "ABSOLUTE Y"}, 
-  {"NOP", "ABSOLUTE X"}, 
-  {"SBC", "ABSOLUTE X"}, 
-  {"INC", "ABSOLUTE X"}, 
-  {"ISC", "ABSOLUTE X"},  
+  OPCODE_TABLE(DEBUG_OUTPUT)
 };
+#undef DEBUG_OUTPUT
 
 
 void
@@ -269,38 +34,68 @@ cpu_debug(MOS_6510* const c)
   uint8_t opcode = rb(c, c->pc);
 
   char flags[] = "........";
+  const uint8_t p = get_flags(c);
 
-  if(c->nf) flags[0] = 'N';
-  if(c->vf) flags[1] = 'V';
+  if(p & 0x80) flags[0] = 'N';
+  if(p & 0x40) flags[1] = 'V';
   flags[2] = 'U'; // Must always be one
-  if(c->bf) flags[3] = 'B';
-  if(c->df) flags[4] = 'D';
-  if(c->idf) flags[5] = 'I';
-  if(c->zf) flags[6] = 'Z';
-  if(c->cf) flags[7] = 'C';
+  if(p & 0x10) flags[3] = 'B';
+  if(p & 0x08) flags[4] = 'D';
+  if(p & 0x04) flags[5] = 'I';
+  if(p & 0x02) flags[6] = 'Z';
+  if(p & 0x01) flags[7] = 'C';
 
-  /* INSTRUCTIONS, ADDRESSING MODES AND REGISTERS */
+  /* INSTRUCTION AND REGISTERS */
 
-/*  
-  printf("[0x%04X] [%02X] %s, [%s]\t", c->pc, rb(c, c->pc), debug_output[opcode].mnemonics, debug_output[opcode].address_mode);
+  char text[DISASM_TEXT];
+  disassemble_at(text, c, c->pc, c->x, c->y);
 
-  printf("A: %02X X: %02X Y: %02X SP: %02X P: %02X [%s] CYC: %llu\n", 
+  printf("[$%04X] [%02X] %-20s A: %02X X: %02X Y: %02X SP: %02X P: %02X [%s] CYC: %" PRIu64 "\n",
+      c->pc,
+      opcode,
+      text,
       c->a,
       c->x,
       c->y,
       c->sp,
-      get_flags(c),
+      p,
       flags,
       c->cyc);
-*/
-  printf("[%d] [%d] %s, [%s]\t", c->pc, rb(c, c->pc), debug_output[opcode].mnemonics, debug_output[opcode].address_mode);
+}
 
-  printf("A: %d X: %d Y: %d SP: %d P: %d [%s] CYC: %llu\n", 
-      c->a,
-      c->x,
-      c->y,
-      c->sp,
-      get_flags(c),
-      flags,
-      c->cyc);
+#ifdef OPCODE_STATS
+
+/* Counters of every opcode that ran, the most expensive one in cycles first */
+
+void
+opcode_stats_dump(const MOS_6510* const c, FILE* out)
+{
+  const struct opcode_stats* const s = c->opcode_stats;
+  uint8_t order[256];
+  uint16_t n = 0;
+  uint64_t total = 0;
+
+  for(uint16_t op = 0; op < 256; op++)
+  {
+    if(s[op].executed == 0) continue;
+
+    uint16_t i = n++;
+    for(; i > 0 && s[order[i - 1]].cycles < s[op].cycles; i--) order[i] = order[i - 1];
+    order[i] = op;
+
+    total += s[op].cycles;
+  }
+
+  fprintf(out, "OP   MNEMONIC  MODE                      EXECUTED            CYCLES       %%     CROSSED\n");
+
+  for(uint16_t i = 0; i < n; i++)
+  {
+    const uint8_t op = order[i];
+
+    fprintf(out, "$%02X  %-8s  %-14s  %18" PRIu64 "  %16" PRIu64 "  %5.1f  %10" PRIu64 "\n",
+        op, debug_output[op].mnemonics, debug_output[op].address_mode,
+        s[op].executed, s[op].cycles, 100.0 * s[op].cycles / total, s[op].crossed);
+  }
 }
+
+#endif // OPCODE_STATS
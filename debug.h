@@ -10,10 +10,16 @@
 #include <stdint.h>
 
 struct debug {
-  char *mnemonics;
-  char *address_mode;
+  const char *mnemonics;
+  const char *address_mode;
 };
 
+extern const struct debug debug_output[256];
+
 void cpu_debug(MOS_6510* const c);
 
+#ifdef OPCODE_STATS
+void opcode_stats_dump(const MOS_6510* const c, FILE* out);
+#endif
+
 #endif // _CPU_DEBUG
@@ -0,0 +1,220 @@
+#include <string.h>
+
+#include "cpu.h"
+#include "bus.h"
+#include "disasm.h"
+#include "opcodes.h"
+
+/* What stands between the prefix and the suffix of an addressing mode */
+
+enum OPERAND {
+  NO_OPERAND,
+  OPERAND_BYTE,
+  OPERAND_WORD,
+  BRANCH_TARGET, // Offset byte, shown as the address it branches to
+};
+
+#define PREFIX_IMPLIED ""
+#define PREFIX_ACCUMULATOR " A"
+#define PREFIX_RELATIVE " $"
+#define PREFIX_IMMEDIATE " #$"
+#define PREFIX_ZEROPAGE " $"
+#define PREFIX_ZEROPAGE_X " $"
+#define PREFIX_ZEROPAGE_Y " $"
+#define PREFIX_ABSOLUTE " $"
+#define PREFIX_ABSOLUTE_X " $"
+#define PREFIX_ABSOLUTE_Y " $"
+#define PREFIX_INDIRECT " ($"
+#define PREFIX_INDIRECT_X " ($"
+#define PREFIX_INDIRECT_Y " ($"
+
+#define SUFFIX_IMPLIED ""
+#define SUFFIX_ACCUMULATOR ""
+#define SUFFIX_RELATIVE ""
+#define SUFFIX_IMMEDIATE ""
+#define SUFFIX_ZEROPAGE ""
+#define SUFFIX_ZEROPAGE_X ",X"
+#define SUFFIX_ZEROPAGE_Y ",Y"
+#define SUFFIX_ABSOLUTE ""
+#define SUFFIX_ABSOLUTE_X ",X"
+#define SUFFIX_ABSOLUTE_Y ",Y"
+#define SUFFIX_INDIRECT ")"
+#define SUFFIX_INDIRECT_X ",X)"
+#define SUFFIX_INDIRECT_Y "),Y"
+
+#define OPERAND_IMPLIED NO_OPERAND
+#define OPERAND_ACCUMULATOR NO_OPERAND
+#define OPERAND_RELATIVE BRANCH_TARGET
+#define OPERAND_IMMEDIATE OPERAND_BYTE
+#define OPERAND_ZEROPAGE OPERAND_BYTE
+#define OPERAND_ZEROPAGE_X OPERAND_BYTE
+#define OPERAND_ZEROPAGE_Y OPERAND_BYTE
+#define OPERAND_ABSOLUTE OPERAND_WORD
+#define OPERAND_ABSOLUTE_X OPERAND_WORD
+#define OPERAND_ABSOLUTE_Y OPERAND_WORD
+#define OPERAND_INDIRECT OPERAND_WORD
+#define OPERAND_INDIRECT_X OPERAND_BYTE
+#define OPERAND_INDIRECT_Y OPERAND_BYTE
+
+/*
+ * Everything but the operand, mnemonic and prefix already joined ("LDA ($").
+ * Both parts are padded so they are always copied whole, 16 bytes per opcode.
+ */
+
+struct text
+{
+  char head[8];
+  char tail[4];
+  uint8_t head_length;
+  uint8_t tail_length;
+  uint8_t operand;
+  uint8_t mode;
+};
+
+#define TEXT(op, mnemonic, func, cycle, mode, crossed)                    \
+  { #mnemonic PREFIX_##mode, SUFFIX_##mode, sizeof(#mnemonic PREFIX_##mode) - 1, \
+    sizeof(SUFFIX_##mode) - 1, OPERAND_##mode, mode },
+static const struct text texts[256] =
+{
+  OPCODE_TABLE(TEXT)
+};
+#undef TEXT
+
+static const char hex[] = "0123456789ABCDEF";
+
+static inline char*
+put_byte(char* p, uint8_t value)
+{
+  p[0] = hex[value >> 4];
+  p[1] = hex[value & 0xF];
+  return p + 2;
+}
+
+static inline char*
+put_word(char* p, uint16_t value)
+{
+  return put_byte(put_byte(p, value >> 8), value & 0xFF);
+}
+
+/* Without the terminator, returns the end of the text */
+
+static inline char*
+format(char* p, uint16_t pc, const uint8_t* bytes)
+{
+  const struct text* const t = &texts[bytes[0]];
+
+  memcpy(p, t->head, 8);
+  p += t->head_length;
+
+  switch (t->operand) {
+    case OPERAND_BYTE:
+      p = put_byte(p, bytes[1]);
+      break;
+
+    case OPERAND_WORD:
+      p = put_word(p, bytes[2] << 8 | bytes[1]);
+      break;
+
+    case BRANCH_TARGET:
+      p = put_word(p, pc + 2 + (int8_t)bytes[1]);
+      break;
+  }
+
+  memcpy(p, t->tail, 4);
+  return p + t->tail_length;
+}
+
+uint8_t
+disassemble(char* out, uint16_t pc, const uint8_t* bytes)
+{
+  char* const end = format(out, pc, bytes);
+
+  *end = '\0';
+  return end - out;
+}
+
+/* Pointers are read as the CPU reads them, see rw() */
+
+static int32_t
+peek_word(const MOS_6510* const c, uint16_t addr)
+{
+  const int lo = bus_peek(c, addr);
+  const int hi = bus_peek(c, addr + 1);
+
+  return lo < 0 || hi < 0 ? -1 : hi << 8 | lo;
+}
+
+/* Address the instruction accesses, -1 if its operand already says so or a pointer can't be read */
+
+static int32_t
+accessed(const MOS_6510* const c, uint8_t mode, uint16_t operand, uint8_t x, uint8_t y)
+{
+  int32_t pointer;
+
+  switch (mode) {
+    case ZEROPAGE_X:
+      return (operand + x) & 0xFF;
+
+    case ZEROPAGE_Y:
+      return (operand + y) & 0xFF;
+
+    case ABSOLUTE_X:
+      return (uint16_t)(operand + x);
+
+    case ABSOLUTE_Y:
+      return (uint16_t)(operand + y);
+
+    case INDIRECT:
+      return peek_word(c, operand);
+
+    case INDIRECT_X:
+      return peek_word(c, (operand + x) & 0xFF);
+
+    case INDIRECT_Y:
+      pointer = peek_word(c, operand);
+      return pointer < 0 ? -1 : (uint16_t)(pointer + y);
+
+    default:
+      return -1;
+  }
+}
+
+uint8_t
+disassemble_at(char* out, const MOS_6510* const c, uint16_t pc, uint8_t x, uint8_t y)
+{
+  const int opcode = bus_peek(c, pc);
+  uint8_t bytes[3] = { opcode, 0, 0 };
+
+  if(opcode < 0)
+  {
+    memcpy(out, "???", 4);
+    return 3;
+  }
+
+  const uint8_t mode = texts[opcode].mode;
+  const uint8_t length = instruction_length(mode);
+
+  for(uint8_t i = 1; i < length; i++)
+  {
+    const int byte = bus_peek(c, pc + i);
+
+    if(byte < 0)
+    {
+      memcpy(out, "???", 4);
+      return 3;
+    }
+    bytes[i] = byte;
+  }
+
+  char* end = format(out, pc, bytes);
+  const int32_t addr = accessed(c, mode, bytes[2] << 8 | bytes[1], x, y);
+
+  if(addr >= 0)
+  {
+    memcpy(end, " ; $", 4);
+    end = put_word(end + 4, addr);
+  }
+
+  *end = '\0';
+  return end - out;
+}
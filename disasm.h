@@ -0,0 +1,30 @@
+#ifndef _6510_DISASM
+#define _6510_DISASM
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+/*
+ * Disassembler producing assembler syntax ("LDA ($12),Y", "BNE $C0DE")
+ * into a buffer of the caller, at least DISASM_TEXT bytes. Every opcode is
+ * one table entry, the text is put together from fixed pieces and a hex
+ * digit table, no printf and no allocation, so whole images and trace
+ * streams can be formatted as fast as they are read. Both functions
+ * return the length of the text, which is NUL terminated.
+ */
+
+#define DISASM_TEXT 24 // "LDA ($12),Y ; $1234" and the terminator, with room to spare
+
+/* Instruction at `pc` from its bytes, instruction_length() of them are read, branch targets are resolved */
+uint8_t disassemble(char* out, uint16_t pc, const uint8_t* bytes);
+
+/*
+ * Instruction at `pc` as it is in memory, followed by the address it
+ * accesses with these index registers for the indexed and indirect modes:
+ * "LDA ($12),Y ; $1234". Reads go through bus_peek(), so I/O is left alone
+ * and what only a page handler knows is shown as "???" or left out.
+ */
+uint8_t disassemble_at(char* out, const MOS_6510* const c, uint16_t pc, uint8_t x, uint8_t y);
+
+#endif // _6510_DISASM
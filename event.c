@@ -0,0 +1,138 @@
+#include <stdint.h>
+
+#include "cpu.h"
+#include "event.h"
+
+/* Sequence numbers are compared modulo 2^32, so they may wrap */
+
+static bool
+earlier(const struct event* const a, const struct event* const b)
+{
+  return a->cycle < b->cycle || (a->cycle == b->cycle && (int32_t)(a->sequence - b->sequence) < 0);
+}
+
+static void
+swap(struct event* const a, struct event* const b)
+{
+  const struct event t = *a;
+  *a = *b;
+  *b = t;
+}
+
+static void
+sift_up(struct events* const q, uint8_t i)
+{
+  while(i && earlier(&q->heap[i], &q->heap[(i - 1) / 2]))
+  {
+    swap(&q->heap[i], &q->heap[(i - 1) / 2]);
+    i = (i - 1) / 2;
+  }
+}
+
+static void
+sift_down(struct events* const q, uint8_t i)
+{
+  while(true)
+  {
+    const uint8_t left = 2 * i + 1;
+    const uint8_t right = left + 1;
+    uint8_t first = i;
+
+    if(left < q->count && earlier(&q->heap[left], &q->heap[first])) first = left;
+    if(right < q->count && earlier(&q->heap[right], &q->heap[first])) first = right;
+    if(first == i) return;
+
+    swap(&q->heap[i], &q->heap[first]);
+    i = first;
+  }
+}
+
+static void
+pop(struct events* const q)
+{
+  q->heap[0] = q->heap[--q->count];
+  sift_down(q, 0);
+
+  q->next = q->count ? q->heap[0].cycle : UINT64_MAX;
+}
+
+/* Drops all pending events, initialise() does so as it resets c->cyc */
+
+void
+events_clear(MOS_6510* const c)
+{
+  c->events.count = 0;
+  c->events.next = UINT64_MAX;
+}
+
+/* Runs handler(c, data, cycle) once c->cyc has reached `cycle`, false if the queue is full */
+
+bool
+event_schedule(MOS_6510* const c, uint64_t cycle, event_handler handler, void* data)
+{
+  struct events* const q = &c->events;
+
+  if(q->count == EVENT_QUEUE) return false;
+
+  q->heap[q->count] = (struct event){ cycle, q->sequence++, handler, data };
+  sift_up(q, q->count++);
+
+  q->next = q->heap[0].cycle;
+  return true;
+}
+
+static void
+raise_lines(MOS_6510* const c, void* data, uint64_t cycle)
+{
+  (void) cycle;
+  c->irq_status |= (uintptr_t) data;
+}
+
+/* Sets `lines` (IRQ_LINE, NMI_LINE) in c->irq_status at `cycle` */
+
+bool
+event_raise(MOS_6510* const c, uint64_t cycle, uint8_t lines)
+{
+  return event_schedule(c, cycle, raise_lines, (void*)(uintptr_t) lines);
+}
+
+/* Removes the pending events with this handler and data, returns how many there were */
+
+uint8_t
+event_cancel(MOS_6510* const c, event_handler handler, void* data)
+{
+  struct events* const q = &c->events;
+  uint8_t kept = 0;
+
+  for(uint8_t i = 0; i < q->count; i++)
+  {
+    if(q->heap[i].handler != handler || q->heap[i].data != data) q->heap[kept++] = q->heap[i];
+  }
+
+  const uint8_t removed = q->count - kept;
+
+  q->count = kept;
+  for(uint8_t i = kept / 2; i-- > 0; ) sift_down(q, i);
+
+  q->next = q->count ? q->heap[0].cycle : UINT64_MAX;
+  return removed;
+}
+
+/* Runs every event that is due, handlers may schedule further ones */
+
+void
+events_run(MOS_6510* const c)
+{
+  struct events* const q = &c->events;
+
+  c->loop.head = -1; // Handlers may change what an idle loop reads, see idle_loop() in cpu.c
+  c->busy_loop = -1;
+
+  while(q->count && q->heap[0].cycle <= c->cyc)
+  {
+    const struct event e = q->heap[0];
+
+    pop(q);
+    e.handler(c, e.data, e.cycle);
+  }
+}
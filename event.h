@@ -0,0 +1,51 @@
+#ifndef _6510_EVENT
+#define _6510_EVENT
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Event queue keyed on c->cyc, for devices that act at a given cycle
+ * instead of being polled after every instruction: timers, raster
+ * interrupts, ... An event runs at the first instruction boundary where
+ * c->cyc has reached its cycle, so an interrupt line it raises is serviced
+ * right there, just as if the host had raised it after that instruction.
+ * The cycle engine (make CORE=cycle) runs it in front of the first bus
+ * access made from that cycle on instead. The other cores only run events
+ * inside run_cycles(), between them the run loops just compare c->cyc with
+ * the cycle of the next one.
+ */
+
+struct MOS_6510;
+
+/* `cycle` is the one the event was scheduled for, periodic sources add their period to it */
+typedef void (*event_handler)(struct MOS_6510* const c, void* data, uint64_t cycle);
+
+#define EVENT_QUEUE 32 // Pending events at most
+
+struct event
+{
+  uint64_t cycle;
+  uint32_t sequence; // Events for the same cycle run in the order they were scheduled
+  event_handler handler;
+  void* data;
+};
+
+/* Binary min-heap on (cycle, sequence) */
+
+struct events
+{
+  struct event heap[EVENT_QUEUE];
+  uint8_t count;
+  uint32_t sequence;
+  uint64_t next; // Cycle of heap[0], UINT64_MAX while empty
+};
+
+void events_clear(struct MOS_6510* const c);
+bool event_schedule(struct MOS_6510* const c, uint64_t cycle, event_handler handler, void* data);
+bool event_raise(struct MOS_6510* const c, uint64_t cycle, uint8_t lines);
+uint8_t event_cancel(struct MOS_6510* const c, event_handler handler, void* data);
+
+void events_run(struct MOS_6510* const c);
+
+#endif // _6510_EVENT
@@ -0,0 +1,979 @@
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "cpu.h"
+#include "bus.h"
+#include "jit.h"
+#include "trace.h"
+
+#ifdef JIT_CORE
+
+/*
+ * x86-64 translator for hot blocks of the block engine.
+ *
+ * A translated block keeps the 6510 registers in host registers from entry
+ * to exit: A in r8d, X in r9d, Y in r10d, SP in r11d (all kept within
+ * 0-255), the lazy N/Z word in esi and the carry in edx. rdi holds the CPU
+ * and eax/ecx are scratch. Instructions are translated when their operand is
+ * in plain memory at a fixed address, in the zero page or on the stack; the
+ * first one that is not (or anything touching I/O) ends the translation, and
+ * the rest of the block is left to the interpreter. ADC/SBC in decimal mode
+ * and a JSR that would wrap the stack leave the block in front of themselves
+ * at run time. Every exit writes the registers, PC and the exact cycle count
+ * up to that point back to c.
+ */
+
+enum
+{
+  RAX = 0, RCX = 1, RDX = 2, RSI = 6, RDI = 7,
+  R8 = 8, R9 = 9, R10 = 10, R11 = 11,
+};
+
+#define REG_A R8
+#define REG_X R9
+#define REG_Y R10
+#define REG_SP R11
+#define REG_ZN RSI
+#define REG_CF RDX
+
+/* Condition codes */
+#define CC_AE 0x3
+#define CC_E 0x4
+#define CC_NE 0x5
+
+struct emitter
+{
+  uint8_t* p;
+  uint8_t* end;
+  bool full;
+  uint8_t retired; // Instructions completed when an exit emitted now is taken
+};
+
+static void
+emit(struct emitter* const e, uint8_t byte)
+{
+  if(e->p < e->end) *e->p++ = byte;
+  else e->full = true;
+}
+
+static void
+emit32(struct emitter* const e, uint32_t value)
+{
+  for(int i = 0; i < 4; i++) emit(e, value >> (i * 8));
+}
+
+static void
+emit64(struct emitter* const e, uint64_t value)
+{
+  for(int i = 0; i < 8; i++) emit(e, value >> (i * 8));
+}
+
+/* REX prefix, `byte_regs` forces one so that 4-7 mean spl-dil instead of ah-bh */
+
+static void
+rex(struct emitter* const e, bool w, int reg, int rm, bool byte_regs)
+{
+  const uint8_t prefix = 0x40 | w << 3 | (reg >> 3) << 2 | (rm >> 3);
+
+  if(prefix != 0x40 || (byte_regs && (reg >= 4 || rm >= 4))) emit(e, prefix);
+}
+
+static void
+modrm(struct emitter* const e, int mod, int reg, int rm)
+{
+  emit(e, mod << 6 | (reg & 7) << 3 | (rm & 7));
+}
+
+/* op r/m32, r32 (mov 0x89, add 0x01, or 0x09, and 0x21, sub 0x29, xor 0x31, cmp 0x39) */
+
+static void
+op_rr(struct emitter* const e, uint8_t opcode, int dst, int src)
+{
+  rex(e, false, src, dst, false);
+  emit(e, opcode);
+  modrm(e, 3, src, dst);
+}
+
+/* op r/m32, imm32 (add 0, or 1, and 4, sub 5, xor 6, cmp 7) */
+
+static void
+op_ri(struct emitter* const e, int ext, int dst, uint32_t imm)
+{
+  rex(e, false, 0, dst, false);
+  emit(e, 0x81);
+  modrm(e, 3, ext, dst);
+  emit32(e, imm);
+}
+
+/* shl 4, shr 5 */
+
+static void
+shift_ri(struct emitter* const e, int ext, int dst, uint8_t imm)
+{
+  rex(e, false, 0, dst, false);
+  emit(e, 0xC1);
+  modrm(e, 3, ext, dst);
+  emit(e, imm);
+}
+
+static void
+mov_ri(struct emitter* const e, int dst, uint32_t imm)
+{
+  rex(e, false, 0, dst, false);
+  emit(e, 0xB8 + (dst & 7));
+  emit32(e, imm);
+}
+
+static void
+test_ri(struct emitter* const e, int dst, uint32_t imm)
+{
+  rex(e, false, 0, dst, false);
+  emit(e, 0xF7);
+  modrm(e, 3, 0, dst);
+  emit32(e, imm);
+}
+
+static void
+setcc(struct emitter* const e, uint8_t cc, int dst)
+{
+  rex(e, false, 0, dst, true);
+  emit(e, 0x0F);
+  emit(e, 0x90 + cc);
+  modrm(e, 3, 0, dst);
+}
+
+/* movzx r32, byte/word [rdi + disp] */
+
+static void
+load_field(struct emitter* const e, int dst, size_t disp, bool word)
+{
+  rex(e, false, dst, RDI, false);
+  emit(e, 0x0F);
+  emit(e, word ? 0xB7 : 0xB6);
+  modrm(e, 2, dst, RDI);
+  emit32(e, disp);
+}
+
+/* mov byte/word [rdi + disp], r */
+
+static void
+store_field(struct emitter* const e, size_t disp, int src, bool word)
+{
+  if(word) emit(e, 0x66);
+  rex(e, false, src, RDI, !word);
+  emit(e, word ? 0x89 : 0x88);
+  modrm(e, 2, src, RDI);
+  emit32(e, disp);
+}
+
+/* mov byte [rdi + disp], imm8 */
+
+static void
+set_field(struct emitter* const e, size_t disp, uint8_t imm)
+{
+  emit(e, 0xC6);
+  modrm(e, 2, 0, RDI);
+  emit32(e, disp);
+  emit(e, imm);
+}
+
+/* test byte [rdi + disp], imm8 */
+
+static void
+test_field(struct emitter* const e, size_t disp, uint8_t imm)
+{
+  emit(e, 0xF6);
+  modrm(e, 2, 0, RDI);
+  emit32(e, disp);
+  emit(e, imm);
+}
+
+/* xor r8, byte [rdi + disp] */
+
+static void
+xor_field(struct emitter* const e, int dst, size_t disp)
+{
+  rex(e, false, dst, RDI, true);
+  emit(e, 0x32);
+  modrm(e, 2, dst, RDI);
+  emit32(e, disp);
+}
+
+/* mov rax, imm64 */
+
+static void
+mov_rax_ptr(struct emitter* const e, const void* ptr)
+{
+  emit(e, 0x48);
+  emit(e, 0xB8);
+  emit64(e, (uint64_t)(uintptr_t)ptr);
+}
+
+/* add rax, r64 */
+
+static void
+add_rax(struct emitter* const e, int src)
+{
+  rex(e, true, src, RAX, false);
+  emit(e, 0x01);
+  modrm(e, 3, src, RAX);
+}
+
+/* movzx r32, byte [rax] */
+
+static void
+load_rax(struct emitter* const e, int dst)
+{
+  rex(e, false, dst, RAX, false);
+  emit(e, 0x0F);
+  emit(e, 0xB6);
+  modrm(e, 0, dst, RAX);
+}
+
+/* mov byte [rax], r8 */
+
+static void
+store_rax(struct emitter* const e, int src)
+{
+  rex(e, false, src, RAX, true);
+  emit(e, 0x88);
+  modrm(e, 0, src, RAX);
+}
+
+/* jcc rel32 / jmp rel32, returns where the displacement goes for patch() */
+
+static uint8_t*
+jump(struct emitter* const e, int cc)
+{
+  if(cc < 0)
+  {
+    emit(e, 0xE9);
+  }
+  else
+  {
+    emit(e, 0x0F);
+    emit(e, 0x80 + cc);
+  }
+
+  uint8_t* const at = e->p;
+  emit32(e, 0);
+  return at;
+}
+
+static void
+patch(struct emitter* const e, uint8_t* const at)
+{
+  if(e->full) return;
+
+  const int32_t rel = e->p - (at + 4);
+  for(int i = 0; i < 4; i++) at[i] = (uint32_t)rel >> (i * 8);
+}
+
+/* zn = v << 8 | v, like set_zn() */
+
+static void
+set_zn(struct emitter* const e, int src)
+{
+  op_rr(e, 0x89, REG_ZN, src);
+  shift_ri(e, 4, REG_ZN, 8);
+  op_rr(e, 0x09, REG_ZN, src);
+}
+
+static void
+prologue(struct emitter* const e)
+{
+  load_field(e, REG_A, offsetof(MOS_6510, a), false);
+  load_field(e, REG_X, offsetof(MOS_6510, x), false);
+  load_field(e, REG_Y, offsetof(MOS_6510, y), false);
+  load_field(e, REG_SP, offsetof(MOS_6510, sp), false);
+  load_field(e, REG_ZN, offsetof(MOS_6510, zn), true);
+  load_field(e, REG_CF, offsetof(MOS_6510, cf), false);
+}
+
+static void
+store_registers(struct emitter* const e)
+{
+  store_field(e, offsetof(MOS_6510, a), REG_A, false);
+  store_field(e, offsetof(MOS_6510, x), REG_X, false);
+  store_field(e, offsetof(MOS_6510, y), REG_Y, false);
+  store_field(e, offsetof(MOS_6510, sp), REG_SP, false);
+  store_field(e, offsetof(MOS_6510, zn), REG_ZN, true);
+  store_field(e, offsetof(MOS_6510, cf), REG_CF, false);
+}
+
+/* Everything after the registers and PC are back in c */
+
+static void
+leave(struct emitter* const e, uint32_t cycles, uint32_t result)
+{
+  /* add qword [rdi + cyc], imm32 */
+  emit(e, 0x48);
+  emit(e, 0x81);
+  modrm(e, 2, 0, RDI);
+  emit32(e, offsetof(MOS_6510, cyc));
+  emit32(e, cycles);
+
+  /* add qword [rdi + instructions], imm32 */
+  emit(e, 0x48);
+  emit(e, 0x81);
+  modrm(e, 2, 0, RDI);
+  emit32(e, offsetof(MOS_6510, instructions));
+  emit32(e, e->retired);
+
+  mov_ri(e, RAX, result);
+  emit(e, 0xC3);
+}
+
+static void
+exit_block(struct emitter* const e, uint16_t pc, uint32_t cycles, uint32_t result)
+{
+  store_registers(e);
+
+  /* mov word [rdi + pc], imm16 */
+  emit(e, 0x66);
+  emit(e, 0xC7);
+  modrm(e, 2, 0, RDI);
+  emit32(e, offsetof(MOS_6510, pc));
+  emit(e, pc & 0xFF);
+  emit(e, pc >> 8);
+
+  leave(e, cycles, result);
+}
+
+/* Leaves in front of the instruction unless the last test matched `cc`, for the interpreter to run it */
+
+static void
+fall_back_unless(struct emitter* const e, const struct block_record* const r, uint32_t cycles, int cc)
+{
+  uint8_t* const skip = jump(e, cc);
+
+  e->retired--;
+  exit_block(e, r->next - instruction_length(opcodes[r->opcode].address_mode), cycles - r->cycles, JIT_STEP);
+  e->retired++;
+  patch(e, skip);
+}
+
+/* Host address of a plain memory byte, NULL if it is behind a handler */
+
+static const uint8_t*
+host_read(MOS_6510* const c, uint16_t addr)
+{
+  if(addr < 0x200) return c->low + addr;
+
+  const uint8_t* const page = c->bus->pages[addr >> 8].read;
+  return page ? page + (addr & 0xFF) : NULL;
+}
+
+static uint8_t*
+host_write(MOS_6510* const c, uint16_t addr)
+{
+  if(addr < 0x200) return c->low + addr;
+
+  uint8_t* const page = c->bus->pages[addr >> 8].write;
+  return page ? page + (addr & 0xFF) : NULL;
+}
+
+/* After a store above the stack, mark the page for snapshots as wb() would */
+
+static void
+mark_written(struct emitter* const e, uint16_t addr)
+{
+  const uint8_t page = addr >> 8;
+
+  if(addr < 0x200) return;
+
+  /* or byte [rdi + written_pages + page / 8], bit */
+  emit(e, 0x80);
+  modrm(e, 2, 1, RDI);
+  emit32(e, offsetof(MOS_6510, written_pages) + (page >> 3));
+  emit(e, 1 << (page & 7));
+}
+
+/* After a store, leave the block if the page holds cached code, as wb() would drop it */
+
+static void
+check_code_write(struct emitter* const e, uint16_t addr, uint16_t next, uint32_t cycles)
+{
+  const uint8_t page = addr >> 8;
+
+  test_field(e, offsetof(MOS_6510, code_pages) + (page >> 3), 1 << (page & 7));
+
+  uint8_t* const clean = jump(e, CC_E);
+  exit_block(e, next, cycles, 0x100 | page);
+  patch(e, clean);
+}
+
+/* rax = host address of a zero page,X/Y operand, which wraps within the zero page */
+
+static void
+zeropage_indexed(MOS_6510* const c, struct emitter* const e, enum ADDR_MODE mode, uint16_t operand)
+{
+  mov_ri(e, RCX, operand);
+  op_rr(e, 0x01, RCX, mode == ZEROPAGE_X ? REG_X : REG_Y);
+  op_ri(e, 4, RCX, 0xFF);
+  mov_rax_ptr(e, c->low);
+  add_rax(e, RCX);
+}
+
+/* rax = host address of the stack byte at 0x100 + SP + offset */
+
+static void
+stack_address(MOS_6510* const c, struct emitter* const e, int offset)
+{
+  mov_rax_ptr(e, c->low + 0x100 + offset);
+  add_rax(e, REG_SP);
+}
+
+/* SP += delta, within 0-255 */
+
+static void
+move_sp(struct emitter* const e, int delta)
+{
+  op_ri(e, 0, REG_SP, (uint32_t)delta);
+  op_ri(e, 4, REG_SP, 0xFF);
+}
+
+static bool
+indexed(enum ADDR_MODE mode)
+{
+  return mode == ZEROPAGE_X || mode == ZEROPAGE_Y;
+}
+
+/* Source operand into eax, false if it isn't in plain memory */
+
+static bool
+load_operand(MOS_6510* const c, struct emitter* const e, enum ADDR_MODE mode, uint16_t operand)
+{
+  if(indexed(mode))
+  {
+    zeropage_indexed(c, e, mode, operand);
+    load_rax(e, RAX);
+    return true;
+  }
+
+  const uint8_t* const host = host_read(c, operand);
+  if(host == NULL) return false;
+
+  if(mode == IMMEDIATE)
+  {
+    mov_ri(e, RAX, *host); // Code bytes can't change under a live block
+  }
+  else
+  {
+    mov_rax_ptr(e, host);
+    load_rax(e, RAX);
+  }
+  return true;
+}
+
+static int
+load_register(uint8_t opcode)
+{
+  switch (opcode) {
+    case 0xA2: case 0xA6: case 0xB6: case 0xAE: return REG_X;
+    case 0xA0: case 0xA4: case 0xB4: case 0xAC: return REG_Y;
+    default: return REG_A;
+  }
+}
+
+/* Emits one instruction, false if it can't be translated */
+
+static bool
+translate(MOS_6510* const c, struct emitter* const e, const struct block_record* const r, uint32_t cycles)
+{
+  const enum ADDR_MODE mode = opcodes[r->opcode].address_mode;
+  const uint16_t addr = r->operand;
+
+  if(mode != IMPLIED && mode != ACCUMULATOR && mode != IMMEDIATE
+      && mode != ZEROPAGE && mode != ABSOLUTE && !indexed(mode)) return false;
+
+  switch (r->opcode) {
+
+    /* LDA, LDX, LDY */
+    case 0xA9: case 0xA5: case 0xB5: case 0xAD:
+    case 0xA2: case 0xA6: case 0xB6: case 0xAE:
+    case 0xA0: case 0xA4: case 0xB4: case 0xAC:
+    {
+      const int dst = load_register(r->opcode);
+      if(!load_operand(c, e, mode, addr)) return false;
+      op_rr(e, 0x89, dst, RAX);
+      set_zn(e, dst);
+      return true;
+    }
+
+    /* STA, STX, STY */
+    case 0x85: case 0x95: case 0x8D:
+    case 0x86: case 0x96: case 0x8E:
+    case 0x84: case 0x94: case 0x8C:
+    {
+      const int src = (r->opcode & 0x03) == 0x02 ? REG_X : (r->opcode & 0x03) == 0x00 ? REG_Y : REG_A;
+
+      if(indexed(mode))
+      {
+        zeropage_indexed(c, e, mode, addr);
+        store_rax(e, src);
+        check_code_write(e, 0, r->next, cycles);
+        return true;
+      }
+
+      uint8_t* const host = host_write(c, addr);
+      if(host == NULL) return false;
+
+      mov_rax_ptr(e, host);
+      store_rax(e, src);
+      mark_written(e, addr);
+      check_code_write(e, addr, r->next, cycles);
+      return true;
+    }
+
+    /* INC, DEC */
+    case 0xE6: case 0xF6: case 0xEE:
+    case 0xC6: case 0xD6: case 0xCE:
+    {
+      if(indexed(mode))
+      {
+        zeropage_indexed(c, e, mode, addr);
+      }
+      else
+      {
+        uint8_t* const host = host_write(c, addr);
+        if(host == NULL || host_read(c, addr) != host) return false;
+
+        mov_rax_ptr(e, host);
+      }
+
+      load_rax(e, RCX);
+      op_ri(e, 0, RCX, (r->opcode & 0xE0) == 0xE0 ? 1 : 0xFFFFFFFF);
+      op_ri(e, 4, RCX, 0xFF);
+      store_rax(e, RCX);
+      set_zn(e, RCX);
+      mark_written(e, addr);
+      check_code_write(e, addr, r->next, cycles);
+      return true;
+    }
+
+    /* AND, ORA, EOR */
+    case 0x29: case 0x25: case 0x35: case 0x2D:
+    case 0x09: case 0x05: case 0x15: case 0x0D:
+    case 0x49: case 0x45: case 0x55: case 0x4D:
+    {
+      const uint8_t op = (r->opcode & 0xE0) == 0x20 ? 0x21 : (r->opcode & 0xE0) == 0x00 ? 0x09 : 0x31;
+
+      if(!load_operand(c, e, mode, addr)) return false;
+      op_rr(e, op, REG_A, RAX);
+      set_zn(e, REG_A);
+      return true;
+    }
+
+    /* CMP, CPX, CPY */
+    case 0xC9: case 0xC5: case 0xD5: case 0xCD:
+    case 0xE0: case 0xE4: case 0xEC:
+    case 0xC0: case 0xC4: case 0xCC:
+    {
+      const int reg = (r->opcode & 0x03) == 0x01 ? REG_A : (r->opcode & 0xE0) == 0xE0 ? REG_X : REG_Y;
+
+      if(!load_operand(c, e, mode, addr)) return false;
+      op_rr(e, 0x31, REG_CF, REG_CF);
+      op_rr(e, 0x39, reg, RAX);
+      setcc(e, CC_AE, REG_CF);
+      op_rr(e, 0x89, RCX, reg);
+      op_rr(e, 0x29, RCX, RAX);
+      op_ri(e, 4, RCX, 0xFF);
+      set_zn(e, RCX);
+      return true;
+    }
+
+    /* ADC, SBC in binary mode, SBC adds the complement of its operand */
+    case 0x69: case 0x65: case 0x75: case 0x6D:
+    case 0xE9: case 0xE5: case 0xF5: case 0xED:
+    {
+      test_field(e, offsetof(MOS_6510, df), 1);
+      fall_back_unless(e, r, cycles, CC_E);
+
+      if(!load_operand(c, e, mode, addr)) return false;
+      if((r->opcode & 0xE0) == 0xE0) op_ri(e, 6, RAX, 0xFF);
+
+      store_field(e, offsetof(MOS_6510, v_a), REG_A, false);
+      store_field(e, offsetof(MOS_6510, v_b), RAX, false);
+      op_rr(e, 0x89, RCX, REG_A);
+      op_rr(e, 0x01, RCX, RAX);
+      op_rr(e, 0x01, RCX, REG_CF);
+      store_field(e, offsetof(MOS_6510, v_r), RCX, false);
+      op_rr(e, 0x89, REG_CF, RCX);
+      shift_ri(e, 5, REG_CF, 8);
+      op_rr(e, 0x89, REG_A, RCX);
+      op_ri(e, 4, REG_A, 0xFF);
+      set_zn(e, REG_A);
+      return true;
+    }
+
+    /* Stack */
+    case 0x48: // PHA
+      stack_address(c, e, 0);
+      store_rax(e, REG_A);
+      move_sp(e, -1);
+      check_code_write(e, 0x100, r->next, cycles);
+      return true;
+
+    case 0x08: // PHP, packs P like pack_flags() with B set
+      set_field(e, offsetof(MOS_6510, bf), 1);
+
+      /* V = (v_a ^ v_r) & (v_b ^ v_r) & 0x80, the same as flag_v() */
+      load_field(e, RAX, offsetof(MOS_6510, v_r), false);
+      load_field(e, RCX, offsetof(MOS_6510, v_a), false);
+      op_rr(e, 0x31, RCX, RAX);
+      xor_field(e, RAX, offsetof(MOS_6510, v_b));
+      op_rr(e, 0x21, RCX, RAX);
+      op_ri(e, 4, RCX, 0x80);
+      shift_ri(e, 5, RCX, 1);
+
+      op_rr(e, 0x89, RAX, REG_ZN); // N
+      shift_ri(e, 5, RAX, 8);
+      op_ri(e, 4, RAX, 0x80);
+      op_rr(e, 0x09, RCX, RAX);
+
+      op_rr(e, 0x31, RAX, RAX); // Z
+      test_ri(e, REG_ZN, 0xFF);
+      setcc(e, CC_E, RAX);
+      shift_ri(e, 4, RAX, 1);
+      op_rr(e, 0x09, RCX, RAX);
+
+      load_field(e, RAX, offsetof(MOS_6510, df), false);
+      shift_ri(e, 4, RAX, 3);
+      op_rr(e, 0x09, RCX, RAX);
+      load_field(e, RAX, offsetof(MOS_6510, idf), false);
+      shift_ri(e, 4, RAX, 2);
+      op_rr(e, 0x09, RCX, RAX);
+      op_rr(e, 0x09, RCX, REG_CF);
+      op_ri(e, 1, RCX, 0x30); // Unused bit and B
+
+      stack_address(c, e, 0);
+      store_rax(e, RCX);
+      move_sp(e, -1);
+      check_code_write(e, 0x100, r->next, cycles);
+      return true;
+
+    case 0x68: // PLA
+      move_sp(e, 1);
+      stack_address(c, e, 0);
+      load_rax(e, REG_A);
+      set_zn(e, REG_A);
+      return true;
+
+    case 0x28: // PLP, unpacks P like set_flags()
+      move_sp(e, 1);
+      stack_address(c, e, 0);
+      load_rax(e, RCX);
+
+      op_rr(e, 0x89, REG_ZN, RCX); // zn = n << 15 | !z
+      op_ri(e, 4, REG_ZN, 0x80);
+      shift_ri(e, 4, REG_ZN, 8);
+      op_rr(e, 0x89, RAX, RCX);
+      shift_ri(e, 5, RAX, 1);
+      op_ri(e, 4, RAX, 1);
+      op_ri(e, 6, RAX, 1);
+      op_rr(e, 0x09, REG_ZN, RAX);
+
+      set_field(e, offsetof(MOS_6510, v_a), 0);
+      set_field(e, offsetof(MOS_6510, v_b), 0);
+      op_rr(e, 0x89, RAX, RCX);
+      op_ri(e, 4, RAX, 0x40);
+      shift_ri(e, 4, RAX, 1);
+      store_field(e, offsetof(MOS_6510, v_r), RAX, false);
+
+      static const struct { size_t field; uint8_t bit; } flags[] = {
+        { offsetof(MOS_6510, df), 3 },
+        { offsetof(MOS_6510, bf), 4 },
+        { offsetof(MOS_6510, idf), 2 },
+      };
+
+      for(size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); i++)
+      {
+        op_rr(e, 0x89, RAX, RCX);
+        shift_ri(e, 5, RAX, flags[i].bit);
+        op_ri(e, 4, RAX, 1);
+        store_field(e, flags[i].field, RAX, false);
+      }
+
+      op_rr(e, 0x89, REG_CF, RCX);
+      op_ri(e, 4, REG_CF, 1);
+      return true;
+
+    /* Transfers */
+    case 0xAA: op_rr(e, 0x89, REG_X, REG_A); set_zn(e, REG_X); return true; // TAX
+    case 0xA8: op_rr(e, 0x89, REG_Y, REG_A); set_zn(e, REG_Y); return true; // TAY
+    case 0x8A: op_rr(e, 0x89, REG_A, REG_X); set_zn(e, REG_A); return true; // TXA
+    case 0x98: op_rr(e, 0x89, REG_A, REG_Y); set_zn(e, REG_A); return true; // TYA
+    case 0xBA: op_rr(e, 0x89, REG_X, REG_SP); set_zn(e, REG_X); return true; // TSX
+    case 0x9A: op_rr(e, 0x89, REG_SP, REG_X); return true; // TXS
+
+    /* INX, INY, DEX, DEY */
+    case 0xE8: case 0xC8: case 0xCA: case 0x88:
+    {
+      const int reg = r->opcode == 0xE8 || r->opcode == 0xCA ? REG_X : REG_Y;
+
+      op_ri(e, 0, reg, r->opcode == 0xE8 || r->opcode == 0xC8 ? 1 : 0xFFFFFFFF);
+      op_ri(e, 4, reg, 0xFF);
+      set_zn(e, reg);
+      return true;
+    }
+
+    /* Shifts and rotations of A */
+    case 0x0A: // ASL
+      op_rr(e, 0x89, REG_CF, REG_A);
+      shift_ri(e, 5, REG_CF, 7);
+      op_rr(e, 0x01, REG_A, REG_A);
+      op_ri(e, 4, REG_A, 0xFF);
+      set_zn(e, REG_A);
+      return true;
+
+    case 0x4A: // LSR
+      op_rr(e, 0x89, REG_CF, REG_A);
+      op_ri(e, 4, REG_CF, 1);
+      shift_ri(e, 5, REG_A, 1);
+      set_zn(e, REG_A);
+      return true;
+
+    case 0x2A: // ROL
+      op_rr(e, 0x89, RCX, REG_A);
+      shift_ri(e, 5, RCX, 7);
+      op_rr(e, 0x01, REG_A, REG_A);
+      op_rr(e, 0x09, REG_A, REG_CF);
+      op_ri(e, 4, REG_A, 0xFF);
+      op_rr(e, 0x89, REG_CF, RCX);
+      set_zn(e, REG_A);
+      return true;
+
+    case 0x6A: // ROR
+      op_rr(e, 0x89, RCX, REG_A);
+      op_ri(e, 4, RCX, 1);
+      shift_ri(e, 4, REG_CF, 7);
+      shift_ri(e, 5, REG_A, 1);
+      op_rr(e, 0x09, REG_A, REG_CF);
+      op_rr(e, 0x89, REG_CF, RCX);
+      set_zn(e, REG_A);
+      return true;
+
+    case 0x18: mov_ri(e, REG_CF, 0); return true; // CLC
+    case 0x38: mov_ri(e, REG_CF, 1); return true; // SEC
+    case 0xEA: return true; // NOP
+
+    default:
+      return false;
+  }
+}
+
+/* JMP, JSR and RTS at the end of a block, false for anything else */
+
+static bool
+translate_jump(MOS_6510* const c, struct emitter* const e, const struct block_record* const r, uint32_t cycles)
+{
+  switch (r->opcode) {
+    case 0x4C: // JMP
+      exit_block(e, r->operand, cycles, 0);
+      return true;
+
+    case 0x20: // JSR, like push_word() the low byte goes below 0x100 when SP is 0
+    {
+      const uint16_t ret = r->next - 1;
+
+      test_ri(e, REG_SP, 0xFF);
+      fall_back_unless(e, r, cycles, CC_NE);
+
+      stack_address(c, e, 0);
+      mov_ri(e, RCX, ret >> 8);
+      store_rax(e, RCX);
+      stack_address(c, e, -1);
+      mov_ri(e, RCX, ret & 0xFF);
+      store_rax(e, RCX);
+      move_sp(e, -2);
+      check_code_write(e, 0x100, r->operand, cycles);
+      exit_block(e, r->operand, cycles, 0);
+      return true;
+    }
+
+    case 0x60: // RTS
+      move_sp(e, 1);
+      stack_address(c, e, 0);
+      load_rax(e, RCX);
+      move_sp(e, 1);
+      stack_address(c, e, 0);
+      load_rax(e, RAX);
+      shift_ri(e, 4, RAX, 8);
+      op_rr(e, 0x09, RAX, RCX);
+      op_ri(e, 0, RAX, 1);
+
+      store_registers(e);
+      store_field(e, offsetof(MOS_6510, pc), RAX, true);
+      leave(e, cycles, 0);
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+/* Branch on N, Z or C at the end of a block: taken and not taken exits */
+
+static bool
+translate_branch(struct emitter* const e, const struct block_record* const r, uint32_t cycles)
+{
+  int taken;
+
+  switch (r->opcode) {
+    case 0x10: test_ri(e, REG_ZN, 0x8000); taken = CC_E; break; // BPL
+    case 0x30: test_ri(e, REG_ZN, 0x8000); taken = CC_NE; break; // BMI
+    case 0x90: test_ri(e, REG_CF, 1); taken = CC_E; break; // BCC
+    case 0xB0: test_ri(e, REG_CF, 1); taken = CC_NE; break; // BCS
+    case 0xD0: test_ri(e, REG_ZN, 0xFF); taken = CC_NE; break; // BNE
+    case 0xF0: test_ri(e, REG_ZN, 0xFF); taken = CC_E; break; // BEQ
+    default: return false;
+  }
+
+  const uint16_t target = r->next + (int8_t)r->operand;
+  const bool crossed = (target & 0xFF00) != (r->next & 0xFF00);
+
+  uint8_t* const branch = jump(e, taken);
+  exit_block(e, r->next, cycles, 0);
+  patch(e, branch);
+  exit_block(e, target, cycles + 1 + crossed, 0);
+  return true;
+}
+
+/*
+ * The code buffer is never writable and executable at once. Before a
+ * block is emitted, the pages from the one it starts on to the end of the
+ * buffer are made RW. Afterwards, the pages holding code are made RX again,
+ * the ones after them stay RW until code goes there.
+ */
+
+static bool
+code_writable(MOS_6510* const c, uintptr_t page_size)
+{
+  const uintptr_t from = c->jit_used & ~(page_size - 1);
+
+  return mprotect(c->jit_code + from, JIT_CODE_SIZE - from, PROT_READ | PROT_WRITE) == 0;
+}
+
+static bool
+code_executable(MOS_6510* const c, uintptr_t page_size, uint32_t start)
+{
+  const uintptr_t from = start & ~(page_size - 1);
+  const uintptr_t to = (c->jit_used + page_size - 1) & ~(page_size - 1);
+
+  return to <= from || mprotect(c->jit_code + from, to - from, PROT_READ | PROT_EXEC) == 0;
+}
+
+void
+jit_flush(MOS_6510* const c)
+{
+  c->jit_used = 0;
+}
+
+void
+jit_free(MOS_6510* const c)
+{
+  if(c->jit_code) munmap(c->jit_code, JIT_CODE_SIZE);
+  c->jit_code = NULL;
+  c->jit_used = 0;
+}
+
+bool
+jit_translate(MOS_6510* const c, struct block* const b)
+{
+#if defined(OPCODE_STATS) || defined(PROFILER)
+  return false; // Counted by the predecoded handlers only
+#endif
+#ifdef TRACER
+  if(c->trace) return false; // Traced by the predecoded handlers
+#endif
+#ifdef REWIND
+  if(c->rewind) return false; // Stores have to go through the journal
+#endif
+  if(c->low_watches) return false; // Zero page and stack accesses have to look for watchpoints
+
+  if(c->jit_code == NULL)
+  {
+    void* const code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(code == MAP_FAILED) return false;
+
+    c->jit_code = code;
+    c->jit_used = 0;
+  }
+
+  const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  const uint32_t used = c->jit_used;
+
+  if(!code_writable(c, page_size)) return false;
+
+  uint8_t* const start = c->jit_code + used;
+  struct emitter e = { start, c->jit_code + JIT_CODE_SIZE, false, 0 };
+
+  prologue(&e);
+
+  uint32_t cycles = 0;
+  uint8_t n = 0;
+  bool ended = false;
+
+  for(; n < b->length; n++)
+  {
+    const struct block_record* const r = &b->records[n];
+    const uint8_t* const mark = e.p;
+
+    e.retired = n + 1;
+
+    if(opcodes[r->opcode].address_mode == RELATIVE)
+    {
+      ended = translate_branch(&e, r, cycles + r->cycles);
+      if(ended) n++;
+      break;
+    }
+
+    if(translate_jump(c, &e, r, cycles + r->cycles))
+    {
+      ended = true;
+      n++;
+      break;
+    }
+
+    if(!translate(c, &e, r, cycles + r->cycles))
+    {
+      e.p = (uint8_t*)mark;
+      break;
+    }
+
+    cycles += r->cycles;
+  }
+
+  if(n > 0)
+  {
+    e.retired = n;
+    if(!ended) exit_block(&e, b->records[n - 1].next, cycles, 0);
+    if(!e.full) c->jit_used = e.p - c->jit_code;
+  }
+
+  /* Code already on the page this block started on has to run again either way */
+  if(!code_executable(c, page_size, used))
+  {
+    blocks_flush(c); // Nothing can be left that runs from a writable page
+    return false;
+  }
+
+  if(n == 0) return false;
+
+  if(e.full)
+  {
+    blocks_flush(c); // Out of code space, start over
+    return false;
+  }
+
+  /* ISO C has no cast from data to function pointers, POSIX makes this well defined */
+  union { uint8_t* code; native_block run; } entry = { start };
+
+  b->native = entry.run;
+  b->native_length = n;
+  return true;
+}
+
+#endif // JIT_CORE
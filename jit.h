@@ -0,0 +1,28 @@
+#ifndef _6510_JIT
+#define _6510_JIT
+
+#include <stdbool.h>
+
+#include "cpu.h"
+
+#ifdef JIT_CORE
+
+#if !defined(__x86_64__) || !defined(__linux__)
+#error "CORE=jit needs Linux on x86-64"
+#endif
+
+#define JIT_THRESHOLD 32 // Block entries before it gets translated
+#define JIT_CODE_SIZE (1 << 20) // Native code buffer per CPU, flushed when full
+
+#define JIT_STEP 0x200 // Left in front of an instruction for the interpreter to run
+
+/* Native block: returns 0, 0x100 | page after a store into a page with cached code, or JIT_STEP */
+typedef uint32_t (*native_block)(MOS_6510* const c);
+
+bool jit_translate(MOS_6510* const c, struct block* const b);
+void jit_flush(MOS_6510* const c);
+void jit_free(MOS_6510* const c);
+
+#endif // JIT_CORE
+
+#endif // _6510_JIT
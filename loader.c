@@ -0,0 +1,225 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cpu.h"
+#include "bus.h"
+#include "loader.h"
+
+struct segment
+{
+  uint32_t addr;
+  uint32_t length;
+  const uint8_t* data;
+};
+
+static uint16_t
+le16(const uint8_t bytes[2])
+{
+  return bytes[0] | bytes[1] << 8;
+}
+
+static bool
+has_extension(const char* path, const char* extension)
+{
+  const size_t length = strlen(path);
+  const size_t extension_length = strlen(extension);
+
+  return length > extension_length && strcasecmp(path + length - extension_length, extension) == 0;
+}
+
+/* Splits the file into segments, NULL or the reason it can't be */
+
+static const char*
+parse(struct program* const p, const char* path, uint16_t addr, struct segment* segments, uint8_t* count)
+{
+  const uint8_t* const data = p->mapping;
+  const size_t size = p->mapping_size;
+
+  if(size >= sizeof(struct program_header) && memcmp(data, PROGRAM_MAGIC, sizeof(PROGRAM_MAGIC)) == 0)
+  {
+    const struct program_header* const header = (const void*) data;
+    const uint16_t flags = le16(header->flags);
+    size_t offset = sizeof(struct program_header);
+
+    if(le16(header->segments) > PROGRAM_SEGMENTS) return "too many segments";
+
+    for(uint16_t i = 0; i < le16(header->segments); i++)
+    {
+      if(size - offset < sizeof(struct program_segment)) return "truncated segment header";
+
+      const struct program_segment* const segment = (const void*) (data + offset);
+      offset += sizeof(struct program_segment);
+
+      if(size - offset < le16(segment->length)) return "truncated segment";
+
+      segments[(*count)++] = (struct segment){ le16(segment->addr), le16(segment->length), data + offset };
+      offset += le16(segment->length);
+    }
+
+    if(flags & PROGRAM_ENTRY) p->entry = le16(header->entry);
+
+    if(flags & PROGRAM_RESET)
+    {
+      memcpy(p->vector, header->reset, 2);
+      segments[(*count)++] = (struct segment){ RESET_VECTOR, 2, p->vector };
+    }
+    return NULL;
+  }
+
+  if(has_extension(path, ".prg"))
+  {
+    if(size < 2) return "no load address";
+
+    segments[(*count)++] = (struct segment){ le16(data), size - 2, data + 2 };
+    return NULL;
+  }
+
+  segments[(*count)++] = (struct segment){ addr, size, data };
+  return NULL;
+}
+
+/*
+ * Loads `path` and maps it on c's bus, `addr` is where raw images go. On
+ * failure p->error tells why and nothing is mapped.
+ */
+
+bool
+program_load(MOS_6510* const c, struct program* const p, const char* path, uint16_t addr)
+{
+  *p = (struct program){ .entry = -1 };
+
+  const int fd = open(path, O_RDONLY);
+  struct stat st;
+
+  if(fd < 0 || fstat(fd, &st) != 0)
+  {
+    if(fd >= 0) close(fd);
+    p->error = "file couldn't be opened";
+    return false;
+  }
+
+  if(st.st_size > 0)
+  {
+    void* const mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    p->mapping = mapping == MAP_FAILED ? NULL : mapping;
+    p->mapping_size = st.st_size;
+  }
+
+  close(fd);
+
+  if(p->mapping == NULL)
+  {
+    p->error = st.st_size ? "file couldn't be mapped" : "file is empty";
+    return false;
+  }
+
+  struct segment segments[PROGRAM_SEGMENTS + 1];
+  uint8_t count = 0;
+
+  p->error = parse(p, path, addr, segments, &count);
+
+  for(uint8_t i = 0; p->error == NULL && i < count; i++)
+  {
+    if(segments[i].addr + segments[i].length > 0x10000) p->error = "file size too large";
+  }
+
+  if(p->error)
+  {
+    program_free(p);
+    return false;
+  }
+
+  /* Pages covered by a single segment come straight from the file, the rest gets copied */
+
+  const uint8_t* host[256] = { NULL };
+  uint8_t touched[256] = { 0 };
+  uint16_t copies = 0;
+
+  for(uint8_t i = 0; i < count; i++)
+  {
+    const struct segment* const s = &segments[i];
+
+    if(s->length == 0) continue;
+
+    for(uint32_t page = s->addr >> 8; page <= (s->addr + s->length - 1) >> 8; page++)
+    {
+      const bool whole = page << 8 >= s->addr && (page + 1) << 8 <= s->addr + s->length;
+
+      host[page] = whole && !touched[page] ? s->data + (page << 8) - s->addr : NULL;
+      touched[page]++;
+    }
+  }
+
+  for(uint16_t page = 2; page < 0x100; page++)
+  {
+    if(touched[page] > 1) host[page] = NULL;
+    if(touched[page] && host[page] == NULL) copies++;
+  }
+
+  p->copies = copies ? calloc(copies, 0x100) : NULL;
+
+  if(copies && p->copies == NULL)
+  {
+    p->error = "out of memory";
+    program_free(p);
+    return false;
+  }
+
+  uint8_t* copy[256] = { NULL };
+
+  for(uint16_t page = 2, next = 0; page < 0x100; page++)
+  {
+    if(touched[page] && host[page] == NULL) host[page] = copy[page] = p->copies + (next++ << 8);
+  }
+
+  for(uint8_t i = 0; i < count; i++)
+  {
+    const struct segment* const s = &segments[i];
+
+    for(uint32_t a = s->addr; a < s->addr + s->length; )
+    {
+      const uint32_t end = (a | 0xFF) + 1 < s->addr + s->length ? (a | 0xFF) + 1 : s->addr + s->length;
+
+      if(a < 0x200) memcpy(c->low + a, s->data + a - s->addr, end - a);
+      else if(copy[a >> 8]) memcpy(copy[a >> 8] + (a & 0xFF), s->data + a - s->addr, end - a);
+
+      a = end;
+    }
+  }
+
+  /* Consecutive pages that are consecutive in host memory too go in one call */
+
+  for(uint16_t page = 2; page < 0x100; )
+  {
+    uint16_t end = page + 1;
+
+    if(host[page] == NULL)
+    {
+      page++;
+      continue;
+    }
+
+    while(end < 0x100 && host[end] == host[end - 1] + 0x100) end++;
+
+    map_image(c, page, end - page, host[page]);
+    page = end;
+  }
+
+  return true;
+}
+
+void
+program_free(struct program* const p)
+{
+  if(p->mapping) munmap(p->mapping, p->mapping_size);
+  free(p->copies);
+
+  p->mapping = NULL;
+  p->copies = NULL;
+}
@@ -0,0 +1,66 @@
+#ifndef _6510_LOADER
+#define _6510_LOADER
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+
+/*
+ * Program images, memory mapped and put on the bus with map_image(). Pages
+ * a single segment covers completely are mapped straight from the file,
+ * only pages shared by segments or only partly covered are copied. Zero
+ * page and stack are copied into c->low as always.
+ *
+ * Three formats are understood:
+ *
+ *   raw        the whole file, loaded at the address given
+ *   .prg       a 2 byte little endian load address, then the data (C64 style)
+ *   container  a struct program_header, then `segments` times a struct
+ *              program_segment followed by its `length` bytes
+ *
+ * Containers are recognised by PROGRAM_MAGIC, .prg files by their extension.
+ */
+
+#define PROGRAM_MAGIC "6510SEG"
+#define PROGRAM_SEGMENTS 64
+
+#define PROGRAM_ENTRY 0x1 // program_header.entry is valid
+#define PROGRAM_RESET 0x2 // program_header.reset goes into the reset vector
+
+/* Little endian, without padding */
+
+struct program_header
+{
+  char magic[8];
+  uint8_t entry[2];
+  uint8_t reset[2];
+  uint8_t flags[2];
+  uint8_t segments[2];
+};
+
+struct program_segment
+{
+  uint8_t addr[2];
+  uint8_t length[2];
+};
+
+/* A loaded program, has to outlive the bus it was mapped on */
+
+struct program
+{
+  void* mapping; // The file
+  size_t mapping_size;
+  uint8_t* copies; // Pages that couldn't be mapped from the file
+
+  int32_t entry; // Where to start, -1 if the image doesn't say
+  uint8_t vector[2]; // Reset vector of a container
+
+  const char* error; // Why program_load() failed
+};
+
+bool program_load(MOS_6510* const c, struct program* const p, const char* path, uint16_t addr);
+void program_free(struct program* const p);
+
+#endif // _6510_LOADER
@@ -0,0 +1,273 @@
+#ifndef _6510_OPCODES
+#define _6510_OPCODES
+
+/*
+ * Instruction set specification, one entry per opcode:
+ *
+ * OP(opcode, mnemonic, handler, cycles, addressing mode, page crossed cycles)
+ *
+ * Expanded by cpu.c into one handler per opcode with the addressing mode,
+ * cycle count and page crossing penalty inlined, and by debug.c into the
+ * debug_output[] table. For RELATIVE the page crossing penalty is only
+ * charged when the branch is taken.
+ */
+
+#define OPCODE_TABLE(OP) \
+  OP(0x00, BRK, BRK, 7, IMPLIED, 0)        \
+  OP(0x01, ORA, ORA, 6, INDIRECT_X, 0)     \
+  OP(0x02, JAM, JAM, 2, IMPLIED, 0)        \
+  OP(0x03, SLO, SLO, 8, INDIRECT_X, 0)     \
+  OP(0x04, NOP, NOP_MEM, 3, ZEROPAGE, 0)   \
+  OP(0x05, ORA, ORA, 3, ZEROPAGE, 0)       \
+  OP(0x06, ASL, ASL_MEM, 5, ZEROPAGE, 0)   \
+  OP(0x07, SLO, SLO, 5, ZEROPAGE, 0)       \
+  OP(0x08, PHP, PHP, 3, IMPLIED, 0)        \
+  OP(0x09, ORA, ORA, 2, IMMEDIATE, 0)      \
+  OP(0x0A, ASL, ASL, 2, ACCUMULATOR, 0)    \
+  OP(0x0B, ANC, ANC, 2, IMMEDIATE, 0)      \
+  OP(0x0C, NOP, NOP_MEM, 4, ABSOLUTE, 0)   \
+  OP(0x0D, ORA, ORA, 4, ABSOLUTE, 0)       \
+  OP(0x0E, ASL, ASL_MEM, 6, ABSOLUTE, 0)   \
+  OP(0x0F, SLO, SLO, 6, ABSOLUTE, 0)       \
+  OP(0x10, BPL, BPL, 2, RELATIVE, 1)       \
+  OP(0x11, ORA, ORA, 5, INDIRECT_Y, 1)     \
+  OP(0x12, JAM, JAM, 0, IMPLIED, 0)        \
+  OP(0x13, SLO, SLO, 8, INDIRECT_X, 0)     \
+  OP(0x14, NOP, NOP_MEM, 4, ZEROPAGE_X, 0) \
+  OP(0x15, ORA, ORA, 4, ZEROPAGE_X, 0)     \
+  OP(0x16, ASL, ASL_MEM, 6, ZEROPAGE_X, 0) \
+  OP(0x17, SLO, SLO, 6, ZEROPAGE, 0)       \
+  OP(0x18, CLC, CLC, 2, IMPLIED, 0)        \
+  OP(0x19, ORA, ORA, 4, ABSOLUTE_Y, 1)     \
+  OP(0x1A, NOP, NOP, 2, IMPLIED, 0)        \
+  OP(0x1B, SLO, SLO, 7, ABSOLUTE_Y, 0)     \
+  OP(0x1C, NOP, NOP_MEM, 4, ABSOLUTE_X, 1) \
+  OP(0x1D, ORA, ORA, 4, ABSOLUTE_X, 1)     \
+  OP(0x1E, ASL, ASL_MEM, 7, ABSOLUTE_X, 0) \
+  OP(0x1F, SLO, SLO, 7, ABSOLUTE_X, 0)     \
+  OP(0x20, JSR, JSR, 6, ABSOLUTE, 0)       \
+  OP(0x21, AND, AND, 6, INDIRECT_X, 0)     \
+  OP(0x22, JAM, JAM, 0, IMPLIED, 0)        \
+  OP(0x23, RLA, RLA, 8, INDIRECT_X, 0)     \
+  OP(0x24, BIT, BIT, 3, ZEROPAGE, 0)       \
+  OP(0x25, AND, AND, 3, ZEROPAGE, 0)       \
+  OP(0x26, ROL, ROL_MEM, 5, ZEROPAGE, 0)   \
+  OP(0x27, RLA, RLA, 5, ZEROPAGE, 0)       \
+  OP(0x28, PLP, PLP, 4, IMPLIED, 0)        \
+  OP(0x29, AND, AND, 2, IMMEDIATE, 0)      \
+  OP(0x2A, ROL, ROL, 2, ACCUMULATOR, 0)    \
+  OP(0x2B, ANC, ANC, 2, IMMEDIATE, 0)      \
+  OP(0x2C, BIT, BIT, 4, ABSOLUTE, 0)       \
+  OP(0x2D, AND, AND, 4, ABSOLUTE, 0)       \
+  OP(0x2E, ROL, ROL_MEM, 6, ABSOLUTE, 0)   \
+  OP(0x2F, RLA, RLA, 6, ABSOLUTE, 0)       \
+  OP(0x30, BMI, BMI, 2, RELATIVE, 1)       \
+  OP(0x31, AND, AND, 5, INDIRECT_Y, 1)     \
+  OP(0x32, JAM, JAM, 0, IMPLIED, 0)        \
+  OP(0x33, RLA, RLA, 8, INDIRECT_Y, 0)     \
+  OP(0x34, NOP, NOP_MEM, 4, ZEROPAGE_X, 0) \
+  OP(0x35, AND, AND, 4, ZEROPAGE_X, 0)     \
+  OP(0x36, ROL, ROL_MEM, 6, ZEROPAGE_X, 0) \
+  OP(0x37, RLA, RLA, 6, ZEROPAGE_X, 0)     \
+  OP(0x38, SEC, SEC, 2, IMPLIED, 0)        \
+  OP(0x39, AND, AND, 4, ABSOLUTE_Y, 1)     \
+  OP(0x3A, NOP, NOP, 2, IMPLIED, 0)        \
+  OP(0x3B, RLA, RLA, 7, ABSOLUTE_Y, 0)     \
+  OP(0x3C, NOP, NOP_MEM, 4, ABSOLUTE_Y, 1) \
+  OP(0x3D, AND, AND, 4, ABSOLUTE_X, 1)     \
+  OP(0x3E, ROL, ROL_MEM, 7, ABSOLUTE_X, 0) \
+  OP(0x3F, RLA, RLA, 7, ABSOLUTE_X, 0)     \
+  OP(0x40, RTI, RTI, 6, IMPLIED, 0)        \
+  OP(0x41, EOR, EOR, 6, INDIRECT_X, 0)     \
+  OP(0x42, JAM, JAM, 0, IMPLIED, 0)        \
+  OP(0x43, SRE, SRE, 8, INDIRECT_X, 0)     \
+  OP(0x44, NOP, NOP_MEM, 3, ZEROPAGE, 0)   \
+  OP(0x45, EOR, EOR, 3, ZEROPAGE, 0)       \
+  OP(0x46, LSR, LSR_MEM, 5, ZEROPAGE, 0)   \
+  OP(0x47, SRE, SRE, 5, ZEROPAGE, 0)       \
+  OP(0x48, PHA, PHA, 3, IMPLIED, 0)        \
+  OP(0x49, EOR, EOR, 2, IMMEDIATE, 0)      \
+  OP(0x4A, LSR, LSR, 2, ACCUMULATOR, 0)    \
+  OP(0x4B, ALR, ALR, 2, IMMEDIATE, 0)      \
+  OP(0x4C, JMP, JMP, 3, ABSOLUTE, 0)       \
+  OP(0x4D, EOR, EOR, 4, ABSOLUTE, 0)       \
+  OP(0x4E, LSR, LSR_MEM, 6, ABSOLUTE, 0)   \
+  OP(0x4F, SRE, SRE, 6, ABSOLUTE, 0)       \
+  OP(0x50, BVC, BVC, 2, RELATIVE, 1)       \
+  OP(0x51, EOR, EOR, 5, INDIRECT_Y, 1)     \
+  OP(0x52, JAM, JAM, 0, IMPLIED, 0)        \
+  OP(0x53, SRE, SRE, 8, INDIRECT_Y, 0)     \
+  OP(0x54, NOP, NOP_MEM, 4, ZEROPAGE_X, 0) \
+  OP(0x55, EOR, EOR, 4, ZEROPAGE_X, 0)     \
+  OP(0x56, LSR, LSR_MEM, 6, ZEROPAGE_X, 0) \
+  OP(0x57, SRE, SRE, 6, ZEROPAGE_X, 0)     \
+  OP(0x58, CLI, CLI, 2, IMPLIED, 0)        \
+  OP(0x59, EOR, EOR, 4, ABSOLUTE_Y, 1)     \
+  OP(0x5A, NOP, NOP, 2, IMPLIED, 0)        \
+  OP(0x5B, SRE, SRE, 7, ABSOLUTE_Y, 0)     \
+  OP(0x5C, NOP, NOP_MEM, 4, ABSOLUTE_X, 1) \
+  OP(0x5D, EOR, EOR, 4, ABSOLUTE_X, 1)     \
+  OP(0x5E, LSR, LSR_MEM, 7, ABSOLUTE_X, 0) \
+  OP(0x5F, SRE, SRE, 7, ABSOLUTE_X, 0)     \
+  OP(0x60, RTS, RTS, 6, IMPLIED, 0)        \
+  OP(0x61, ADC, ADC, 6, INDIRECT_X, 0)     \
+  OP(0x62, JAM, JAM, 0, IMPLIED, 0)        \
+  OP(0x63, RRA, RRA, 8, INDIRECT_X, 0)     \
+  OP(0x64, NOP, NOP_MEM, 3, ZEROPAGE, 0)   \
+  OP(0x65, ADC, ADC, 3, ZEROPAGE, 0)       \
+  OP(0x66, ROR, ROR_MEM, 5, ZEROPAGE, 0)   \
+  OP(0x67, RRA, RRA, 5, ZEROPAGE, 0)       \
+  OP(0x68, PLA, PLA, 4, IMPLIED, 0)        \
+  OP(0x69, ADC, ADC, 2, IMMEDIATE, 0)      \
+  OP(0x6A, ROR, ROR, 2, ACCUMULATOR, 0)    \
+  OP(0x6B, ARR, ARR, 2, IMMEDIATE, 0)      \
+  OP(0x6C, JMP, JMP, 5, INDIRECT, 0)       \
+  OP(0x6D, ADC, ADC, 4, ABSOLUTE, 0)       \
+  OP(0x6E, ROR, ROR_MEM, 6, ABSOLUTE, 0)   \
+  OP(0x6F, RRA, RRA, 6, ABSOLUTE, 0)       \
+  OP(0x70, BVS, BVS, 2, RELATIVE, 1)       \
+  OP(0x71, ADC, ADC, 5, INDIRECT_Y, 1)     \
+  OP(0x72, JAM, JAM, 0, IMPLIED, 0)        \
+  OP(0x73, RRA, RRA, 8, INDIRECT_Y, 0)     \
+  OP(0x74, NOP, NOP_MEM, 4, ZEROPAGE_X, 0) \
+  OP(0x75, ADC, ADC, 4, ZEROPAGE_X, 0)     \
+  OP(0x76, ROR, ROR_MEM, 6, ZEROPAGE_X, 0) \
+  OP(0x77, RRA, RRA, 6, ZEROPAGE_X, 0)     \
+  OP(0x78, SEI, SEI, 2, IMPLIED, 0)        \
+  OP(0x79, ADC, ADC, 4, ABSOLUTE_Y, 1)     \
+  OP(0x7A, NOP, NOP, 2, IMPLIED, 0)        \
+  OP(0x7B, RRA, RRA, 7, ABSOLUTE_Y, 0)     \
+  OP(0x7C, NOP, NOP_MEM, 4, ABSOLUTE_X, 1) \
+  OP(0x7D, ADC, ADC, 4, ABSOLUTE_X, 1)     \
+  OP(0x7E, ROR, ROR_MEM, 7, ABSOLUTE_X, 0) \
+  OP(0x7F, RRA, RRA, 7, ABSOLUTE_X, 0)     \
+  OP(0x80, NOP, NOP_MEM, 2, IMMEDIATE, 0)  \
+  OP(0x81, STA, STA, 6, INDIRECT_X, 0)     \
+  OP(0x82, NOP, NOP_MEM, 2, IMMEDIATE, 0)  \
+  OP(0x83, SAX, SAX, 6, INDIRECT_X, 0)     \
+  OP(0x84, STY, STY, 3, ZEROPAGE, 0)       \
+  OP(0x85, STA, STA, 3, ZEROPAGE, 0)       \
+  OP(0x86, STX, STX, 3, ZEROPAGE, 0)       \
+  OP(0x87, SAX, SAX, 3, ZEROPAGE, 0)       \
+  OP(0x88, DEY, DEY, 2, IMPLIED, 0)        \
+  OP(0x89, NOP, NOP_MEM, 2, IMMEDIATE, 0)  \
+  OP(0x8A, TXA, TXA, 2, IMPLIED, 0)        \
+  OP(0x8B, XAA, XAA, 2, IMMEDIATE, 0)      \
+  OP(0x8C, STY, STY, 4, ABSOLUTE, 0)       \
+  OP(0x8D, STA, STA, 4, ABSOLUTE, 0)       \
+  OP(0x8E, STX, STX, 4, ABSOLUTE, 0)       \
+  OP(0x8F, SAX, SAX, 4, ABSOLUTE, 0)       \
+  OP(0x90, BCC, BCC, 2, RELATIVE, 1)       \
+  OP(0x91, STA, STA, 6, INDIRECT_Y, 0)     \
+  OP(0x92, JAM, JAM, 0, IMPLIED, 0)        \
+  OP(0x93, AHX, AHX, 6, INDIRECT_Y, 0)     \
+  OP(0x94, STY, STY, 4, ZEROPAGE_X, 0)     \
+  OP(0x95, STA, STA, 4, ZEROPAGE_X, 0)     \
+  OP(0x96, STX, STX, 4, ZEROPAGE_Y, 0)     \
+  OP(0x97, SAX, SAX, 4, ZEROPAGE_Y, 0)     \
+  OP(0x98, TYA, TYA, 2, IMPLIED, 0)        \
+  OP(0x99, STA, STA, 5, ABSOLUTE_Y, 0)     \
+  OP(0x9A, TXS, TXS, 2, IMPLIED, 0)        \
+  OP(0x9B, TAS, TAS, 5, ABSOLUTE_Y, 0)     \
+  OP(0x9C, SHY, SHY, 5, ABSOLUTE_X, 0)     \
+  OP(0x9D, STA, STA, 5, ABSOLUTE_X, 0)     \
+  OP(0x9E, SHX, SHX, 5, ABSOLUTE_Y, 0)     \
+  OP(0x9F, AHX, AHX, 5, ABSOLUTE_Y, 0)     \
+  OP(0xA0, LDY, LDY, 2, IMMEDIATE, 0)      \
+  OP(0xA1, LDA, LDA, 6, INDIRECT_X, 0)     \
+  OP(0xA2, LDX, LDX, 2, IMMEDIATE, 0)      \
+  OP(0xA3, LAX, LAX, 6, INDIRECT_X, 0)     \
+  OP(0xA4, LDY, LDY, 3, ZEROPAGE, 0)       \
+  OP(0xA5, LDA, LDA, 3, ZEROPAGE, 0)       \
+  OP(0xA6, LDX, LDX, 3, ZEROPAGE, 0)       \
+  OP(0xA7, LAX, LAX, 3, ZEROPAGE, 0)       \
+  OP(0xA8, TAY, TAY, 2, IMPLIED, 0)        \
+  OP(0xA9, LDA, LDA, 2, IMMEDIATE, 0)      \
+  OP(0xAA, TAX, TAX, 2, IMPLIED, 0)        \
+  OP(0xAB, LAX, LAX, 2, IMMEDIATE, 0)      \
+  OP(0xAC, LDY, LDY, 4, ABSOLUTE, 0)       \
+  OP(0xAD, LDA, LDA, 4, ABSOLUTE, 0)       \
+  OP(0xAE, LDX, LDX, 4, ABSOLUTE, 0)       \
+  OP(0xAF, LAX, LAX, 4, ABSOLUTE, 0)       \
+  OP(0xB0, BCS, BCS, 2, RELATIVE, 1)       \
+  OP(0xB1, LDA, LDA, 5, INDIRECT_Y, 1)     \
+  OP(0xB2, JAM, JAM, 0, IMPLIED, 0)        \
+  OP(0xB3, LAX, LAX, 5, INDIRECT_Y, 1)     \
+  OP(0xB4, LDY, LDY, 4, ZEROPAGE_X, 0)     \
+  OP(0xB5, LDA, LDA, 4, ZEROPAGE_X, 0)     \
+  OP(0xB6, LDX, LDX, 4, ZEROPAGE_Y, 0)     \
+  OP(0xB7, LAX, LAX, 4, ZEROPAGE_Y, 0)     \
+  OP(0xB8, CLV, CLV, 2, IMPLIED, 0)        \
+  OP(0xB9, LDA, LDA, 4, ABSOLUTE_Y, 1)     \
+  OP(0xBA, TSX, TSX, 2, IMPLIED, 0)        \
+  OP(0xBB, LAS, LAS, 4, ABSOLUTE_Y, 1)     \
+  OP(0xBC, LDY, LDY, 4, ABSOLUTE_X, 1)     \
+  OP(0xBD, LDA, LDA, 4, ABSOLUTE_X, 1)     \
+  OP(0xBE, LDX, LDX, 4, ABSOLUTE_Y, 1)     \
+  OP(0xBF, LAX, LAX, 4, ABSOLUTE_Y, 1)     \
+  OP(0xC0, CPY, CPY, 2, IMMEDIATE, 0)      \
+  OP(0xC1, CMP, CMP, 6, INDIRECT_X, 0)     \
+  OP(0xC2, NOP, NOP_MEM, 2, IMMEDIATE, 0)  \
+  OP(0xC3, DCP, DCP, 8, INDIRECT_X, 0)     \
+  OP(0xC4, CPY, CPY, 3, ZEROPAGE, 0)       \
+  OP(0xC5, CMP, CMP, 3, ZEROPAGE, 0)       \
+  OP(0xC6, DEC, DEC, 5, ZEROPAGE, 0)       \
+  OP(0xC7, DCP, DCP, 5, ZEROPAGE, 0)       \
+  OP(0xC8, INY, INY, 2, IMPLIED, 0)        \
+  OP(0xC9, CMP, CMP, 2, IMMEDIATE, 0)      \
+  OP(0xCA, DEX, DEX, 2, IMPLIED, 0)        \
+  OP(0xCB, AXS, AXS, 2, IMMEDIATE, 0)      \
+  OP(0xCC, CPY, CPY, 4, ABSOLUTE, 0)       \
+  OP(0xCD, CMP, CMP, 4, ABSOLUTE, 0)       \
+  OP(0xCE, DEC, DEC, 6, ABSOLUTE, 0)       \
+  OP(0xCF, DCP, DCP, 6, ABSOLUTE_X, 0)     \
+  OP(0xD0, BNE, BNE, 2, RELATIVE, 1)       \
+  OP(0xD1, CMP, CMP, 5, INDIRECT_Y, 1)     \
+  OP(0xD2, JAM, JAM, 0, IMPLIED, 0)        \
+  OP(0xD3, DCP, DCP, 8, INDIRECT_Y, 0)     \
+  OP(0xD4, NOP, NOP_MEM, 4, ZEROPAGE_X, 0) \
+  OP(0xD5, CMP, CMP, 4, ZEROPAGE_X, 0)     \
+  OP(0xD6, DEC, DEC, 6, ZEROPAGE_X, 0)     \
+  OP(0xD7, DCP, DCP, 6, ZEROPAGE_X, 0)     \
+  OP(0xD8, CLD, CLD, 2, IMPLIED, 0)        \
+  OP(0xD9, CMP, CMP, 4, ABSOLUTE_Y, 1)     \
+  OP(0xDA, NOP, NOP, 2, IMPLIED, 0)        \
+  OP(0xDB, DCP, DCP, 7, ABSOLUTE_Y, 0)     \
+  OP(0xDC, NOP, NOP_MEM, 4, ABSOLUTE_X, 1) \
+  OP(0xDD, CMP, CMP, 4, ABSOLUTE_X, 1)     \
+  OP(0xDE, DEC, DEC, 7, ABSOLUTE_X, 0)     \
+  OP(0xDF, DCP, DCP, 7, ABSOLUTE_X, 0)     \
+  OP(0xE0, CPX, CPX, 2, IMMEDIATE, 0)      \
+  OP(0xE1, SBC, SBC, 6, INDIRECT_X, 0)     \
+  OP(0xE2, NOP, NOP_MEM, 2, IMMEDIATE, 0)  \
+  OP(0xE3, ISC, ISC, 8, INDIRECT_X, 0)     \
+  OP(0xE4, CPX, CPX, 3, ZEROPAGE, 0)       \
+  OP(0xE5, SBC, SBC, 3, ZEROPAGE, 0)       \
+  OP(0xE6, INC, INC, 5, ZEROPAGE, 0)       \
+  OP(0xE7, ISC, ISC, 5, ZEROPAGE, 0)       \
+  OP(0xE8, INX, INX, 2, IMPLIED, 0)        \
+  OP(0xE9, SBC, SBC, 2, IMMEDIATE, 0)      \
+  OP(0xEA, NOP, NOP, 2, IMPLIED, 0)        \
+  OP(0xEB, SBC, USBC, 2, IMMEDIATE, 0)     \
+  OP(0xEC, CPX, CPX, 4, ABSOLUTE, 0)       \
+  OP(0xED, SBC, SBC, 4, ABSOLUTE, 0)       \
+  OP(0xEE, INC, INC, 6, ABSOLUTE, 0)       \
+  OP(0xEF, ISC, ISC, 6, ABSOLUTE, 0)       \
+  OP(0xF0, BEQ, BEQ, 2, RELATIVE, 1)       \
+  OP(0xF1, SBC, SBC, 5, INDIRECT_Y, 1)     \
+  OP(0xF2, JAM, JAM, 0, IMPLIED, 0)        \
+  OP(0xF3, ISC, ISC, 8, INDIRECT_Y, 0)     \
+  OP(0xF4, NOP, NOP_MEM, 4, ZEROPAGE_X, 0) \
+  OP(0xF5, SBC, SBC, 4, ZEROPAGE_X, 0)     \
+  OP(0xF6, INC, INC, 6, ZEROPAGE_X, 0)     \
+  OP(0xF7, ISC, ISC, 6, ZEROPAGE_X, 0)     \
+  OP(0xF8, SED, SED, 2, IMPLIED, 0)        \
+  OP(0xF9, SBC, SBC, 4, ABSOLUTE_Y, 1)     \
+  OP(0xFA, NOP, NOP, 2, IMPLIED, 0)        \
+  OP(0xFB, ISC, ISC, 7, ABSOLUTE_Y, 0)     \
+  OP(0xFC, NOP, NOP_MEM, 4, ABSOLUTE_X, 1) \
+  OP(0xFD, SBC, SBC, 4, ABSOLUTE_X, 1)     \
+  OP(0xFE, INC, INC, 7, ABSOLUTE_X, 0)     \
+  OP(0xFF, ISC, ISC, 7, IMPLIED, 0)
+
+#endif // _6510_OPCODES
@@ -0,0 +1,213 @@
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "cpu.h"
+#include "bus.h"
+#include "disasm.h"
+#include "profile.h"
+
+#ifdef PROFILER
+
+/*
+ * Sampling profiler, make PROFILE=1.
+ *
+ * Calls are followed on a shadow stack: JSR, BRK and interrupts push the
+ * routine they enter together with the SP after pushing the return
+ * address. A frame is left once SP has risen above that again, which
+ * covers RTS and RTI as well as code dropping its return address with PLA.
+ * Every distinct path of routines gets a node, so cycles can be reported
+ * per call path in the folded stack format of flamegraph.pl and friends.
+ */
+
+bool
+profile_start(MOS_6510* const c, uint32_t period)
+{
+  struct profile* const p = calloc(1, sizeof(struct profile));
+
+  if(p == NULL) return false;
+
+  free(c->profile);
+  c->profile = p;
+
+  p->period = period;
+  p->next_sample = c->cyc + period;
+
+  p->node_count = 1; // Root, whatever runs outside of any call
+  p->depth = 1;
+  return true;
+}
+
+void
+profile_stop(MOS_6510* const c)
+{
+  free(c->profile);
+  c->profile = NULL;
+}
+
+/* Names `first`-`last` in the report and in folded stacks, earlier ranges win where they overlap */
+
+bool
+profile_range(MOS_6510* const c, uint16_t first, uint16_t last, const char* name)
+{
+  struct profile* const p = c->profile;
+
+  if(p == NULL || p->range_count == PROFILE_RANGES || first > last) return false;
+
+  p->ranges[p->range_count++] = (struct profile_range){ first, last, name };
+  return true;
+}
+
+void
+profile_call(MOS_6510* const c, uint16_t routine)
+{
+  struct profile* const p = c->profile;
+
+  if(p == NULL) return;
+
+  profile_unwind(p, c->sp + 2); // SP before a JSR pushed its return address
+
+  /*
+   * Too deep: the call is charged to the innermost node. Its frame stays,
+   * it began above this call's SP, so it is left once this call and the
+   * routine it belongs to have returned, and no node gets deeper than the
+   * stack.
+   */
+  if(p->depth == PROFILE_DEPTH) return;
+
+  const uint16_t parent = p->stack[p->depth - 1].node;
+  uint16_t node = p->nodes[parent].child;
+
+  while(node && p->nodes[node].routine != routine) node = p->nodes[node].sibling;
+
+  if(node == 0 && p->node_count < PROFILE_NODES)
+  {
+    node = p->node_count++;
+    p->nodes[node] = (struct profile_node){ parent, 0, p->nodes[parent].child, routine, 0 };
+    p->nodes[parent].child = node;
+  }
+
+  if(node == 0) node = parent; // Out of nodes
+
+  p->stack[p->depth++] = (struct profile_frame){ node, c->sp };
+}
+
+static const struct profile_range*
+range_of(const struct profile* const p, uint16_t addr)
+{
+  for(uint8_t i = 0; i < p->range_count; i++)
+  {
+    if(addr >= p->ranges[i].first && addr <= p->ranges[i].last) return &p->ranges[i];
+  }
+
+  return NULL;
+}
+
+static void
+print_instruction(const MOS_6510* const c, FILE* out, uint16_t pc)
+{
+  const int opcode = bus_peek(c, pc);
+
+  if(opcode < 0)
+  {
+    fprintf(out, "$%04X  (I/O)                  ", pc);
+    return;
+  }
+
+  const uint8_t length = instruction_length(opcodes[opcode].address_mode);
+  uint8_t code[3] = { opcode, 0, 0 };
+  char bytes[10] = "";
+  char text[DISASM_TEXT];
+
+  for(uint8_t i = 0; i < length; i++)
+  {
+    const int byte = bus_peek(c, pc + i);
+    snprintf(bytes + 3 * i, sizeof(bytes) - 3 * i, byte < 0 ? "?? " : "%02X ", byte);
+    if(byte >= 0) code[i] = byte;
+  }
+
+  disassemble(text, pc, code);
+  fprintf(out, "$%04X  %-9s %-13s", pc, bytes, text);
+}
+
+/* The `top` most hit instructions, then the totals of every range */
+
+void
+profile_report(const MOS_6510* const c, FILE* out, unsigned top)
+{
+  const struct profile* const p = c->profile;
+
+  if(p == NULL) return;
+
+  uint16_t order[64];
+  unsigned n = 0;
+
+  if(top > 64) top = 64;
+
+  for(uint32_t pc = 0; pc < 0x10000; pc++)
+  {
+    if(p->hits[pc] == 0 || top == 0 || (n == top && p->hits[pc] <= p->hits[order[n - 1]])) continue;
+
+    unsigned i = n < top ? n++ : n - 1;
+    for(; i > 0 && p->hits[order[i - 1]] < p->hits[pc]; i--) order[i] = order[i - 1];
+    order[i] = pc;
+  }
+
+  fprintf(out, "%" PRIu64 " %s, top %u:\n", p->total, p->period ? "samples" : "cycles", n);
+
+  for(unsigned i = 0; i < n; i++)
+  {
+    const struct profile_range* const r = range_of(p, order[i]);
+
+    print_instruction(c, out, order[i]);
+    fprintf(out, "  %14" PRIu64 "  %5.1f%%  %s\n", p->hits[order[i]], 100.0 * p->hits[order[i]] / p->total, r ? r->name : "");
+  }
+
+  for(uint8_t i = 0; i < p->range_count; i++)
+  {
+    const struct profile_range* const r = &p->ranges[i];
+    uint64_t hits = 0;
+
+    for(uint32_t pc = r->first; pc <= r->last; pc++)
+    {
+      if(range_of(p, pc) == r) hits += p->hits[pc];
+    }
+
+    fprintf(out, "%-16s $%04X-$%04X  %14" PRIu64 "  %5.1f%%\n", r->name, r->first, r->last, hits,
+        p->total ? 100.0 * hits / p->total : 0);
+  }
+}
+
+/* One "root;caller;callee hits" line per call path, routines named by their range if they have one */
+
+void
+profile_folded(const MOS_6510* const c, FILE* out, const char* root)
+{
+  const struct profile* const p = c->profile;
+
+  if(p == NULL) return;
+
+  for(uint16_t node = 0; node < p->node_count; node++)
+  {
+    if(p->nodes[node].hits == 0) continue;
+
+    uint16_t path[PROFILE_DEPTH];
+    uint16_t depth = 0;
+
+    for(uint16_t n = node; n != 0 && depth < PROFILE_DEPTH; n = p->nodes[n].parent) path[depth++] = n;
+
+    fputs(root, out);
+
+    while(depth--)
+    {
+      const uint16_t routine = p->nodes[path[depth]].routine;
+      const struct profile_range* const r = range_of(p, routine);
+
+      if(r) fprintf(out, ";%s:$%04X", r->name, routine);
+      else fprintf(out, ";$%04X", routine);
+    }
+
+    fprintf(out, " %" PRIu64 "\n", p->nodes[node].hits);
+  }
+}
+
+#endif // PROFILER
@@ -0,0 +1,116 @@
+#ifndef _6510_PROFILE
+#define _6510_PROFILE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+
+#ifdef PROFILER
+
+#define PROFILE_DEPTH 64 // Nested calls followed, deeper ones are charged to the deepest
+#define PROFILE_NODES 4096 // Distinct call paths, new ones are charged to their caller when full
+#define PROFILE_RANGES 32
+
+/* Routine entered through JSR, BRK or an interrupt, and the SP its return address left */
+
+struct profile_frame
+{
+  uint16_t node;
+  uint8_t sp;
+};
+
+/* Call path, a child of `parent` for every routine called from it */
+
+struct profile_node
+{
+  uint16_t parent;
+  uint16_t child; // First callee, 0 if none
+  uint16_t sibling; // Next callee of the same parent, 0 if none
+  uint16_t routine; // Entry address
+  uint64_t hits; // Cycles (or samples) spent in the routine itself
+};
+
+struct profile_range
+{
+  uint16_t first, last;
+  const char* name;
+};
+
+/*
+ * Profile of one CPU (make PROFILE=1), see profile_start().
+ *
+ * hits[] is indexed by the address of the instruction. With a period of 0
+ * every instruction is charged its cycles, otherwise one hit is counted
+ * every `period` cycles for the instruction running at that moment.
+ */
+
+struct profile
+{
+  uint32_t period;
+  uint64_t next_sample;
+  uint64_t total;
+
+  uint64_t hits[0x10000];
+
+  struct profile_frame stack[PROFILE_DEPTH]; // stack[0] is the root node
+  uint8_t depth;
+
+  struct profile_node nodes[PROFILE_NODES];
+  uint16_t node_count;
+
+  struct profile_range ranges[PROFILE_RANGES];
+  uint8_t range_count;
+};
+
+bool profile_start(MOS_6510* const c, uint32_t period);
+void profile_stop(MOS_6510* const c);
+bool profile_range(MOS_6510* const c, uint16_t first, uint16_t last, const char* name);
+
+void profile_report(const MOS_6510* const c, FILE* out, unsigned top);
+void profile_folded(const MOS_6510* const c, FILE* out, const char* root);
+
+void profile_call(MOS_6510* const c, uint16_t routine);
+
+/* Leaves the frames whose return address has been pulled off the stack since */
+
+static inline void
+profile_unwind(struct profile* const p, uint8_t sp)
+{
+  while(p->depth > 1 && sp > p->stack[p->depth - 1].sp) p->depth--;
+}
+
+/*
+ * Called after every instruction with its address and the cycles it took,
+ * `op` is constant in the generated handlers so the call check folds away.
+ */
+
+static inline void
+profile_counted(MOS_6510* const c, uint8_t op, uint16_t pc, uint64_t elapsed)
+{
+  struct profile* const p = c->profile;
+
+  if(p == NULL) return;
+
+  uint64_t hits = elapsed;
+
+  if(p->period)
+  {
+    for(hits = 0; c->cyc >= p->next_sample; hits++) p->next_sample += p->period;
+  }
+
+  if(hits)
+  {
+    profile_unwind(p, c->sp);
+    p->hits[pc] += hits;
+    p->nodes[p->stack[p->depth - 1].node].hits += hits;
+    p->total += hits;
+  }
+
+  if(op == 0x00 || op == 0x20) profile_call(c, c->pc); // BRK, JSR
+}
+
+#endif // PROFILER
+
+#endif // _6510_PROFILE
@@ -0,0 +1,224 @@
+#include <stdlib.h>
+
+#include "cpu.h"
+#include "bus.h"
+#include "snapshot.h"
+#include "rewind.h"
+
+#ifdef REWIND
+
+/*
+ * Journals up to 2^steps_log2 steps and 2^writes_log2 writes, with a
+ * keyframe every `interval` steps of which the last `keyframes` are kept.
+ */
+
+bool
+rewind_start(MOS_6510* const c, uint8_t steps_log2, uint8_t writes_log2, uint32_t interval, uint16_t keyframes)
+{
+  if(c->rewind || steps_log2 > 30 || writes_log2 < 4 || writes_log2 > 30 || interval == 0 || keyframes == 0) return false;
+
+  struct rewind* const r = calloc(1, sizeof(struct rewind));
+  if(r == NULL) return false;
+
+  r->step_mask = (1ull << steps_log2) - 1;
+  r->write_mask = (1u << writes_log2) - 1;
+  r->interval = interval;
+  r->keyframe_count = keyframes;
+
+  r->steps = malloc((r->step_mask + 1) * sizeof(struct rewind_step));
+  r->writes = malloc(((uint64_t) r->write_mask + 1) * sizeof(struct rewind_write));
+  r->keyframes = calloc(keyframes, sizeof(struct rewind_keyframe));
+
+  if(r->steps == NULL || r->writes == NULL || r->keyframes == NULL)
+  {
+    free(r->steps);
+    free(r->writes);
+    free(r->keyframes);
+    free(r);
+    return false;
+  }
+
+  for(uint16_t i = 0; i < keyframes; i++) r->keyframes[i].step = UINT64_MAX;
+
+  c->rewind = r;
+#ifdef JIT_CORE
+  blocks_flush(c); // Translated blocks don't journal anything
+#endif
+  return true;
+}
+
+void
+rewind_stop(MOS_6510* const c)
+{
+  struct rewind* const r = c->rewind;
+
+  if(r == NULL) return;
+
+  for(uint16_t i = 0; i < r->keyframe_count; i++) snapshot_free(&r->keyframes[i].snapshot);
+
+  free(r->steps);
+  free(r->writes);
+  free(r->keyframes);
+  free(r);
+  c->rewind = NULL;
+}
+
+/* In front of every step */
+
+void
+rewind_record(MOS_6510* const c, bool interrupt)
+{
+  struct rewind* const r = c->rewind;
+
+  if(r->head % r->interval == 0)
+  {
+    struct rewind_keyframe* const k = &r->keyframes[r->head / r->interval % r->keyframe_count];
+
+    k->step = snapshot_save(c, &k->snapshot) ? r->head : UINT64_MAX;
+  }
+
+  if(r->head - r->floor > r->step_mask) r->floor++;
+
+  r->steps[r->head & r->step_mask] = (struct rewind_step){
+    c->cyc, r->write_head, c->pc, c->a, c->x, c->y, c->sp, get_flags(c), c->irq_status, interrupt, c->halted
+  };
+  r->head++;
+}
+
+/* In front of every write to plain memory */
+
+void
+rewind_journal(MOS_6510* const c, uint16_t addr, uint8_t old)
+{
+  struct rewind* const r = c->rewind;
+
+  /* The oldest steps go once the ring wraps onto their writes */
+  while(r->floor + 1 < r->head && r->write_head - r->steps[r->floor & r->step_mask].writes > r->write_mask) r->floor++;
+
+  r->writes[r->write_head++ & r->write_mask] = (struct rewind_write){ addr, old };
+}
+
+uint64_t
+rewind_available(const MOS_6510* const c)
+{
+  return c->rewind ? c->rewind->head - c->rewind->floor : 0;
+}
+
+/* Writes behind the journal's back, like wb() but without I/O */
+
+static void
+poke(MOS_6510* const c, uint16_t addr, uint8_t value)
+{
+  if(addr < 0x200)
+  {
+    c->low[addr] = value;
+    code_write(c, addr);
+    return;
+  }
+
+  uint8_t* const page = bus_writable(c, addr >> 8);
+
+  if(page)
+  {
+    page[addr & 0xFF] = value;
+    page_written(c, addr);
+    code_write(c, addr);
+  }
+}
+
+/* Goes back `count` steps, false if the journal doesn't reach that far */
+
+bool
+rewind_back(MOS_6510* const c, uint64_t count)
+{
+  struct rewind* const r = c->rewind;
+
+  if(r == NULL || count > r->head - r->floor) return false;
+  if(count == 0) return true;
+
+  const uint64_t target = r->head - count;
+  const struct rewind_keyframe* start = NULL;
+
+  for(uint16_t i = 0; i < r->keyframe_count; i++)
+  {
+    const struct rewind_keyframe* const k = &r->keyframes[i];
+
+    if(k->step >= target && k->step < r->head && (start == NULL || k->step < start->step)) start = k;
+  }
+
+  uint64_t step = r->head;
+
+  if(start)
+  {
+    snapshot_restore(c, &start->snapshot);
+    step = start->step;
+  }
+
+  /* Undo the writes of every step after the target, newest first */
+  while(step > target)
+  {
+    const struct rewind_step* const s = &r->steps[--step & r->step_mask];
+    const uint32_t end = step + 1 == r->head ? r->write_head : r->steps[(step + 1) & r->step_mask].writes;
+
+    for(uint32_t w = end; w != s->writes; )
+    {
+      const struct rewind_write* const write = &r->writes[--w & r->write_mask];
+      poke(c, write->addr, write->old);
+    }
+
+    if(!s->interrupt) c->instructions--;
+  }
+
+  const struct rewind_step* const s = &r->steps[target & r->step_mask];
+
+  c->a = s->a;
+  c->x = s->x;
+  c->y = s->y;
+  c->sp = s->sp;
+  set_flags(c, s->p);
+  c->pc = s->pc;
+  c->cyc = s->cyc;
+  c->halted = s->halted;
+  c->irq_status = s->irq_status;
+
+  /* What came after the target is history now */
+  for(uint16_t i = 0; i < r->keyframe_count; i++)
+  {
+    if(r->keyframes[i].step != UINT64_MAX && r->keyframes[i].step > target) r->keyframes[i].step = UINT64_MAX;
+  }
+
+  r->head = target;
+  r->write_head = s->writes;
+  return true;
+}
+
+/* Goes back to in front of the last step that wrote `addr`, false if it isn't in the journal */
+
+bool
+rewind_to_write(MOS_6510* const c, uint16_t addr)
+{
+  const struct rewind* const r = c->rewind;
+
+  if(r == NULL || r->head == r->floor) return false;
+
+  const uint32_t first = r->steps[r->floor & r->step_mask].writes;
+  uint32_t w = r->write_head;
+
+  while(w != first && r->writes[(w - 1) & r->write_mask].addr != addr) w--;
+  if(w == first) return false;
+
+  /* Last step whose writes start at or before the one found */
+  uint64_t low = r->floor, high = r->head - 1;
+
+  while(low < high)
+  {
+    const uint64_t middle = low + (high - low + 1) / 2;
+
+    if(r->steps[middle & r->step_mask].writes - first <= w - 1 - first) low = middle;
+    else high = middle - 1;
+  }
+
+  return rewind_back(c, r->head - low);
+}
+
+#endif // REWIND
@@ -0,0 +1,76 @@
+#ifndef _6510_REWIND
+#define _6510_REWIND
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+#include "snapshot.h"
+
+#ifdef REWIND
+
+/*
+ * Reverse stepping (make REWIND=1).
+ *
+ * Every step, an instruction or an interrupt sequence, journals the
+ * registers in front of it, and every wb() or stack push the address and
+ * the value it overwrote. Every `interval` steps a keyframe snapshot is
+ * taken as well. Going back restores the oldest keyframe that is not older
+ * than the target and undoes the journal from there, so no step is undone
+ * more than once per interval. Both journals are rings: once full, the
+ * oldest steps can't be gone back to anymore, which bounds the memory used.
+ * Writes to I/O handlers are not journaled and can't be undone.
+ */
+
+struct rewind_step
+{
+  uint64_t cyc;
+  uint32_t writes; // Journal position of the step's first write
+  uint16_t pc;
+  uint8_t a, x, y, sp, p;
+  uint8_t irq_status;
+  bool interrupt; // Not counted in c->instructions
+  bool halted; // In front of a reset() of a jammed CPU
+};
+
+struct rewind_write
+{
+  uint16_t addr;
+  uint8_t old;
+};
+
+struct rewind_keyframe
+{
+  uint64_t step; // Taken in front of this step, UINT64_MAX while unused
+  struct snapshot snapshot;
+};
+
+struct rewind
+{
+  struct rewind_step* steps;
+  uint64_t step_mask; // Ring size - 1, a power of two
+  uint64_t head; // Steps journaled so far
+  uint64_t floor; // Oldest step that can still be gone back to
+
+  struct rewind_write* writes;
+  uint32_t write_mask;
+  uint32_t write_head;
+
+  struct rewind_keyframe* keyframes;
+  uint16_t keyframe_count;
+  uint32_t interval;
+};
+
+bool rewind_start(MOS_6510* const c, uint8_t steps_log2, uint8_t writes_log2, uint32_t interval, uint16_t keyframes);
+void rewind_stop(MOS_6510* const c);
+
+uint64_t rewind_available(const MOS_6510* const c);
+bool rewind_back(MOS_6510* const c, uint64_t count);
+bool rewind_to_write(MOS_6510* const c, uint16_t addr);
+
+void rewind_record(MOS_6510* const c, bool interrupt);
+void rewind_journal(MOS_6510* const c, uint16_t addr, uint8_t old);
+
+#endif // REWIND
+
+#endif // _6510_REWIND
@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "bus.h"
+#include "snapshot.h"
+
+/* Gives every page written since the last snapshot a new version */
+
+static void
+commit(MOS_6510* const c)
+{
+  struct bus* const b = c->bus;
+
+  for(uint8_t i = 0; i < 32; i++)
+  {
+    for(uint8_t bits = c->written_pages[i]; bits; bits &= bits - 1)
+    {
+      b->version[i << 3 | __builtin_ctz(bits)] = ++b->versions;
+    }
+
+    c->written_pages[i] = 0;
+  }
+}
+
+/* False if there was no memory for the pages, the snapshot is of no use then */
+
+bool
+snapshot_save(MOS_6510* const c, struct snapshot* const s)
+{
+  const struct bus* const b = c->bus;
+
+  commit(c);
+
+  for(uint16_t page = 2; page < 0x100; page++)
+  {
+    const uint32_t version = b->version[page];
+    const uint8_t* const host = page_mapping(c->bus, page)->write;
+
+    if(version == s->version[page]) continue;
+
+    if(version && host)
+    {
+      if(s->pages[page] == NULL && (s->pages[page] = malloc(0x100)) == NULL) return false;
+      memcpy(s->pages[page], host, 0x100);
+    }
+
+    s->version[page] = version;
+  }
+
+  memcpy(s->low, c->low, sizeof(s->low));
+
+  s->a = c->a;
+  s->x = c->x;
+  s->y = c->y;
+  s->sp = c->sp;
+  s->p = get_flags(c);
+  s->pc = c->pc;
+  s->irq_status = c->irq_status;
+#ifdef CYCLE_CORE
+  s->irq_sampled = c->irq_sampled;
+#endif
+  s->halted = c->halted;
+  s->cyc = c->cyc;
+  s->instructions = c->instructions;
+  return true;
+}
+
+void
+snapshot_restore(MOS_6510* const c, const struct snapshot* const s)
+{
+  struct bus* const b = c->bus;
+
+  commit(c);
+
+  for(uint16_t page = 2; page < 0x100; page++)
+  {
+    if(b->version[page] == s->version[page]) continue;
+
+    const uint8_t* const saved = s->version[page] ? s->pages[page] : b->image[page];
+    uint8_t* const host = saved ? bus_writable(c, page) : NULL;
+
+    if(host) memcpy(host, saved, 0x100);
+
+    b->version[page] = s->version[page];
+    code_write(c, page << 8);
+  }
+
+  memcpy(c->low, s->low, sizeof(s->low));
+  code_write(c, 0x000);
+  code_write(c, 0x100);
+
+  c->a = s->a;
+  c->x = s->x;
+  c->y = s->y;
+  c->sp = s->sp;
+  set_flags(c, s->p);
+  c->pc = s->pc;
+  c->irq_status = s->irq_status;
+#ifdef CYCLE_CORE
+  c->irq_sampled = s->irq_sampled;
+#endif
+  c->halted = s->halted;
+  c->cyc = s->cyc;
+  c->instructions = s->instructions;
+}
+
+void
+snapshot_free(struct snapshot* const s)
+{
+  for(uint16_t page = 0; page < 0x100; page++)
+  {
+    free(s->pages[page]);
+    s->pages[page] = NULL;
+    s->version[page] = 0;
+  }
+}
@@ -0,0 +1,48 @@
+#ifndef _6510_SNAPSHOT
+#define _6510_SNAPSHOT
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+
+/*
+ * Saved CPU state plus memory, for rolling back to it any number of times.
+ *
+ * Memory is kept as page deltas against the bus' map_image() contents:
+ * wb() marks every page written, so saving only copies pages that changed
+ * since this snapshot was last saved into, and restoring only copies back
+ * those that changed since it was taken. Zero page and stack are saved
+ * whole. A snapshot belongs to one CPU and its memory map, I/O state isn't
+ * part of it. Start from a zeroed struct snapshot and snapshot_free() it
+ * when done.
+ *
+ * The CPU side is complete: registers, interrupt lines, a JAM and, with
+ * CORE=cycle, the lines sampled for the next instruction. Pending events
+ * are not, they belong to the devices that scheduled them like the rest of
+ * the I/O state, and a restore leaves the queue as it is.
+ */
+
+struct snapshot
+{
+  uint8_t a, x, y, sp, p;
+  uint16_t pc;
+  uint8_t irq_status;
+#ifdef CYCLE_CORE
+  uint8_t irq_sampled;
+#endif
+  bool halted;
+  uint64_t cyc;
+  uint64_t instructions;
+
+  uint8_t low[0x200];
+
+  uint32_t version[256]; // bus->version[] when saved
+  uint8_t* pages[256]; // Contents of the pages with a version, allocated as needed
+};
+
+bool snapshot_save(MOS_6510* const c, struct snapshot* const s);
+void snapshot_restore(MOS_6510* const c, const struct snapshot* const s);
+void snapshot_free(struct snapshot* const s);
+
+#endif // _6510_SNAPSHOT
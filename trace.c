@@ -0,0 +1,189 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "cpu.h"
+#include "disasm.h"
+#include "trace.h"
+
+#ifdef TRACER
+
+/* Saves whatever the CPU appended, in as few writes as the ring's wrap-around allows */
+
+static void*
+trace_writer(void* arg)
+{
+  struct trace* const t = arg;
+  const struct timespec nap = { 0, 100000 }; // 0.1ms
+
+  while(true)
+  {
+    const bool stop = atomic_load_explicit(&t->stop, memory_order_acquire);
+    const uint64_t head = atomic_load_explicit(&t->head, memory_order_acquire);
+    const uint64_t tail = atomic_load_explicit(&t->tail, memory_order_relaxed);
+
+    if(head == tail)
+    {
+      if(stop) return NULL;
+      nanosleep(&nap, NULL);
+      continue;
+    }
+
+    const uint64_t start = tail & t->mask;
+    uint64_t count = head - tail;
+
+    if(count > t->mask + 1 - start) count = t->mask + 1 - start;
+
+    fwrite(&t->ring[start], sizeof(struct trace_record), count, t->file);
+    atomic_store_explicit(&t->tail, tail + count, memory_order_release);
+  }
+}
+
+/* Records appended so far */
+
+static uint64_t
+appended(const MOS_6510* const c)
+{
+  const struct trace* const t = c->trace;
+
+  return t->batch + (c->trace_cursor - &t->ring[t->batch & t->mask]);
+}
+
+/*
+ * The current batch is full: publishes it and returns where the next one
+ * starts, once the writer has made room for it. Batches never wrap around
+ * the ring, which is a whole number of them.
+ */
+
+struct trace_record*
+trace_batch(MOS_6510* const c)
+{
+  struct trace* const t = c->trace;
+
+  t->batch += TRACE_BATCH;
+  atomic_store_explicit(&t->head, t->batch, memory_order_release);
+
+  if(t->file && t->batch + TRACE_BATCH - atomic_load_explicit(&t->tail, memory_order_acquire) > t->mask + 1)
+  {
+    while(t->batch + TRACE_BATCH - atomic_load_explicit(&t->tail, memory_order_acquire) > t->mask + 1) sched_yield();
+    t->stalls++;
+  }
+
+  c->trace_cursor = &t->ring[t->batch & t->mask];
+  c->trace_end = c->trace_cursor + TRACE_BATCH;
+  return c->trace_cursor;
+}
+
+/*
+ * Starts tracing into a ring of 2^size_log2 records. With a `path` a
+ * writer thread saves every record to that file, otherwise only the last
+ * 2^size_log2 are kept for trace_dump().
+ */
+
+bool
+trace_start(MOS_6510* const c, const char* path, uint8_t size_log2)
+{
+  if(c->trace || size_log2 > 30 || (1u << size_log2) < TRACE_BATCH) return false;
+
+  struct trace* const t = calloc(1, sizeof(struct trace));
+  if(t == NULL) return false;
+
+  t->mask = (1ull << size_log2) - 1;
+  t->ring = calloc(t->mask + 1, sizeof(struct trace_record));
+
+  if(t->ring && path)
+  {
+    const struct trace_header header = { TRACE_MAGIC, TRACE_VERSION, sizeof(struct trace_record) };
+
+    t->file = fopen(path, "wb");
+
+    if(t->file == NULL || fwrite(&header, sizeof(header), 1, t->file) != 1
+        || pthread_create(&t->writer, NULL, trace_writer, t) != 0)
+    {
+      if(t->file) fclose(t->file);
+      t->file = NULL;
+    }
+  }
+
+  if(t->ring == NULL || (path && t->file == NULL))
+  {
+    free(t->ring);
+    free(t);
+    return false;
+  }
+
+  c->trace = t;
+  c->trace_cursor = t->ring;
+  c->trace_end = t->ring + TRACE_BATCH;
+#ifdef JIT_CORE
+  blocks_flush(c); // Translated blocks don't record anything
+#endif
+  return true;
+}
+
+/* Saves what is left, false if the file couldn't be written completely */
+
+bool
+trace_stop(MOS_6510* const c)
+{
+  struct trace* const t = c->trace;
+  bool saved = true;
+
+  if(t == NULL) return true;
+
+  if(t->file)
+  {
+    atomic_store_explicit(&t->head, appended(c), memory_order_release); // The last batch isn't full
+    atomic_store_explicit(&t->stop, true, memory_order_release);
+    pthread_join(t->writer, NULL);
+    saved = !ferror(t->file);
+    saved &= fclose(t->file) == 0;
+  }
+
+  free(t->ring);
+  free(t);
+  c->trace = NULL;
+  c->trace_cursor = NULL;
+  c->trace_end = NULL;
+  return saved;
+}
+
+/* P of a record, packed like get_flags() does */
+
+uint8_t
+trace_flags(const struct trace_record* const r)
+{
+  const bool v = ~(r->v_a ^ r->v_b) & (r->v_a ^ r->v_r) & 0x80;
+
+  return (r->zn >> 15) << 7 | v << 6 | 1 << 5 | r->bf << 4 | r->df << 3 | r->idf << 2
+    | ((r->zn & 0xFF) == 0) << 1 | r->cf;
+}
+
+/* The last `count` instructions traced, oldest first. Operands and pointers are shown as memory holds them now */
+
+void
+trace_dump(const MOS_6510* const c, FILE* out, uint32_t count)
+{
+  const struct trace* const t = c->trace;
+
+  if(t == NULL) return;
+
+  const uint64_t head = appended(c);
+
+  if(count > head) count = head;
+  if(count > t->mask + 1) count = t->mask + 1;
+
+  for(uint64_t i = head - count; i < head; i++)
+  {
+    const struct trace_record* const r = &t->ring[i & t->mask];
+    char text[DISASM_TEXT];
+
+    disassemble_at(text, c, r->pc, r->x, r->y);
+    fprintf(out, "[0x%04X] [%02X] %-20s A: %02X X: %02X Y: %02X SP: %02X P: %02X CYC: %" PRIu64 "\n",
+        r->pc, r->opcode, text, r->a, r->x, r->y, r->sp, trace_flags(r), r->cyc);
+  }
+}
+
+#endif // TRACER
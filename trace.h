@@ -0,0 +1,83 @@
+#ifndef _6510_TRACE
+#define _6510_TRACE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "cpu.h"
+
+#ifdef TRACER
+
+/*
+ * Execution trace (make TRACE=1), one record per instruction with the state
+ * in front of it. Trace files start with a struct trace_header followed by
+ * the records, both in host byte order. Flags are stored the way the CPU
+ * keeps them, so recording is only copies, trace_flags() packs them into P.
+ */
+
+/* Fields next to each other are never next to each other in the CPU, except B, D, I and V, see trace_instruction() */
+
+struct trace_record
+{
+  uint16_t pc;
+  uint16_t zn; // Lazy N and Z
+  uint8_t a, opcode, x;
+  bool cf;
+  uint8_t y;
+  bool bf, df, idf;
+  uint8_t v_a, v_b, v_r; // Lazy V
+  uint8_t sp;
+  uint64_t cyc;
+};
+
+#define TRACE_MAGIC "6510TRC"
+#define TRACE_VERSION 2
+
+#define TRACE_BATCH 64 // Records appended before the writer gets to see them, a power of two
+
+struct trace_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+};
+
+/*
+ * Single producer, single consumer ring: the CPU appends at its
+ * `trace_cursor`, kept in MOS_6510 to spare a load per record, and
+ * publishes what it appended as `head` whenever a batch of TRACE_BATCH
+ * records is full, the writer thread saves records up to `head` and moves
+ * `tail` after them. Without a file nothing is saved and the ring just
+ * keeps the most recent records for trace_dump().
+ */
+
+struct trace
+{
+  struct trace_record* ring;
+  uint64_t mask; // Ring size - 1, a power of two and at least a batch
+
+  uint64_t batch; // Records appended before the current batch
+
+  _Atomic uint64_t head;
+  _Atomic uint64_t tail;
+  uint64_t stalls; // Times the CPU waited for the writer
+
+  FILE* file;
+  pthread_t writer;
+  _Atomic bool stop;
+};
+
+bool trace_start(MOS_6510* const c, const char* path, uint8_t size_log2);
+bool trace_stop(MOS_6510* const c);
+void trace_dump(const MOS_6510* const c, FILE* out, uint32_t count);
+
+uint8_t trace_flags(const struct trace_record* const r);
+
+struct trace_record* trace_batch(MOS_6510* const c);
+
+#endif // TRACER
+
+#endif // _6510_TRACE